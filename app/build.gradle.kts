@@ -8,6 +8,10 @@ plugins {
 // Single source of truth for library version
 val libraryVersion = "0.1.7"
 
+// Native build switches from gradle.properties or -P, passed to CMake as ON/OFF
+fun boolProperty(name: String, default: Boolean = false): String =
+    if ((findProperty(name) as String?)?.toBoolean() ?: default) "ON" else "OFF"
+
 android {
     namespace = "org.codeshipping.llamakotlin"
     compileSdk = 36
@@ -29,7 +33,14 @@ android {
                     "-DLLAMA_BUILD_TESTS=OFF",
                     "-DLLAMA_BUILD_EXAMPLES=OFF",
                     "-DLLAMA_BUILD_SERVER=OFF",
-                    "-DLIBRARY_VERSION=$libraryVersion"
+                    "-DLIBRARY_VERSION=$libraryVersion",
+                    // Optional GPU backends, e.g. ./gradlew assembleRelease -Pllama.vulkan=true
+                    "-DLLAMA_ANDROID_VULKAN=${boolProperty("llama.vulkan")}",
+                    "-DLLAMA_ANDROID_OPENCL=${boolProperty("llama.opencl")}",
+                    "-DLLAMA_ANDROID_BACKEND_DL=${boolProperty("llama.backendDl")}",
+                    "-DLLAMA_ANDROID_CPU_VARIANTS=${boolProperty("llama.cpuVariants", default = true)}",
+                    "-DLLAMA_ANDROID_JSON_SCHEMA=${boolProperty("llama.jsonSchema", default = true)}",
+                    "-DLLAMA_ANDROID_TRACING=${boolProperty("llama.tracing")}"
                 )
             }
         }
@@ -9,6 +9,12 @@
 -keep class org.codeshipping.llamakotlin.LlamaModel { *; }
 -keep class org.codeshipping.llamakotlin.LlamaConfig { *; }
 -keep class org.codeshipping.llamakotlin.LlamaNative { *; }
+# NativeConfig and the callbacks are resolved by name in JNI_OnLoad
+-keep class org.codeshipping.llamakotlin.LlamaNative$* { *; }
+
+# Constructed from native code
+-keep class org.codeshipping.llamakotlin.BackendDevice { <init>(...); }
+-keep class org.codeshipping.llamakotlin.LoadPlan { <init>(...); }
 
 # Keep exception classes
 -keep class org.codeshipping.llamakotlin.exception.** { *; }
@@ -0,0 +1,179 @@
+#include "async_generation.h"
+
+#include <android/log.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#define LOG_TAG "LlamaAsync"
+#ifdef NDEBUG
+#define LOGD(...) ((void)0)
+#else
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#endif
+
+namespace llamaandroid {
+
+namespace {
+size_t roundUpPow2(size_t n) {
+    size_t size = 64;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+bool isContinuation(char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+// Bounds every slow-path wait, so a missed wakeup costs at most this much
+constexpr auto kWaitSlice = std::chrono::milliseconds(10);
+} // namespace
+
+TokenRing::TokenRing(size_t capacity)
+    : data_(roundUpPow2(capacity)),
+      mask_(data_.size() - 1) {
+}
+
+void TokenRing::notify(std::atomic<bool>& waiting) {
+    if (waiting.load()) {
+        std::lock_guard<std::mutex> lock(waitMutex_);
+        cv_.notify_all();
+    }
+}
+
+bool TokenRing::write(const char* data, size_t size) {
+    size_t written = 0;
+    while (written < size) {
+        if (abandoned_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        const size_t head = head_.load(std::memory_order_relaxed);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        size_t n = std::min(data_.size() - (head - tail), size - written);
+        // Publish whole characters only, the rest goes in once there is room for it
+        if (written + n < size) {
+            while (n > 0 && isContinuation(data[written + n])) {
+                n--;
+            }
+        }
+
+        if (n == 0) {
+            // Full: wait for the consumer to read something
+            std::unique_lock<std::mutex> lock(waitMutex_);
+            producerWaiting_.store(true);
+            cv_.wait_for(lock, kWaitSlice, [&] {
+                return abandoned_.load() || tail_.load(std::memory_order_acquire) != tail;
+            });
+            producerWaiting_.store(false);
+            continue;
+        }
+
+        const size_t offset = head & mask_;
+        const size_t first = std::min(n, data_.size() - offset);
+        memcpy(data_.data() + offset, data + written, first);
+        memcpy(data_.data(), data + written + first, n - first);
+        head_.store(head + n, std::memory_order_release);
+        written += n;
+        notify(consumerWaiting_);
+    }
+    return true;
+}
+
+void TokenRing::close() {
+    closed_.store(true, std::memory_order_release);
+    notify(consumerWaiting_);
+}
+
+size_t TokenRing::read(char* dst, size_t capacity) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    const size_t available = head_.load(std::memory_order_acquire) - tail;
+    size_t n = std::min(available, capacity);
+    if (n < available) {
+        while (n > 0 && isContinuation(data_[(tail + n) & mask_])) {
+            n--;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    const size_t offset = tail & mask_;
+    const size_t first = std::min(n, data_.size() - offset);
+    memcpy(dst, data_.data() + offset, first);
+    memcpy(dst + first, data_.data(), n - first);
+    tail_.store(tail + n, std::memory_order_release);
+    notify(producerWaiting_);
+    return n;
+}
+
+bool TokenRing::waitReadable(int timeoutMs) {
+    auto ready = [this] {
+        return closed_.load(std::memory_order_acquire) ||
+               head_.load(std::memory_order_acquire) != tail_.load(std::memory_order_relaxed);
+    };
+    if (ready()) {
+        return true;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    std::unique_lock<std::mutex> lock(waitMutex_);
+    consumerWaiting_.store(true);
+    while (!ready() && std::chrono::steady_clock::now() < deadline) {
+        cv_.wait_until(lock, std::min(deadline, std::chrono::steady_clock::now() + kWaitSlice));
+    }
+    consumerWaiting_.store(false);
+    return ready();
+}
+
+void TokenRing::abandon() {
+    abandoned_.store(true, std::memory_order_release);
+    notify(producerWaiting_);
+}
+
+bool TokenRing::finished() const {
+    // closed_ first: once it is set, head_ holds the final count
+    return closed_.load(std::memory_order_acquire) &&
+           head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed);
+}
+
+AsyncGeneration::AsyncGeneration(size_t ringCapacity, Task task)
+    : ring_(ringCapacity) {
+    worker_ = std::thread([this, task = std::move(task)] {
+        const Sink sink = [this](const std::string& text) {
+            ring_.write(text.data(), text.size());
+        };
+        const Progress progress = [this](int processed, int total) {
+            total_.store(total, std::memory_order_relaxed);
+            processed_.store(processed, std::memory_order_relaxed);
+        };
+        error_ = task(sink, progress);
+        ring_.close();
+        LOGD("Async generation finished%s", error_.empty() ? "" : " with an error");
+    });
+}
+
+AsyncGeneration::~AsyncGeneration() {
+    join();
+}
+
+long AsyncGeneration::poll(char* dst, size_t capacity) {
+    const size_t n = ring_.read(dst, capacity);
+    if (n == 0 && ring_.finished()) {
+        return -1;
+    }
+    return (long)n;
+}
+
+std::string AsyncGeneration::join() {
+    ring_.abandon();
+    std::lock_guard<std::mutex> lock(joinMutex_);
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    return error_;
+}
+
+} // namespace llamaandroid
@@ -0,0 +1,146 @@
+#ifndef LLAMA_ASYNC_GENERATION_H
+#define LLAMA_ASYNC_GENERATION_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstddef>
+
+namespace llamaandroid {
+
+/**
+ * Single-producer / single-consumer byte ring for generated UTF-8 text.
+ * The data path is lock-free (one atomic index per side); the mutex and condition variable
+ * are only touched when the producer finds the ring full or the consumer waits for data.
+ * Text is published at character boundaries, so a read never returns half a character.
+ */
+class TokenRing {
+public:
+    /**
+     * @param capacity Rounded up to a power of two
+     */
+    explicit TokenRing(size_t capacity);
+
+    /**
+     * Producer: append text made of complete UTF-8 characters, waiting while the ring is full
+     * (back-pressure on decoding when the consumer falls behind by a whole ring)
+     * @return false if the consumer abandoned the ring; the text is dropped
+     */
+    bool write(const char* data, size_t size);
+
+    /**
+     * Producer: no more data will be written
+     */
+    void close();
+
+    /**
+     * Consumer: copy up to capacity bytes of the available text, never blocks
+     * @param capacity At least 4, so a whole character always fits
+     * @return Number of bytes copied, 0 if nothing is available right now
+     */
+    size_t read(char* dst, size_t capacity);
+
+    /**
+     * Consumer: wait until text is available or the producer closed the ring
+     * @return true if a read() would now return data or the ring is finished
+     */
+    bool waitReadable(int timeoutMs);
+
+    /**
+     * Consumer: stop reading; unblocks a producer waiting for space
+     */
+    void abandon();
+
+    /**
+     * Closed by the producer and fully read
+     */
+    bool finished() const;
+
+private:
+    void notify(std::atomic<bool>& waiting);
+
+    std::vector<char> data_;
+    const size_t mask_;
+
+    // Monotonic byte counters; index = counter & mask_
+    alignas(64) std::atomic<size_t> head_{0};   // Written by the producer
+    alignas(64) std::atomic<size_t> tail_{0};   // Read by the consumer
+
+    std::atomic<bool> closed_{false};
+    std::atomic<bool> abandoned_{false};
+
+    // Slow path only
+    std::mutex waitMutex_;
+    std::condition_variable cv_;
+    std::atomic<bool> producerWaiting_{false};
+    std::atomic<bool> consumerWaiting_{false};
+};
+
+/**
+ * A generation running on its own native thread.
+ *
+ * The task decodes and writes text into a TokenRing that the caller drains with poll(), so
+ * decoding never waits on the collector (unless it lags a whole ring behind) and no JVM
+ * callback runs on the decode thread. Prefill progress is published through atomics.
+ */
+class AsyncGeneration {
+public:
+    using Sink = std::function<void(const std::string&)>;
+    using Progress = std::function<void(int processed, int total)>;
+    /**
+     * Runs on the worker thread
+     * @return Error message, empty on success
+     */
+    using Task = std::function<std::string(const Sink& sink, const Progress& progress)>;
+
+    AsyncGeneration(size_t ringCapacity, Task task);
+
+    /**
+     * Joins the worker; the task must react to cancellation
+     */
+    ~AsyncGeneration();
+
+    AsyncGeneration(const AsyncGeneration&) = delete;
+    AsyncGeneration& operator=(const AsyncGeneration&) = delete;
+
+    /**
+     * Copy the text generated since the last poll, never blocks
+     * @return Bytes copied; 0 if none are available yet; -1 once the generation finished
+     *         and everything was read
+     */
+    long poll(char* dst, size_t capacity);
+
+    /**
+     * Block until poll() has something to return, at most timeoutMs
+     */
+    bool await(int timeoutMs) { return ring_.waitReadable(timeoutMs); }
+
+    /**
+     * Latest prefill progress: prompt tokens processed and total (0 / 0 before the first report)
+     */
+    int processed() const { return processed_.load(std::memory_order_relaxed); }
+    int total() const { return total_.load(std::memory_order_relaxed); }
+
+    /**
+     * Wait for the worker to end. Text not polled yet is dropped, so a producer blocked on
+     * a full ring (collector gone after a cancel) can't keep the worker alive.
+     * @return The task's error message, empty on success
+     */
+    std::string join();
+
+private:
+    TokenRing ring_;
+    std::atomic<int> processed_{0};
+    std::atomic<int> total_{0};
+    std::string error_;
+    std::mutex joinMutex_;      // join() may race between the owner and context teardown
+    std::thread worker_;
+};
+
+} // namespace llamaandroid
+
+#endif // LLAMA_ASYNC_GENERATION_H
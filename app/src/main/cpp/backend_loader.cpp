@@ -0,0 +1,144 @@
+#include "backend_loader.h"
+
+#include <android/log.h>
+#include <mutex>
+
+#if LLAMA_BACKEND_CPU_VARIANTS && defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#define LOG_TAG "LlamaBackend"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+
+namespace llamaandroid {
+
+#if LLAMA_AVAILABLE
+
+#if LLAMA_BACKEND_DL
+namespace {
+// Library names resolve through the app's native library directory (also from inside the APK)
+bool loadBackendLibrary(const char* name) {
+    ggml_backend_reg_t reg = ggml_backend_load(name);
+    if (reg == nullptr) {
+        LOGW("Backend %s not available", name);
+        return false;
+    }
+    LOGI("Loaded backend %s (%s)", ggml_backend_reg_name(reg), name);
+    return true;
+}
+
+#if LLAMA_BACKEND_CPU_VARIANTS && defined(__aarch64__)
+/**
+ * Load the most capable CPU kernel variant this core supports.
+ * Variants are the GGML_CPU_ALL_VARIANTS Android set; a variant must never be loaded on a
+ * CPU without its features, it would crash with SIGILL on the first matmul.
+ */
+bool loadCpuVariant() {
+    const unsigned long hwcap = getauxval(AT_HWCAP);
+    const unsigned long hwcap2 = getauxval(AT_HWCAP2);
+    const bool dotprod = (hwcap & HWCAP_ASIMDDP) != 0;
+    const bool fp16 = (hwcap & HWCAP_ASIMDHP) != 0;
+    const bool i8mm = (hwcap2 & HWCAP2_I8MM) != 0;
+    const bool sve2 = (hwcap & HWCAP_SVE) != 0 && (hwcap2 & HWCAP2_SVE2) != 0;
+    LOGI("CPU features: dotprod=%d fp16=%d i8mm=%d sve2=%d", dotprod, fp16, i8mm, sve2);
+    
+    struct Variant {
+        const char* library;
+        bool supported;
+    };
+    const Variant variants[] = {
+        {"libggml-cpu-android_armv9.0_1.so", dotprod && fp16 && i8mm && sve2},
+        {"libggml-cpu-android_armv8.6_1.so", dotprod && fp16 && i8mm},
+        {"libggml-cpu-android_armv8.2_2.so", dotprod && fp16},
+        {"libggml-cpu-android_armv8.2_1.so", dotprod},
+        {"libggml-cpu-android_armv8.0_1.so", true},
+    };
+    for (const Variant& variant : variants) {
+        if (variant.supported && loadBackendLibrary(variant.library)) {
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+} // namespace
+#endif
+
+void loadBackends() {
+    static std::once_flag once;
+    std::call_once(once, [] {
+#if LLAMA_BACKEND_DL
+        // GPU backends first so llama.cpp prefers them for offloaded layers
+#if LLAMA_BACKEND_VULKAN
+        loadBackendLibrary("libggml-vulkan.so");
+#endif
+#if LLAMA_BACKEND_OPENCL
+        loadBackendLibrary("libggml-opencl.so");
+#endif
+#if LLAMA_BACKEND_CPU_VARIANTS && defined(__aarch64__)
+        if (!loadCpuVariant() && !loadBackendLibrary("libggml-cpu.so")) {
+#else
+        if (!loadBackendLibrary("libggml-cpu.so")) {
+#endif
+            LOGW("No CPU backend could be loaded");
+        }
+#endif
+        LOGI("%zu backend(s), %zu device(s) registered", ggml_backend_reg_count(), ggml_backend_dev_count());
+    });
+}
+
+std::vector<BackendDevice> listBackendDevices() {
+    loadBackends();
+    
+    std::vector<BackendDevice> devices;
+    for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        BackendDevice device;
+        device.name = ggml_backend_dev_name(dev);
+        device.description = ggml_backend_dev_description(dev);
+        device.backend = ggml_backend_reg_name(ggml_backend_dev_backend_reg(dev));
+        device.type = (int)ggml_backend_dev_type(dev);
+        ggml_backend_dev_memory(dev, &device.memoryFree, &device.memoryTotal);
+        devices.push_back(device);
+    }
+    return devices;
+}
+
+ggml_backend_dev_t findBackendDevice(const std::string& name) {
+    for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+        if (name == ggml_backend_dev_name(dev)) {
+            return dev;
+        }
+    }
+    return nullptr;
+}
+
+bool hasGpuDevice() {
+    for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+        if (ggml_backend_dev_type(ggml_backend_dev_get(i)) != GGML_BACKEND_DEVICE_TYPE_CPU) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#else
+
+void loadBackends() {
+}
+
+std::vector<BackendDevice> listBackendDevices() {
+    // Stub build - report a single CPU device
+    BackendDevice cpu;
+    cpu.name = "CPU";
+    cpu.description = "Stub CPU device";
+    cpu.backend = "CPU";
+    return {cpu};
+}
+
+#endif // LLAMA_AVAILABLE
+
+} // namespace llamaandroid
@@ -0,0 +1,56 @@
+#ifndef LLAMA_BACKEND_LOADER_H
+#define LLAMA_BACKEND_LOADER_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#if LLAMA_AVAILABLE
+#include "ggml-backend.h"
+#endif
+
+namespace llamaandroid {
+
+/**
+ * A ggml compute device (CPU, GPU, accelerator) available to llama.cpp
+ */
+struct BackendDevice {
+    std::string name;           // Device name used by LlamaConfig::gpuDevice, e.g. "Vulkan0"
+    std::string description;    // Human readable, e.g. the GPU model
+    std::string backend;        // Backend providing the device, e.g. "Vulkan", "OpenCL", "CPU"
+    int type = 0;               // 0 = CPU, 1 = GPU, 2 = integrated GPU, 3 = accelerator
+    size_t memoryFree = 0;
+    size_t memoryTotal = 0;
+};
+
+/**
+ * Register the ggml backends once per process.
+ * In LLAMA_BACKEND_DL builds the backends are separate libraries and are loaded by name;
+ * a GPU backend that fails to load (missing driver, unsupported device) is skipped and
+ * inference falls back to the CPU. With LLAMA_BACKEND_CPU_VARIANTS the CPU backend is picked
+ * from several builds (dotprod, i8mm, SVE2) by the features reported in AT_HWCAP.
+ * With statically linked backends this is a no-op.
+ */
+void loadBackends();
+
+/**
+ * Devices of all registered backends
+ */
+std::vector<BackendDevice> listBackendDevices();
+
+#if LLAMA_AVAILABLE
+/**
+ * Find a registered device by name
+ * @return Device, or nullptr if not found
+ */
+ggml_backend_dev_t findBackendDevice(const std::string& name);
+
+/**
+ * Whether any GPU or accelerator device is registered
+ */
+bool hasGpuDevice();
+#endif
+
+} // namespace llamaandroid
+
+#endif // LLAMA_BACKEND_LOADER_H
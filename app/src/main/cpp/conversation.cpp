@@ -0,0 +1,194 @@
+#include "conversation.h"
+#include "trace.h"
+
+#include <android/log.h>
+
+#define LOG_TAG "LlamaConversation"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+
+namespace llamaandroid {
+
+#if LLAMA_AVAILABLE
+namespace {
+bool startsWith(const std::string& text, const std::string& prefix) {
+    return text.size() >= prefix.size() && text.compare(0, prefix.size(), prefix) == 0;
+}
+} // namespace
+
+Conversation::Conversation(std::shared_ptr<llama_model> model)
+    : model_(std::move(model)),
+      template_(llama_model_chat_template(model_.get(), nullptr)),
+      formatBuf_(4096) {
+}
+
+bool Conversation::format(size_t n, bool addGenerationPrompt, std::string& out) {
+    std::vector<llama_chat_message> messages(n);
+    for (size_t i = 0; i < n; i++) {
+        messages[i] = {roles_[i].c_str(), contents_[i].c_str()};
+    }
+
+    int result = llama_chat_apply_template(template_, messages.data(), n, addGenerationPrompt,
+                                           formatBuf_.data(), (int32_t)formatBuf_.size());
+    if (result > (int)formatBuf_.size()) {
+        // The buffer grows with the history and is kept for the next turn
+        formatBuf_.resize((size_t)result * 2);
+        result = llama_chat_apply_template(template_, messages.data(), n, addGenerationPrompt,
+                                           formatBuf_.data(), (int32_t)formatBuf_.size());
+    }
+    if (result < 0) {
+        return false;
+    }
+    out.assign(formatBuf_.data(), (size_t)result);
+    return true;
+}
+
+bool Conversation::tokenize(const std::string& text, size_t offset, std::vector<llama_token>& out) {
+    LLAMA_TRACE_SCOPE("llama:tokenize");
+    const size_t length = text.size() - offset;
+    if (length == 0) {
+        return true;
+    }
+
+    // Same bound as LlamaContextWrapper::tokenizeInto(): every token covers at least one byte
+    const size_t start = out.size();
+    out.resize(start + length + 4);
+    const int n = llama_tokenize(llama_model_get_vocab(model_.get()), text.data() + offset, (int32_t)length,
+                                 out.data() + start, (int32_t)(length + 4), false, true);
+    if (n < 0) {
+        out.resize(start);
+        return false;
+    }
+    out.resize(start + (size_t)n);
+    return true;
+}
+
+bool Conversation::rebuild() {
+    // Message boundaries are unknown now: the whole history counts as the latest message,
+    // which only turns off turn-aware truncation
+    tokens_.clear();
+    if (!tokenize(formatted_, 0, tokens_)) {
+        turnEnds_.assign(roles_.size(), 0);
+        return false;
+    }
+    turnEnds_.assign(roles_.size(), 0);
+    if (!turnEnds_.empty()) {
+        turnEnds_.back() = tokens_.size();
+    }
+    LOGW("Chat template is not prefix-stable, history tokenized again (%zu tokens)", tokens_.size());
+    return true;
+}
+
+int Conversation::append(const std::string& role, const std::string& content, std::string& error) {
+    roles_.push_back(role);
+    contents_.push_back(content);
+    genPromptMessages_ = 0;
+
+    std::string full;
+    if (!format(roles_.size(), false, full)) {
+        roles_.pop_back();
+        contents_.pop_back();
+        error = "Failed to apply chat template";
+        return -1;
+    }
+
+    const size_t before = tokens_.size();
+    if (startsWith(full, formatted_)) {
+        // Usual case: the new message only appended text to the formatted history
+        if (!tokenize(full, formatted_.size(), tokens_)) {
+            roles_.pop_back();
+            contents_.pop_back();
+            error = "Failed to tokenize message";
+            return -1;
+        }
+        turnEnds_.push_back(tokens_.size());
+        formatted_ = std::move(full);
+        return (int)(tokens_.size() - before);
+    }
+
+    // rebuild() replaces the whole history, put it back if that fails
+    std::string savedFormatted = std::move(formatted_);
+    std::vector<llama_token> savedTokens = std::move(tokens_);
+    std::vector<size_t> savedTurnEnds = std::move(turnEnds_);
+    formatted_ = std::move(full);
+    tokens_.clear();
+    if (!rebuild()) {
+        formatted_ = std::move(savedFormatted);
+        tokens_ = std::move(savedTokens);
+        turnEnds_ = std::move(savedTurnEnds);
+        roles_.pop_back();
+        contents_.pop_back();
+        error = "Failed to tokenize conversation";
+        return -1;
+    }
+    return tokens_.size() > before ? (int)(tokens_.size() - before) : 0;
+}
+
+bool Conversation::promptTurns(std::vector<std::vector<llama_token>>& turns, std::string& error) {
+    turns.clear();
+    if (roles_.empty()) {
+        error = "Conversation has no messages";
+        return false;
+    }
+
+    if (genPromptMessages_ != roles_.size()) {
+        std::string full;
+        if (!format(roles_.size(), true, full) || !startsWith(full, formatted_)) {
+            error = "Failed to apply chat template";
+            return false;
+        }
+        genPrompt_ = full.substr(formatted_.size());
+        genPromptTokens_.clear();
+        if (!tokenize(genPrompt_, 0, genPromptTokens_)) {
+            error = "Failed to tokenize generation prompt";
+            return false;
+        }
+        genPromptMessages_ = roles_.size();
+    }
+
+    size_t begin = 0;
+    for (size_t end : turnEnds_) {
+        turns.emplace_back(tokens_.begin() + begin, tokens_.begin() + end);
+        begin = end;
+    }
+    turns.back().insert(turns.back().end(), genPromptTokens_.begin(), genPromptTokens_.end());
+    return true;
+}
+
+void Conversation::appendReply(const std::vector<llama_token>& tokens, const std::string& text) {
+    roles_.push_back("assistant");
+    contents_.push_back(text);
+
+    std::string full;
+    if (!format(roles_.size(), false, full)) {
+        LOGW("Failed to apply chat template to the reply, reply not recorded");
+        roles_.pop_back();
+        contents_.pop_back();
+        return;
+    }
+
+    const std::string prompted = formatted_ + genPrompt_;
+    if (genPromptMessages_ == roles_.size() - 1 && startsWith(full, prompted) &&
+        full.compare(prompted.size(), text.size(), text) == 0) {
+        // The template kept the reply verbatim: reuse the sampled tokens, which are also what the
+        // KV cache holds, and only tokenize the end-of-turn text the template puts after it
+        tokens_.insert(tokens_.end(), genPromptTokens_.begin(), genPromptTokens_.end());
+        tokens_.insert(tokens_.end(), tokens.begin(), tokens.end());
+        tokenize(full, prompted.size() + text.size(), tokens_);
+        turnEnds_.push_back(tokens_.size());
+        formatted_ = std::move(full);
+    } else if (startsWith(full, formatted_)) {
+        // Reply rewritten by the template (e.g. reasoning stripped): tokenize what it became
+        tokenize(full, formatted_.size(), tokens_);
+        turnEnds_.push_back(tokens_.size());
+        formatted_ = std::move(full);
+    } else {
+        formatted_ = std::move(full);
+        rebuild();
+    }
+    genPromptMessages_ = 0;
+    LOGI("Reply recorded: %zu generated tokens, %zu tokens in history", tokens.size(), tokens_.size());
+}
+#endif
+
+} // namespace llamaandroid
@@ -0,0 +1,99 @@
+#ifndef LLAMA_CONVERSATION_H
+#define LLAMA_CONVERSATION_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+#if LLAMA_AVAILABLE
+#include "llama.h"
+#endif
+
+namespace llamaandroid {
+
+#if LLAMA_AVAILABLE
+/**
+ * Multi-turn chat history kept in native memory as messages and their tokens.
+ *
+ * The model's chat template is applied incrementally: appending a message formats the
+ * history once more (cheap string work) and tokenizes only the text it added. A reply is
+ * recorded from the tokens the model generated, so it is never detokenized and tokenized
+ * again - the history tokens then match the KV cache and the next turn reuses it fully.
+ *
+ * Not thread-safe; LlamaContextWrapper serializes access under its mutex.
+ */
+class Conversation {
+public:
+    /**
+     * @param model Model whose vocabulary and chat template are used (kept alive by the conversation)
+     */
+    explicit Conversation(std::shared_ptr<llama_model> model);
+
+    const llama_model* model() const { return model_.get(); }
+
+    /**
+     * Append a message and tokenize the text it adds to the formatted history
+     * @param error Set on failure
+     * @return Number of tokens added, -1 on error
+     */
+    int append(const std::string& role, const std::string& content, std::string& error);
+
+    /**
+     * Prompt tokens for the next reply, one entry per message; the generation prompt is
+     * part of the last entry. BOS is not included.
+     * @param error Set on failure
+     * @return false if the history is empty or can't be formatted
+     */
+    bool promptTurns(std::vector<std::vector<llama_token>>& turns, std::string& error);
+
+    /**
+     * Record the model's reply to the prompt from the last promptTurns() call
+     * @param tokens Generated tokens, without the end-of-generation token
+     * @param text Raw text of those tokens
+     */
+    void appendReply(const std::vector<llama_token>& tokens, const std::string& text);
+
+    size_t messageCount() const { return roles_.size(); }
+
+    /**
+     * Tokens of the formatted history, without the generation prompt or BOS
+     */
+    size_t tokenCount() const { return tokens_.size(); }
+
+    bool startsWithSystem() const { return !roles_.empty() && roles_[0] == "system"; }
+
+    /**
+     * First non-system message kept by the last turn-aware truncation of this history
+     */
+    size_t& turnCut() { return turnCut_; }
+
+private:
+    // Format the first n messages into out; false if the template fails
+    bool format(size_t n, bool addGenerationPrompt, std::string& out);
+    bool tokenize(const std::string& text, size_t offset, std::vector<llama_token>& out);
+    // Tokenize the whole history again, when the template isn't prefix-stable
+    bool rebuild();
+
+    std::shared_ptr<llama_model> model_;
+    const char* template_ = nullptr;
+
+    std::vector<std::string> roles_;
+    std::vector<std::string> contents_;
+
+    std::string formatted_;                 // History formatted without the generation prompt
+    std::vector<llama_token> tokens_;       // Tokens of formatted_
+    std::vector<size_t> turnEnds_;          // End of each message in tokens_
+
+    std::string genPrompt_;                 // Generation prompt text appended after formatted_
+    std::vector<llama_token> genPromptTokens_;
+    size_t genPromptMessages_ = 0;          // messageCount() genPrompt_ was computed for, 0 = stale
+    size_t turnCut_ = 0;
+
+    std::vector<char> formatBuf_;
+};
+#endif
+
+} // namespace llamaandroid
+
+#endif // LLAMA_CONVERSATION_H
@@ -0,0 +1,91 @@
+#include "cpu_topology.h"
+
+#include <android/log.h>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+#define LOG_TAG "LlamaCpu"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+
+namespace llamaandroid {
+
+namespace {
+// Upper bound for threads picked automatically - beyond this ggml's sync overhead dominates on phones
+constexpr int kMaxAutoThreads = 8;
+
+// Read a single integer from a sysfs file, -1 if unavailable
+long readSysfsLong(const char* path) {
+    FILE* f = fopen(path, "r");
+    if (f == nullptr) {
+        return -1;
+    }
+    long value = -1;
+    if (fscanf(f, "%ld", &value) != 1) {
+        value = -1;
+    }
+    fclose(f);
+    return value;
+}
+} // namespace
+
+int CpuTopology::decodeThreads() const {
+    const int n = performanceCores.empty() ? coreCount() : (int)performanceCores.size();
+    return std::max(1, std::min(n, kMaxAutoThreads));
+}
+
+int CpuTopology::batchThreads() const {
+    return std::max(1, std::min(coreCount(), kMaxAutoThreads));
+}
+
+const CpuTopology& CpuTopology::get() {
+    static const CpuTopology topology = probe();
+    return topology;
+}
+
+CpuTopology CpuTopology::probe() {
+    CpuTopology topology;
+
+    const long nCpus = sysconf(_SC_NPROCESSORS_CONF);
+    std::vector<std::pair<long, int>> cores;  // (max frequency or capacity, cpu id)
+    char path[128];
+
+    for (int cpu = 0; cpu < nCpus; cpu++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", cpu);
+        long speed = readSysfsLong(path);
+        if (speed < 0) {
+            // Some kernels only expose the scheduler's relative capacity
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpu_capacity", cpu);
+            speed = readSysfsLong(path);
+        }
+        cores.emplace_back(std::max(speed, 0L), cpu);
+    }
+
+    if (cores.empty()) {
+        LOGW("Could not enumerate CPUs, assuming 4 uniform cores");
+        topology.performanceCores = {0, 1, 2, 3};
+        return topology;
+    }
+
+    std::sort(cores.begin(), cores.end(), [](const std::pair<long, int>& a, const std::pair<long, int>& b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+
+    // Lowest cluster = efficiency; unknown speeds (0) everywhere means homogeneous
+    const long slowest = cores.back().first;
+    const bool uniform = cores.front().first == slowest;
+    for (const auto& core : cores) {
+        if (!uniform && core.first == slowest) {
+            topology.efficiencyCores.push_back(core.second);
+        } else {
+            topology.performanceCores.push_back(core.second);
+        }
+    }
+
+    LOGI("CPU topology: %zu performance, %zu efficiency cores (max %ld, min %ld)",
+         topology.performanceCores.size(), topology.efficiencyCores.size(), cores.front().first, slowest);
+    return topology;
+}
+
+} // namespace llamaandroid
@@ -0,0 +1,42 @@
+#ifndef LLAMA_CPU_TOPOLOGY_H
+#define LLAMA_CPU_TOPOLOGY_H
+
+#include <vector>
+
+namespace llamaandroid {
+
+/**
+ * Core layout of the device, probed from /sys/devices/system/cpu/cpuN/cpufreq.
+ * On big.LITTLE / DynamIQ SoCs the cluster with the lowest max frequency is treated as
+ * efficiency cores, every faster cluster (big, prime) as performance cores.
+ */
+struct CpuTopology {
+    std::vector<int> performanceCores;  // CPU ids, fastest first
+    std::vector<int> efficiencyCores;   // CPU ids of the slowest cluster (empty on homogeneous CPUs)
+
+    int coreCount() const { return (int)(performanceCores.size() + efficiencyCores.size()); }
+    bool isHeterogeneous() const { return !performanceCores.empty() && !efficiencyCores.empty(); }
+
+    /**
+     * Threads for single-token decode: one per performance core.
+     * Decode is memory-bound and waits on its slowest thread, so efficiency cores only add tail latency.
+     */
+    int decodeThreads() const;
+
+    /**
+     * Threads for batched prefill: every core, which is compute-bound enough to benefit.
+     */
+    int batchThreads() const;
+
+    /**
+     * Topology of this device, probed once and cached
+     */
+    static const CpuTopology& get();
+
+private:
+    static CpuTopology probe();
+};
+
+} // namespace llamaandroid
+
+#endif // LLAMA_CPU_TOPOLOGY_H
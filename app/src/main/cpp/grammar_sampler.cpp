@@ -0,0 +1,174 @@
+#include "grammar_sampler.h"
+
+#include <android/log.h>
+#include <algorithm>
+#include <cmath>
+#include <exception>
+
+#if LLAMA_AVAILABLE && LLAMA_JSON_SCHEMA
+#include "json-schema-to-grammar.h"
+#include <nlohmann/json.hpp>
+#endif
+
+#define LOG_TAG "LlamaGrammar"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+
+namespace llamaandroid {
+
+bool jsonSchemaSupported() {
+#if LLAMA_AVAILABLE && LLAMA_JSON_SCHEMA
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if LLAMA_AVAILABLE
+namespace {
+// Escape a trigger word for use inside std::regex (ECMAScript)
+std::string regexEscape(const std::string& text) {
+    static const std::string special = "\\^$.|?*+()[]{}-/";
+    std::string escaped;
+    escaped.reserve(text.size() * 2);
+    for (char c : text) {
+        if (special.find(c) != std::string::npos) {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+struct ConstrainedSampler {
+    llama_sampler* chain;
+    llama_sampler* grammar;
+    std::vector<llama_token_data> scratch;  // Unconstrained candidates for the fast path
+};
+
+ConstrainedSampler* state(const llama_sampler* smpl) {
+    return static_cast<ConstrainedSampler*>(smpl->ctx);
+}
+
+const char* constrainedName(const llama_sampler* /* smpl */) {
+    return "constrained";
+}
+
+void constrainedAccept(llama_sampler* smpl, llama_token token) {
+    ConstrainedSampler* s = state(smpl);
+    llama_sampler_accept(s->grammar, token);
+    llama_sampler_accept(s->chain, token);
+}
+
+void constrainedApply(llama_sampler* smpl, llama_token_data_array* cur_p) {
+    ConstrainedSampler* s = state(smpl);
+
+    // Fast path: let the chain pick from a copy, then ask the grammar about that one token
+    s->scratch.assign(cur_p->data, cur_p->data + cur_p->size);
+    llama_token_data_array probe = {s->scratch.data(), s->scratch.size(), -1, cur_p->sorted};
+    llama_sampler_apply(s->chain, &probe);
+    if (probe.selected >= 0) {
+        llama_token_data single = {probe.data[probe.selected].id, 1.0f, 0.0f};
+        llama_token_data_array one = {&single, 1, -1, false};
+        llama_sampler_apply(s->grammar, &one);
+        if (std::isfinite(single.logit)) {
+            // The chain usually truncated the candidates (top-k), so this copy is small
+            std::copy(probe.data, probe.data + probe.size, cur_p->data);
+            cur_p->size = probe.size;
+            cur_p->selected = probe.selected;
+            cur_p->sorted = probe.sorted;
+            return;
+        }
+    }
+
+    // Rejected: mask the whole vocabulary with the grammar and sample again
+    llama_sampler_apply(s->grammar, cur_p);
+    llama_sampler_apply(s->chain, cur_p);
+}
+
+void constrainedReset(llama_sampler* smpl) {
+    ConstrainedSampler* s = state(smpl);
+    llama_sampler_reset(s->grammar);
+    llama_sampler_reset(s->chain);
+}
+
+llama_sampler* constrainedClone(const llama_sampler* smpl) {
+    const ConstrainedSampler* s = state(smpl);
+    return makeConstrainedSampler(llama_sampler_clone(s->chain), llama_sampler_clone(s->grammar));
+}
+
+void constrainedFree(llama_sampler* smpl) {
+    ConstrainedSampler* s = state(smpl);
+    llama_sampler_free(s->grammar);
+    llama_sampler_free(s->chain);
+    delete s;
+}
+
+// Members assigned one by one: newer llama.h versions append optional hooks to the struct
+llama_sampler_i constrainedInterface() {
+    llama_sampler_i iface{};
+    iface.name = constrainedName;
+    iface.accept = constrainedAccept;
+    iface.apply = constrainedApply;
+    iface.reset = constrainedReset;
+    iface.clone = constrainedClone;
+    iface.free = constrainedFree;
+    return iface;
+}
+} // namespace
+
+llama_sampler* createGrammarSampler(const llama_vocab* vocab, const GrammarSpec& spec, std::string& error) {
+    std::string gbnf = spec.grammar;
+    if (!spec.jsonSchema.empty()) {
+#if LLAMA_JSON_SCHEMA
+        try {
+            gbnf = json_schema_to_grammar(nlohmann::ordered_json::parse(spec.jsonSchema));
+        } catch (const std::exception& e) {
+            error = std::string("Invalid JSON schema: ") + e.what();
+            return nullptr;
+        }
+#else
+        error = "JSON schema support is not built in (LLAMA_ANDROID_JSON_SCHEMA=OFF)";
+        return nullptr;
+#endif
+    }
+
+    llama_sampler* grammar = nullptr;
+    if (spec.triggers.empty()) {
+        grammar = llama_sampler_init_grammar(vocab, gbnf.c_str(), "root");
+    } else {
+        // Output is unconstrained until a trigger; the grammar then has to match from the trigger on
+        std::vector<std::string> patterns;
+        std::vector<llama_token> tokens;
+        for (const std::string& trigger : spec.triggers) {
+            llama_token ids[2];
+            const int n = llama_tokenize(vocab, trigger.c_str(), (int32_t)trigger.size(), ids, 2, false, true);
+            if (n == 1 && (llama_vocab_get_attr(vocab, ids[0]) & (LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_USER_DEFINED))) {
+                tokens.push_back(ids[0]);
+            } else {
+                patterns.push_back("[\\s\\S]*?(" + regexEscape(trigger) + ")[\\s\\S]*");
+            }
+        }
+        std::vector<const char*> patternPtrs;
+        for (const std::string& pattern : patterns) {
+            patternPtrs.push_back(pattern.c_str());
+        }
+        grammar = llama_sampler_init_grammar_lazy_patterns(vocab, gbnf.c_str(), "root",
+                                                            patternPtrs.data(), patternPtrs.size(),
+                                                            tokens.data(), tokens.size());
+    }
+
+    if (grammar == nullptr) {
+        error = spec.jsonSchema.empty() ? "Failed to parse grammar" : "Failed to parse grammar generated from JSON schema";
+        return nullptr;
+    }
+    LOGI("Grammar sampler ready (%zu bytes of GBNF, %zu trigger(s))", gbnf.size(), spec.triggers.size());
+    return grammar;
+}
+
+llama_sampler* makeConstrainedSampler(llama_sampler* chain, llama_sampler* grammar) {
+    static const llama_sampler_i iface = constrainedInterface();
+    return llama_sampler_init(&iface, new ConstrainedSampler{chain, grammar, {}});
+}
+#endif
+
+} // namespace llamaandroid
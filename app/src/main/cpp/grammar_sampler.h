@@ -0,0 +1,52 @@
+#ifndef LLAMA_GRAMMAR_SAMPLER_H
+#define LLAMA_GRAMMAR_SAMPLER_H
+
+#include <string>
+#include <vector>
+
+#if LLAMA_AVAILABLE
+#include "llama.h"
+#endif
+
+namespace llamaandroid {
+
+/**
+ * Output constraint for sampling. At most one of grammar / jsonSchema is set.
+ */
+struct GrammarSpec {
+    std::string grammar;                // GBNF, root rule "root"
+    std::string jsonSchema;             // JSON schema, converted to GBNF
+    std::vector<std::string> triggers;  // Lazy mode: only constrain from the first trigger on
+
+    bool empty() const { return grammar.empty() && jsonSchema.empty(); }
+};
+
+/**
+ * Whether JSON schemas can be converted (LLAMA_JSON_SCHEMA builds)
+ */
+bool jsonSchemaSupported();
+
+#if LLAMA_AVAILABLE
+/**
+ * Build llama.cpp's grammar sampler for a spec.
+ * A trigger that is a single special token (e.g. "<tool_call>") triggers on that token,
+ * any other trigger on its text appearing in the output.
+ * @param error Set when the grammar or schema is invalid
+ * @return Grammar sampler, nullptr on error
+ */
+llama_sampler* createGrammarSampler(const llama_vocab* vocab, const GrammarSpec& spec, std::string& error);
+
+/**
+ * Combine a sampler chain and a grammar sampler into one llama_sampler, taking ownership of both.
+ *
+ * Sampling follows llama.cpp's common_sampler: the chain picks a token from the unconstrained
+ * candidates and the grammar only checks that one token. The grammar is applied to the whole
+ * vocabulary only when the pick is rejected, so constrained output costs about the same as
+ * unconstrained output - most picks already fit the grammar.
+ */
+llama_sampler* makeConstrainedSampler(llama_sampler* chain, llama_sampler* grammar);
+#endif
+
+} // namespace llamaandroid
+
+#endif // LLAMA_GRAMMAR_SAMPLER_H
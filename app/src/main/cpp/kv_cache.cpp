@@ -0,0 +1,67 @@
+#include "kv_cache.h"
+
+#include <cstdint>
+
+namespace llamaandroid {
+
+namespace {
+// llama.cpp rounds the KV cache size up to a multiple of this
+constexpr int64_t kContextPadding = 256;
+
+// Bytes per block and elements per block, matching ggml's block layouts
+struct TypeLayout {
+    int64_t blockBytes;
+    int64_t blockSize;
+};
+
+TypeLayout layoutOf(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::Q8_0: return {34, 32};    // fp16 scale + 32 x int8
+        case KvCacheType::Q4_0: return {18, 32};    // fp16 scale + 32 x 4 bit
+        case KvCacheType::F16:
+        default:                return {2, 1};
+    }
+}
+
+int64_t rowBytes(KvCacheType type, int64_t elements) {
+    const TypeLayout layout = layoutOf(type);
+    return (elements + layout.blockSize - 1) / layout.blockSize * layout.blockBytes;
+}
+} // namespace
+
+bool parseKvCacheType(const std::string& name, KvCacheType& type) {
+    if (name.empty() || name == "f16") {
+        type = KvCacheType::F16;
+    } else if (name == "q8_0") {
+        type = KvCacheType::Q8_0;
+    } else if (name == "q4_0") {
+        type = KvCacheType::Q4_0;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+size_t estimateKvCacheBytes(const KvCacheShape& shape, int contextSize, KvCacheType typeK, KvCacheType typeV) {
+    if (shape.nLayer <= 0 || shape.nHeadKv <= 0 || contextSize <= 0) {
+        return 0;
+    }
+    const int64_t cells = (contextSize + kContextPadding - 1) / kContextPadding * kContextPadding;
+    // One K and one V row per cell and layer; quantized types are blocked along the row
+    const int64_t perCell = rowBytes(typeK, (int64_t)shape.nHeadKv * shape.headDimK) +
+                            rowBytes(typeV, (int64_t)shape.nHeadKv * shape.headDimV);
+    return (size_t)(cells * perCell * shape.nLayer);
+}
+
+#if LLAMA_AVAILABLE
+ggml_type toGgmlType(KvCacheType type) {
+    switch (type) {
+        case KvCacheType::Q8_0: return GGML_TYPE_Q8_0;
+        case KvCacheType::Q4_0: return GGML_TYPE_Q4_0;
+        case KvCacheType::F16:
+        default:                return GGML_TYPE_F16;
+    }
+}
+#endif
+
+} // namespace llamaandroid
@@ -0,0 +1,51 @@
+#ifndef LLAMA_KV_CACHE_H
+#define LLAMA_KV_CACHE_H
+
+#include <string>
+#include <cstddef>
+
+#if LLAMA_AVAILABLE
+#include "ggml.h"
+#endif
+
+namespace llamaandroid {
+
+/**
+ * Element types supported for the K and V caches
+ */
+enum class KvCacheType {
+    F16,
+    Q8_0,   // ~half of F16, near lossless
+    Q4_0    // ~quarter of F16, noticeable quality loss on small models
+};
+
+/**
+ * Parse a cache type name as passed from Kotlin ("f16", "q8_0", "q4_0")
+ * @return false if the name is not a supported type
+ */
+bool parseKvCacheType(const std::string& name, KvCacheType& type);
+
+/**
+ * Attention dimensions of a model that determine the size of its KV cache
+ */
+struct KvCacheShape {
+    int nLayer = 0;
+    int nHeadKv = 0;
+    int headDimK = 0;
+    int headDimV = 0;
+};
+
+/**
+ * Estimate the KV cache memory for a context of contextSize tokens.
+ * Counts every layer with full attention, so models with sliding-window layers use less.
+ * The context is padded the same way llama.cpp pads it.
+ */
+size_t estimateKvCacheBytes(const KvCacheShape& shape, int contextSize, KvCacheType typeK, KvCacheType typeV);
+
+#if LLAMA_AVAILABLE
+ggml_type toGgmlType(KvCacheType type);
+#endif
+
+} // namespace llamaandroid
+
+#endif // LLAMA_KV_CACHE_H
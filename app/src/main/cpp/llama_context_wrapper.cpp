@@ -1,14 +1,31 @@
 #include "llama_context_wrapper.h"
+#include "cpu_topology.h"
+#include "kv_cache.h"
+#include "memory_info.h"
+#include "model_footprint.h"
+#include "trace.h"
 #include <android/log.h>
 #include <sstream>
-#include <ctime>
 #include <random>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <thread>
+#include <sys/stat.h>
 
 #define LOG_TAG "LlamaAndroid"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+// Compiled out of release builds: some debug logs sit on per-chunk paths
+#ifdef NDEBUG
+#define LOGD(...) ((void)0)
+#else
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#endif
 
 namespace llamaandroid {
 
@@ -18,12 +35,128 @@ namespace llamaandroid {
 #define LIBRARY_VERSION "0.1.1"
 #endif
 
+namespace {
+// Micro-batch bounds for the adaptive memory policy (llama.cpp's default n_ubatch is 512)
+constexpr int kDefaultMicroBatch = 512;
+constexpr int kMinMicroBatch = 32;
+
+// Texts decoded together by embed(), each as its own sequence
+constexpr int kMaxEmbedSequences = 32;
+
+// Peak resident set size of this process in kB (VmHWM), 0 if unavailable
+long readPeakRssKb() {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (f == nullptr) {
+        return 0;
+    }
+    char line[256];
+    long value = 0;
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        if (sscanf(line, "VmHWM: %ld kB", &value) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return value;
+}
+
+double percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    size_t idx = std::min(samples.size() - 1, (size_t)(p * (samples.size() - 1) + 0.5));
+    std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+    return samples[idx];
+}
+
+double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+#if LLAMA_AVAILABLE
+// Integer GGUF metadata value of the model's architecture, e.g. "llama.attention.key_length"
+int archMetaInt(const llama_model* model, const char* suffix, int fallback) {
+    char arch[64];
+    char value[32];
+    if (llama_model_meta_val_str(model, "general.architecture", arch, sizeof(arch)) < 0) {
+        return fallback;
+    }
+    const std::string key = std::string(arch) + "." + suffix;
+    if (llama_model_meta_val_str(model, key.c_str(), value, sizeof(value)) < 0) {
+        return fallback;
+    }
+    return atoi(value);
+}
+
+KvCacheShape kvCacheShape(const llama_model* model) {
+    KvCacheShape shape;
+    shape.nLayer = llama_model_n_layer(model);
+    shape.nHeadKv = llama_model_n_head_kv(model);
+    // Head size defaults to n_embd / n_head unless the model overrides it (e.g. Gemma)
+    const int nHead = llama_model_n_head(model);
+    const int headDim = nHead > 0 ? llama_model_n_embd(model) / nHead : 0;
+    shape.headDimK = archMetaInt(model, "attention.key_length", headDim);
+    shape.headDimV = archMetaInt(model, "attention.value_length", headDim);
+    return shape;
+}
+
+/**
+ * Largest n_ubatch whose compute buffer fits in half of the memory left after the KV cache
+ */
+int chooseMicroBatch(const llama_model* model, const LlamaConfig& config, size_t kvBytes) {
+    const int maxMicroBatch = std::max(1, std::min(config.batchSize, kDefaultMicroBatch));
+    const MemoryInfo memory = MemoryInfo::read();
+    if (!memory.isKnown()) {
+        return maxMicroBatch;
+    }
+    
+    const size_t budget = (memory.availableBytes > kvBytes ? memory.availableBytes - kvBytes : 0) / 2;
+    const size_t perToken = computeBytesPerToken((size_t)llama_vocab_n_tokens(llama_model_get_vocab(model)),
+                                                 llama_model_n_embd(model), llama_model_n_head(model),
+                                                 config.contextSize, config.flashAttention);
+    
+    int microBatch = maxMicroBatch;
+    while (microBatch > kMinMicroBatch && (size_t)microBatch * perToken > budget) {
+        microBatch /= 2;
+    }
+    LOGI("Memory: %zu MB available of %zu MB, KV cache %zu MB -> n_ubatch=%d",
+         memory.availableBytes >> 20, memory.totalBytes >> 20, kvBytes >> 20, microBatch);
+    return microBatch;
+}
+
+// Sampler chains kept per wrapper; an override config used once shouldn't evict the model's own
+constexpr size_t kMaxCachedSamplers = 8;
+
+// Everything createSamplerChain() reads, byte for byte - equal keys build identical chains
+std::string samplerKey(const LlamaConfig& config) {
+    std::string key;
+    auto addBytes = [&key](const void* data, size_t size) {
+        key.append(static_cast<const char*>(data), size);
+    };
+    auto addString = [&](const std::string& text) {
+        const size_t size = text.size();
+        addBytes(&size, sizeof(size));
+        key += text;
+    };
+    addBytes(&config.temperature, sizeof(config.temperature));
+    addBytes(&config.topP, sizeof(config.topP));
+    addBytes(&config.topK, sizeof(config.topK));
+    addBytes(&config.repeatPenalty, sizeof(config.repeatPenalty));
+    addBytes(&config.seed, sizeof(config.seed));
+    addString(config.grammar);
+    addString(config.jsonSchema);
+    for (const std::string& trigger : config.grammarTriggers) {
+        addString(trigger);
+    }
+    return key;
+}
+#endif
+} // namespace
+
 LlamaContextWrapper::LlamaContextWrapper() {
     LOGI("LlamaContextWrapper created");
 #if LLAMA_AVAILABLE
-    // Initialize llama backend
-    llama_backend_init();
-    LOGI("llama.cpp backend initialized");
+    initBackend();
 #else
     LOGW("llama.cpp not available - using stub implementation");
 #endif
@@ -34,13 +167,10 @@ LlamaContextWrapper::~LlamaContextWrapper() {
     // Mark as freed BEFORE unloading to catch race conditions
     magic_ = MAGIC_FREED;
     unloadModel();
-#if LLAMA_AVAILABLE
-    llama_backend_free();
-    LOGI("llama.cpp backend freed");
-#endif
 }
 
-bool LlamaContextWrapper::loadModel(const std::string& modelPath, const LlamaConfig& config) {
+bool LlamaContextWrapper::loadModel(const std::string& modelPath, const LlamaConfig& config,
+                                    LoadProgressCallback progress) {
     std::lock_guard<std::mutex> lock(mutex_);
     clearError();
     
@@ -59,11 +189,45 @@ bool LlamaContextWrapper::loadModel(const std::string& modelPath, const LlamaCon
     modelParams.use_mmap = config.useMmap;
     modelParams.use_mlock = config.useMlock;
     
+    // Offload to one selected device instead of every GPU llama.cpp finds
+    ggml_backend_dev_t devices[2] = {nullptr, nullptr};
+    if (config.gpuLayers > 0 && !config.gpuDevice.empty()) {
+        devices[0] = findBackendDevice(config.gpuDevice);
+        if (devices[0] != nullptr) {
+            modelParams.devices = devices;
+        } else {
+            LOGW("GPU device '%s' not found, using default devices", config.gpuDevice.c_str());
+        }
+    }
+    if (config.gpuLayers > 0 && !hasGpuDevice()) {
+        LOGW("gpuLayers=%d requested but no GPU backend is available, running on CPU", config.gpuLayers);
+    }
+    
     LOGI("Model params: gpu_layers=%d, use_mmap=%d, use_mlock=%d",
          config.gpuLayers, config.useMmap, config.useMlock);
     
-    // Load the model using new API
-    model_ = llama_model_load_from_file(modelPath.c_str(), modelParams);
+    // Reading the weights reports up to loadShare, the warm-up decode covers the rest
+    const float loadShare = config.warmup ? 0.9f : 1.0f;
+    std::pair<LoadProgressCallback*, float> loadProgress(&progress, loadShare);
+    if (progress) {
+        modelParams.progress_callback = [](float p, void* data) {
+            auto* lp = static_cast<std::pair<LoadProgressCallback*, float>*>(data);
+            (*lp->first)(p * lp->second);
+            return true;
+        };
+        modelParams.progress_callback_user_data = &loadProgress;
+    }
+    
+    // Weights already loaded by another wrapper with the same parameters are shared
+    modelRef_ = ModelRegistry::get().acquire(modelPath, modelParams);
+    if (modelRef_ == nullptr && modelParams.n_gpu_layers > 0) {
+        // GPU buffers can fail to allocate (driver limits, shared memory) - retry on the CPU
+        LOGW("Model load with %d GPU layers failed, retrying on CPU", modelParams.n_gpu_layers);
+        modelParams.n_gpu_layers = 0;
+        modelParams.devices = nullptr;
+        modelRef_ = ModelRegistry::get().acquire(modelPath, modelParams);
+    }
+    model_ = modelRef_.get();
     if (model_ == nullptr) {
         setError("Failed to load model from: " + modelPath);
         LOGE("%s", lastError_.c_str());
@@ -72,32 +236,119 @@ bool LlamaContextWrapper::loadModel(const std::string& modelPath, const LlamaCon
     
     LOGI("Model loaded successfully");
     
+    // A model shared through the registry was loaded without calling back
+    modelParams.progress_callback = nullptr;
+    if (progress) {
+        progress(loadShare);
+    }
+    
     // Set up context parameters
     llama_context_params ctxParams = llama_context_default_params();
     ctxParams.n_ctx = config.contextSize;
     ctxParams.n_batch = config.batchSize;
-    ctxParams.n_threads = config.threads;
-    ctxParams.n_threads_batch = config.threadsBatch;
+    // Automatic thread counts follow the core topology
+    const CpuTopology& topology = CpuTopology::get();
+    const bool autoThreads = config.threads <= 0 || config.threadsBatch <= 0;
+    ctxParams.n_threads = config.threads > 0 ? config.threads : topology.decodeThreads();
+    ctxParams.n_threads_batch = config.threadsBatch > 0 ? config.threadsBatch : topology.batchThreads();
+    // Each parallel sequence gets contextSize / parallelSequences tokens of KV cache
+    ctxParams.n_seq_max = std::max(1, config.parallelSequences);
+    
+    KvCacheType typeK;
+    KvCacheType typeV;
+    if (!parseKvCacheType(config.cacheTypeK, typeK) || !parseKvCacheType(config.cacheTypeV, typeV)) {
+        setError("Unsupported KV cache type: " + config.cacheTypeK + "/" + config.cacheTypeV);
+        LOGE("%s", lastError_.c_str());
+        modelRef_.reset();
+        model_ = nullptr;
+        return false;
+    }
+    if (typeV != KvCacheType::F16 && !config.flashAttention) {
+        // llama.cpp can only read a quantized V cache through the flash attention kernel
+        setError("Quantized V cache (" + config.cacheTypeV + ") requires flashAttention");
+        LOGE("%s", lastError_.c_str());
+        modelRef_.reset();
+        model_ = nullptr;
+        return false;
+    }
+    ctxParams.type_k = toGgmlType(typeK);
+    ctxParams.type_v = toGgmlType(typeV);
+    ctxParams.flash_attn_type = config.flashAttention ? LLAMA_FLASH_ATTN_TYPE_ENABLED : LLAMA_FLASH_ATTN_TYPE_DISABLED;
+    
+    // The micro-batch sizes llama.cpp's compute buffer - fit it to the memory left after the KV cache
+    const size_t kvBytes = llamaandroid::estimateKvCacheBytes(kvCacheShape(model_), config.contextSize, typeK, typeV);
+    ctxParams.n_ubatch = chooseMicroBatch(model_, config, kvBytes);
     
-    LOGI("Context params: n_ctx=%d, n_batch=%d, n_threads=%d",
-         ctxParams.n_ctx, ctxParams.n_batch, ctxParams.n_threads);
+    LOGI("Context params: n_ctx=%d, n_batch=%d, n_ubatch=%d, n_threads=%d, n_threads_batch=%d, n_seq_max=%d",
+         ctxParams.n_ctx, ctxParams.n_batch, ctxParams.n_ubatch, ctxParams.n_threads, ctxParams.n_threads_batch,
+         ctxParams.n_seq_max);
+    LOGI("KV cache: type_k=%s, type_v=%s, flash_attn=%d, estimated %zu KB", config.cacheTypeK.c_str(),
+         config.cacheTypeV.c_str(), config.flashAttention, kvBytes / 1024);
     
     // Create context using new API
     context_ = llama_init_from_model(model_, ctxParams);
     if (context_ == nullptr) {
         setError("Failed to create llama context");
         LOGE("%s", lastError_.c_str());
-        llama_model_free(model_);
+        modelRef_.reset();
         model_ = nullptr;
         return false;
     }
     
     LOGI("Context created successfully");
     
+    if (!allocateBuffers(config.batchSize, (int)llama_n_ctx(context_))) {
+        setError("Failed to allocate memory for generation batch. Device is out of memory.");
+        LOGE("%s", lastError_.c_str());
+        unloadModel();
+        return false;
+    }
+    
+    if (autoThreads) {
+        createThreadpools(ctxParams.n_threads, ctxParams.n_threads_batch);
+    }
+    
+    // cancelGeneration() interrupts a running llama_decode between graph nodes, not just between chunks.
+    // Parallel requests are cancelled per sequence by the scheduler instead.
+    if (ctxParams.n_seq_max == 1) {
+        llama_set_abort_callback(context_, abortCallback, this);
+    }
+    
     // Set up sampler with config seed
-    setupSampler(config);
+    if (!setupSampler(config)) {
+        LOGE("%s", lastError_.c_str());
+        unloadModel();
+        return false;
+    }
+    
+    // Before the scheduler starts, which owns decoding on context_ from then on
+    if (config.warmup) {
+        warmUp(context_);
+    }
+    
+    if (ctxParams.n_seq_max > 1) {
+        scheduler_ = std::make_unique<SequenceScheduler>(context_, (int)ctxParams.n_seq_max, &cancelEpoch_);
+        if (!config.draftModelPath.empty()) {
+            LOGW("Speculative decoding is not used with parallelSequences > 1, ignoring draft model");
+        }
+    } else if (!config.draftModelPath.empty()) {
+        if (!loadDraftModel(config, modelParams, ctxParams)) {
+            LOGE("%s", lastError_.c_str());
+            unloadModel();
+            return false;
+        }
+        if (config.warmup) {
+            warmUp(draftContext_);
+        }
+    }
+    
+    if (progress) {
+        progress(1.0f);
+    }
     
     currentConfig_ = config;
+    currentConfig_.threads = ctxParams.n_threads;
+    currentConfig_.threadsBatch = ctxParams.n_threads_batch;
     LOGI("Model loading complete");
     return true;
     
@@ -105,10 +356,36 @@ bool LlamaContextWrapper::loadModel(const std::string& modelPath, const LlamaCon
     // Stub implementation for testing without llama.cpp
     LOGW("Using stub implementation - model not actually loaded");
     currentConfig_ = config;
+    if (progress) {
+        progress(1.0f);
+    }
     return true;
 #endif
 }
 
+bool LlamaContextWrapper::loadModelFromFd(int fd, int64_t offset, const LlamaConfig& config,
+                                          LoadProgressCallback progress) {
+    struct stat st;
+    std::string error;
+    if (offset != 0) {
+        // Nothing in llama.cpp reads a GGUF from inside another file (e.g. an asset in the APK)
+        error = "Model must start at offset 0 of the file, got " + std::to_string(offset) +
+                " (store it uncompressed as a separate file, e.g. a file-backed asset pack)";
+    } else if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        error = "File descriptor " + std::to_string(fd) + " is not a regular file";
+    }
+    if (!error.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        setError(error);
+        LOGE("%s", lastError_.c_str());
+        return false;
+    }
+    
+    // Opening our own fd through procfs works even when the file has no path this app can open
+    // (SAF documents), and the model stays mapped after the caller closes the descriptor
+    return loadModel("/proc/self/fd/" + std::to_string(fd), config, std::move(progress));
+}
+
 void LlamaContextWrapper::unloadModel() {
     // Note: Don't lock mutex here as it may be called from destructor
     // or from loadModel which already holds the lock
@@ -116,11 +393,22 @@ void LlamaContextWrapper::unloadModel() {
     LOGI("Unloading model");
     
 #if LLAMA_AVAILABLE
-    if (sampler_ != nullptr) {
-        llama_sampler_free(sampler_);
-        sampler_ = nullptr;
-        LOGD("Sampler freed");
+    // Stop the scheduler first - its worker thread decodes on context_
+    if (scheduler_) {
+        scheduler_.reset();
+        LOGD("Scheduler stopped");
+    }
+    
+    unloadDraftModel();
+    freeEmbedContext();
+    
+    // sampler_ is one of the cached chains
+    sampler_ = nullptr;
+    for (auto& entry : samplerCache_) {
+        llama_sampler_free(entry.second);
     }
+    samplerCache_.clear();
+    LOGD("Samplers freed");
     
     if (context_ != nullptr) {
         llama_free(context_);
@@ -128,10 +416,27 @@ void LlamaContextWrapper::unloadModel() {
         LOGD("Context freed");
     }
     
+    freeThreadpools();
+    freeBuffers();
+    
+    lastPromptTokens_.clear();
+    chatPrompt_.clear();
+    chatSegments_.clear();
+    chatTurnCut_ = 0;
+    // Conversations hold tokens of this model's vocabulary (and a reference to it)
+    conversations_.clear();
+    // Adapters belong to the model, which may outlive this wrapper in the registry
+    for (auto& entry : loraAdapters_) {
+        llama_adapter_lora_free(entry.second);
+    }
+    loraAdapters_.clear();
+    loraScales_.clear();
+    
     if (model_ != nullptr) {
-        llama_model_free(model_);
+        // Only frees the weights if no other wrapper shares them
+        modelRef_.reset();
         model_ = nullptr;
-        LOGD("Model freed");
+        LOGD("Model released");
     }
 #endif
     
@@ -153,18 +458,52 @@ bool LlamaContextWrapper::isModelLoaded() const {
 #endif
 }
 
-std::string LlamaContextWrapper::generate(const std::string& prompt, const LlamaConfig* config) {
+std::string LlamaContextWrapper::generate(const std::string& prompt, const LlamaConfig* config, std::string* error) {
     std::string result;
     
-    generateStream(prompt, [&result](const std::string& token) {
+    std::string failure = generateStream(prompt, [&result](const std::string& token) {
         result += token;
     }, config);
+    if (error != nullptr) {
+        *error = std::move(failure);
+    }
     
     return result;
 }
 
-void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallback callback, const LlamaConfig* config) {
+std::string LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallback callback,
+                                                const LlamaConfig* config, ProgressCallback progress) {
+    return generateStreamImpl(prompt, nullptr, std::move(callback), config, std::move(progress));
+}
+
+std::string LlamaContextWrapper::generateStream(const std::vector<int32_t>& promptTokens, TokenCallback callback,
+                                                const LlamaConfig* config, ProgressCallback progress) {
+    return generateStreamImpl(std::string(), &promptTokens, std::move(callback), config, std::move(progress));
+}
+
+std::string LlamaContextWrapper::generateConversation(int id, TokenCallback callback, const LlamaConfig* config,
+                                                      ProgressCallback progress) {
+    return generateStreamImpl(std::string(), nullptr, std::move(callback), config, std::move(progress), id);
+}
+
+std::string LlamaContextWrapper::generateStreamImpl(const std::string& prompt, const std::vector<int32_t>* inputTokens,
+                                                    TokenCallback callback, const LlamaConfig* config,
+                                                    ProgressCallback progress, int conversationId) {
+#if LLAMA_AVAILABLE
+    if (currentConfig_.parallelSequences > 1) {
+        return generateStreamParallel(prompt, inputTokens, std::move(callback), config, conversationId);
+    }
+#endif
+    
     std::lock_guard<std::mutex> lock(mutex_);
+    generateStreamLocked(prompt, inputTokens, std::move(callback), config, std::move(progress), conversationId);
+    // Copied under the same lock, the next call replaces it
+    return lastError_;
+}
+
+void LlamaContextWrapper::generateStreamLocked(const std::string& prompt, const std::vector<int32_t>* inputTokens,
+                                               TokenCallback callback, const LlamaConfig* config,
+                                               ProgressCallback progress, int conversationId) {
     clearError();
     
     if (!isModelLoaded()) {
@@ -175,36 +514,99 @@ void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallbac
     
     const LlamaConfig& cfg = config ? *config : currentConfig_;
     
+    LLAMA_TRACE_SCOPE("llama:generate");
     LOGI("Starting generation for prompt length: %zu", prompt.length());
     LOGD("Prompt: %.100s...", prompt.c_str());
     
     isGenerating_ = true;
     shouldCancel_ = false;
     
+    const auto tStart = std::chrono::steady_clock::now();
+    GenerationStats stats;
+    
 #if LLAMA_AVAILABLE
-    // Update sampler if config changed
-    if (config != nullptr) {
-        setupSampler(*config);
+    // Cached chain for these sampling parameters, reset below
+    if (!setupSampler(cfg)) {
+        isGenerating_ = false;
+        return;
+    }
+    
+    Conversation* conversation = nullptr;
+    if (conversationId != 0 && (conversation = findConversation(conversationId)) == nullptr) {
+        setError("Invalid conversation");
+        isGenerating_ = false;
+        return;
     }
     
-    // Tokenize prompt
-    std::vector<llama_token> promptTokens = tokenize(prompt, true);
+    // Tokenize prompt - per message when it came from applyChatTemplate() or a Conversation
+    std::vector<std::vector<llama_token>> turnTokens;
+    bool firstTurnIsSystem = false;
+    size_t* turnCut = nullptr;
+    std::vector<llama_token>& promptTokens = tokenScratch_;
+    if (conversation != nullptr) {
+        // Already tokenized per message, only the generation prompt may be new
+        std::string error;
+        if (!conversation->promptTurns(turnTokens, error)) {
+            setError(error);
+            isGenerating_ = false;
+            return;
+        }
+        promptTokens.clear();
+        if (llama_vocab_get_add_bos(llama_model_get_vocab(model_))) {
+            promptTokens.push_back(llama_vocab_bos(llama_model_get_vocab(model_)));
+        }
+        for (const std::vector<llama_token>& turn : turnTokens) {
+            promptTokens.insert(promptTokens.end(), turn.begin(), turn.end());
+        }
+        firstTurnIsSystem = conversation->startsWithSystem();
+        turnCut = &conversation->turnCut();
+    } else if (inputTokens != nullptr) {
+        // llama_decode would reject the whole batch, report the offending id instead
+        const int32_t nVocab = llama_vocab_n_tokens(llama_model_get_vocab(model_));
+        for (int32_t token : *inputTokens) {
+            if (token < 0 || token >= nVocab) {
+                setError("Invalid token id in prompt: " + std::to_string(token));
+                isGenerating_ = false;
+                return;
+            }
+        }
+        promptTokens.assign(inputTokens->begin(), inputTokens->end());
+    } else if (!chatSegments_.empty() && prompt == chatPrompt_) {
+        const std::vector<llama_token> tokens = tokenizeTurns(prompt, turnTokens);
+        promptTokens.assign(tokens.begin(), tokens.end());
+        firstTurnIsSystem = chatSegments_[0].role == "system";
+        turnCut = &chatTurnCut_;
+    } else if (!tokenizeInto(prompt.data(), prompt.size(), true, promptTokens)) {
+        promptTokens.clear();
+    }
     if (promptTokens.empty()) {
         setError("Failed to tokenize prompt");
         isGenerating_ = false;
         return;
     }
     
+    stats.tokenizeMs = elapsedMs(tStart);
     LOGI("Tokenized prompt: %zu tokens", promptTokens.size());
     
     // Check context size and handle overflow
     const int n_ctx = llama_n_ctx(context_);
-    const int maxPromptTokens = n_ctx - cfg.maxTokens - 16; // Reserve space for generation + safety margin
-    
-    // CRITICAL: On low-memory devices, limit prompt size even further
-    // Large prompts require significant scratch buffers during prefill
-    // Rule of thumb: batch_size=128 can safely handle ~300 tokens, batch_size=64 can handle ~200
-    const int safePromptLimit = std::min(maxPromptTokens, cfg.batchSize * 3);
+    // Reserve space for generation + safety margin; with context shifting generation can run past the window
+    const int reserveTokens = cfg.contextShift ? std::min(cfg.maxTokens, n_ctx / 4) : cfg.maxTokens;
+    // Prompt length doesn't drive memory use: the KV cache is allocated for n_ctx up front and the
+    // prefill scratch is bounded by n_ubatch, which loadModel() sized to the available memory
+    const int safePromptLimit = n_ctx - reserveTokens - 16;
+    
+    // Drop whole old turns first; fall back to token-level truncation if that isn't enough
+    if ((int)promptTokens.size() > safePromptLimit && !turnTokens.empty() && safePromptLimit >= 64) {
+        std::vector<llama_token> truncated = truncateTurns(turnTokens, firstTurnIsSystem, safePromptLimit, *turnCut);
+        if (!truncated.empty()) {
+            LOGW("Prompt too long (%zu tokens), dropped old turns: %zu tokens", promptTokens.size(), truncated.size());
+            promptTokens = std::move(truncated);
+            stats.truncated = true;
+        }
+    } else if (!turnTokens.empty()) {
+        *turnCut = 0;
+    }
     
     if ((int)promptTokens.size() > safePromptLimit) {
         if (safePromptLimit < 64) {
@@ -214,24 +616,25 @@ void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallbac
             return;
         }
         
-        // Smart truncation - preserve important context
-        LOGW("Prompt too long (%zu tokens), applying smart truncation to %d tokens (safe limit based on batch=%d)",
-             promptTokens.size(), safePromptLimit, cfg.batchSize);
-        promptTokens = smartTruncate(promptTokens, safePromptLimit);
+        if (cfg.contextShift) {
+            // Keep the sink tokens plus the most recent tail so the cache can be shifted onto it
+            LOGW("Prompt too long (%zu tokens), keeping %d head tokens and the most recent tail (%d tokens total)",
+                 promptTokens.size(), cfg.keepTokens, safePromptLimit);
+            promptTokens = truncateKeepingHead(promptTokens, safePromptLimit, cfg.keepTokens);
+        } else {
+            // Smart truncation - preserve important context
+            LOGW("Prompt too long (%zu tokens), applying smart truncation to %d tokens",
+                 promptTokens.size(), safePromptLimit);
+            promptTokens = smartTruncate(promptTokens, safePromptLimit);
+        }
+        stats.truncated = true;
         LOGI("Truncated to %zu tokens", promptTokens.size());
     }
     
-    // Clear KV cache for fresh start
-    // Note: KV cache reuse is complex and can cause issues when the 
-    // previous context doesn't match. For reliability, always clear.
-    llama_memory_t mem = llama_get_memory(context_);
-    if (mem != nullptr) {
-        llama_memory_clear(mem, true);
-        LOGD("Memory cleared for new generation");
-    }
-    
-    // Store current prompt for next turn's cache optimization
-    lastPromptTokens_ = promptTokens;
+    // Reuse the KV cache prefix shared with the previous request (prompt + generated tokens)
+    // and only prefill the new suffix. Falls back to a full clear when the cache can't be trimmed.
+    const int n_keep = std::max(0, std::min(cfg.keepTokens, n_ctx / 2));
+    const size_t n_reused = prepareKvCache(promptTokens, cfg.cacheReuse, cfg.contextShift ? n_keep : -1);
     
     // Reset sampler state for new generation
     if (sampler_ != nullptr) {
@@ -239,35 +642,27 @@ void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallbac
         LOGD("Sampler reset for new generation");
     }
     
-    // Create batch for prompt processing
+    // Batch preallocated by loadModel(), prefill chunks larger than it are split
     const size_t n_prompt = promptTokens.size();
-    int batchCapacity = std::max(cfg.batchSize, (int)n_prompt + 1);
-    llama_batch batch = llama_batch_init(batchCapacity, 0, 1);
-    
-    // CRITICAL: Check if batch allocation failed (can happen on low memory)
-    if (batch.token == nullptr || batch.pos == nullptr) {
-        LOGE("Failed to allocate batch with capacity %d - out of memory", batchCapacity);
-        
-        // Try again with smaller batch
-        batchCapacity = std::min(64, cfg.batchSize / 2);
-        LOGW("Retrying with reduced batch size: %d", batchCapacity);
-        batch = llama_batch_init(batchCapacity, 0, 1);
-        
-        if (batch.token == nullptr || batch.pos == nullptr) {
-            setError("Failed to allocate memory for generation batch. Device is out of memory.");
-            isGenerating_ = false;
-            return;
-        }
-        
-        LOGI("Batch allocated successfully with reduced capacity: %d", batchCapacity);
+    llama_batch& batch = batch_;
+    const int batchCapacity = batchCapacity_;
+    
+    stats.promptTokens = (int)n_prompt;
+    stats.reusedTokens = (int)n_reused;
+    stats.batchCapacity = batchCapacity;
+    
+    // Process prompt in chunks, starting after the tokens already in the KV cache
+    const auto tPrefill = std::chrono::steady_clock::now();
+    size_t n_processed = n_reused;
+    if (progress) {
+        progress((int)n_processed, (int)n_prompt);
     }
     
-    // Process prompt in chunks
-    size_t n_processed = 0;
-    
+    // Shrinks for the rest of this request when a chunk fails to allocate; the next one starts full size
+    int chunkLimit = std::min(cfg.batchSize, batchCapacity);
     while (n_processed < n_prompt && !shouldCancel_) {
-        // Calculate chunk size
-        size_t chunk_size = std::min((size_t)cfg.batchSize, n_prompt - n_processed);
+        LLAMA_TRACE_SCOPE("llama:prefill_chunk");
+        size_t chunk_size = std::min((size_t)chunkLimit, n_prompt - n_processed);
         
         // Add tokens to batch
         batch.n_tokens = 0;
@@ -282,25 +677,89 @@ void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallbac
         }
         
         // Process batch
-        if (llama_decode(context_, batch) != 0) {
+        const int ret = llama_decode(context_, batch);
+        if (ret != 0 && ret != 2 && ret != -1 && chunk_size > (size_t)kMinMicroBatch) {
+            // No KV slot or compute buffer for this chunk: drop what it left behind and retry it at half size
+            llama_memory_seq_rm(llama_get_memory(context_), 0, (llama_pos)n_processed, -1);
+            chunkLimit = std::max(kMinMicroBatch, (int)chunk_size / 2);
+            LOGW("Prompt chunk of %zu tokens failed (%d), retrying with %d", chunk_size, ret, chunkLimit);
+            continue;
+        }
+        if (ret == 2) {
+            // Cancelled mid-chunk by the abort callback: drop the partial chunk, the rest stays reusable
+            llama_memory_seq_rm(llama_get_memory(context_), 0, (llama_pos)n_processed, -1);
+            LOGI("Prefill cancelled after %zu/%zu tokens", n_processed, n_prompt);
+            break;
+        }
+        if (ret != 0) {
             setError("Failed to process prompt batch");
-            llama_batch_free(batch);
+            invalidateKvCache();
             isGenerating_ = false;
             return;
         }
         
+        lastPromptTokens_.insert(lastPromptTokens_.end(),
+                                 promptTokens.begin() + n_processed,
+                                 promptTokens.begin() + n_processed + chunk_size);
         n_processed += chunk_size;
         LOGD("Processed %zu/%zu prompt tokens", n_processed, n_prompt);
+        if (progress) {
+            progress((int)n_processed, (int)n_prompt);
+        }
     }
     
+    if (n_processed < n_prompt) {
+        // Cancelled during prefill: there are no logits to sample from, keep the processed prefix
+        stats.prefillMs = elapsedMs(tPrefill);
+        lastStats_ = stats;
+        isGenerating_ = false;
+        if (evictPending_.exchange(false)) {
+            evictCaches();
+        }
+        return;
+    }
+
     LOGI("Prompt processed, starting generation");
-    
+
     int n_cur = (int)n_prompt;
     int n_generated = 0;
     
     // Get vocab for token operations
     const llama_vocab * vocab = llama_model_get_vocab(model_);
     
+    // Speculative decoding: tokens proposed by the draft model are verified in the same decode
+    const int nDraftMax = (draftContext_ != nullptr) ? std::max(0, std::min(cfg.draftTokens, batchCapacity - 1)) : 0;
+    std::vector<llama_token>& drafts = drafts_;
+    int n_drafted = 0;
+    int n_accepted = 0;
+    
+    auto sample = [&](int32_t idx) {
+        LLAMA_TRACE_SCOPE("llama:sample");
+        return llama_sampler_sample(sampler_, context_, idx);
+    };
+    
+    // First token comes from the logits of the last prompt token (sampling waits for the prefill to finish)
+    llama_token newToken = (sampler_ != nullptr) ? sample(-1) : -1;
+    stats.prefillMs = elapsedMs(tPrefill);
+    stats.timeToFirstTokenMs = elapsedMs(tStart);
+    const auto tDecode = std::chrono::steady_clock::now();
+    
+    // Pieces can end inside a multi-byte character; the decoder holds the tail for the next token
+    utf8_.reset();
+    replyTokens_.clear();
+    replyText_.clear();
+    auto emitToken = [&](llama_token token) {
+        const std::string& piece = tokenToPiece(token);
+        if (conversation != nullptr) {
+            replyTokens_.push_back(token);
+            replyText_ += piece;
+        }
+        utf8_.push(piece, emitted_);
+        if (!emitted_.empty()) {
+            callback(emitted_);
+        }
+    };
+    
     // Generation loop
     while (n_generated < cfg.maxTokens && !shouldCancel_) {
         // Safety check - ensure sampler and context are valid
@@ -310,9 +769,6 @@ void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallbac
             break;
         }
         
-        // Sample next token
-        llama_token newToken = llama_sampler_sample(sampler_, context_, -1);
-        
         // Safety check for invalid token
         if (newToken < 0) {
             LOGW("Invalid token sampled: %d", newToken);
@@ -325,38 +781,130 @@ void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallbac
             break;
         }
         
-        // Convert token to text
-        std::string tokenStr = detokenize({newToken});
+        // Call callback with the text of the new token, once its characters are complete
+        emitToken(newToken);
+        n_generated++;
+        
+        if (n_cur >= n_ctx) {
+            // Discard half of the tokens after the kept prefix and keep going
+            const int n_discard = (n_cur - n_keep) / 2;
+            if (!cfg.contextShift || n_discard <= 0 ||
+                !shiftKvCache(context_, lastPromptTokens_, (size_t)n_keep, (size_t)n_discard)) {
+                LOGW("Context full (%d tokens), stopping generation", n_cur);
+                break;
+            }
+            n_cur -= n_discard;
+            LOGI("Context shift: discarded %d tokens after the first %d", n_discard, n_keep);
+            
+            // Apply the same shift to the draft cache, or drop its tail if it can't be shifted
+            if (draftContext_ != nullptr && draftCachedTokens_.size() > (size_t)n_keep) {
+                if (draftCachedTokens_.size() < (size_t)(n_keep + n_discard) ||
+                    !shiftKvCache(draftContext_, draftCachedTokens_, (size_t)n_keep, (size_t)n_discard)) {
+                    llama_memory_seq_rm(llama_get_memory(draftContext_), 0, n_keep, -1);
+                    draftCachedTokens_.resize(n_keep);
+                }
+            }
+        }
         
-        // Call callback with new token
-        callback(tokenStr);
+        // Draft the next few tokens, bounded by the remaining budget and context
+        drafts.clear();
+        const int nDraft = std::min({nDraftMax, cfg.maxTokens - n_generated, n_ctx - n_cur - 1});
+        if (nDraft > 0) {
+            LLAMA_TRACE_SCOPE("llama:draft");
+            draftTokens(newToken, nDraft, drafts);
+        }
         
-        // Prepare batch for next token
+        // Prepare batch: the new token followed by the drafts to verify
         batch.n_tokens = 0;
-        batch.token[0] = newToken;
-        batch.pos[0] = n_cur;
-        batch.n_seq_id[0] = 1;
-        batch.seq_id[0][0] = 0;
-        batch.logits[0] = true;
-        batch.n_tokens = 1;
+        for (size_t i = 0; i <= drafts.size(); i++) {
+            batch.token[i] = (i == 0) ? newToken : drafts[i - 1];
+            batch.pos[i] = n_cur + (int)i;
+            batch.n_seq_id[i] = 1;
+            batch.seq_id[i][0] = 0;
+            batch.logits[i] = true;
+            batch.n_tokens++;
+        }
         
         // Decode
-        int decode_result = llama_decode(context_, batch);
+        int decode_result;
+        {
+            LLAMA_TRACE_SCOPE("llama:decode");
+            decode_result = llama_decode(context_, batch);
+        }
+        if (decode_result == 2) {
+            // Aborted by cancelGeneration(); the token was emitted but never entered the cache
+            llama_memory_seq_rm(llama_get_memory(context_), 0, n_cur, -1);
+            break;
+        }
         if (decode_result != 0) {
             LOGE("Failed to decode token, error code: %d", decode_result);
             setError("Failed to decode token");
+            invalidateKvCache();
             break;
         }
         
+        // Generated tokens stay in the KV cache and can be reused by the next turn
+        lastPromptTokens_.push_back(newToken);
+        lastPromptTokens_.insert(lastPromptTokens_.end(), drafts.begin(), drafts.end());
         n_cur++;
-        n_generated++;
+        
+        // Verify drafts: accept them for as long as the target model samples the same token
+        size_t n_ok = 0;
+        newToken = sample(0);
+        while (n_ok < drafts.size() && newToken == drafts[n_ok] &&
+               n_generated < cfg.maxTokens && !shouldCancel_ &&
+               !llama_vocab_is_eog(vocab, newToken)) {
+            emitToken(newToken);
+            n_generated++;
+            n_cur++;
+            n_ok++;
+            newToken = sample((int32_t)n_ok);
+        }
+        
+        if (!drafts.empty()) {
+            n_drafted += (int)drafts.size();
+            n_accepted += (int)n_ok;
+            
+            // Roll back the rejected drafts
+            if (n_ok < drafts.size()) {
+                llama_memory_seq_rm(llama_get_memory(context_), 0, n_cur, -1);
+                lastPromptTokens_.resize(n_cur);
+            }
+        }
+    }
+    
+    utf8_.flush(emitted_);
+    if (!emitted_.empty()) {
+        callback(emitted_);
+    }
+    
+    lastDraftedTokens_ = n_drafted;
+    lastAcceptedTokens_ = n_accepted;
+    
+    // Also a reply cut short by maxTokens or cancellation, so the history matches the KV cache
+    if (conversation != nullptr && !replyTokens_.empty()) {
+        conversation->appendReply(replyTokens_, replyText_);
+    }
+    
+    stats.decodeMs = elapsedMs(tDecode);
+    stats.generatedTokens = n_generated;
+    stats.tokensPerSecond = stats.decodeMs > 0.0 ? 1000.0 * n_generated / stats.decodeMs : 0.0;
+    stats.draftedTokens = n_drafted;
+    stats.acceptedTokens = n_accepted;
+    lastStats_ = stats;
+    if (n_drafted > 0) {
+        LOGI("Speculative decoding: %d/%d drafted tokens accepted (%.1f%%)",
+             n_accepted, n_drafted, 100.0f * n_accepted / n_drafted);
     }
     
-    // Mark generation as complete BEFORE freeing batch
     isGenerating_ = false;
     
-    llama_batch_free(batch);
-    LOGI("Generation complete: %d tokens generated", n_generated);
+    LOGI("Generation complete: %d tokens generated (prefill %.1f ms, TTFT %.1f ms, %.2f t/s)",
+         n_generated, stats.prefillMs, stats.timeToFirstTokenMs, stats.tokensPerSecond);
+    
+    if (evictPending_.exchange(false)) {
+        evictCaches();
+    }
     
 #else
     // Stub implementation for testing
@@ -371,166 +919,1329 @@ void LlamaContextWrapper::generateStream(const std::string& prompt, TokenCallbac
     std::string word;
     while (iss >> word && !shouldCancel_) {
         callback(word + " ");
+        stats.generatedTokens++;
     }
+    stats.decodeMs = elapsedMs(tStart);
+    lastStats_ = stats;
+    isGenerating_ = false;
 #endif
 }
 
-void LlamaContextWrapper::cancelGeneration() {
-    LOGI("Generation cancellation requested");
-    shouldCancel_ = true;
-}
-
-bool LlamaContextWrapper::isGenerating() const {
-    return isGenerating_;
-}
-
-std::string LlamaContextWrapper::getLastError() const {
+#if LLAMA_AVAILABLE
+std::string LlamaContextWrapper::generateStreamParallel(const std::string& prompt,
+                                                        const std::vector<int32_t>* promptTokens,
+                                                        TokenCallback callback, const LlamaConfig* config,
+                                                        int conversationId) {
+    auto request = std::make_shared<SequenceRequest>();
+    const auto tStart = std::chrono::steady_clock::now();
+    GenerationStats stats;
+    
+    {
+        // Errors are returned rather than kept in lastError_, which concurrent requests share
+        std::lock_guard<std::mutex> lock(mutex_);
+        
+        if (!isModelLoaded() || !scheduler_) {
+            LOGE("Model not loaded");
+            return "Model not loaded";
+        }
+        
+        const LlamaConfig& cfg = config ? *config : currentConfig_;
+        
+        if (conversationId != 0) {
+            Conversation* conversation = findConversation(conversationId);
+            std::vector<std::vector<llama_token>> turns;
+            std::string error;
+            if (conversation == nullptr) {
+                return "Invalid conversation";
+            }
+            if (!conversation->promptTurns(turns, error)) {
+                return error;
+            }
+            if (llama_vocab_get_add_bos(llama_model_get_vocab(model_))) {
+                request->prompt.push_back(llama_vocab_bos(llama_model_get_vocab(model_)));
+            }
+            for (const std::vector<llama_token>& turn : turns) {
+                request->prompt.insert(request->prompt.end(), turn.begin(), turn.end());
+            }
+        } else if (promptTokens != nullptr) {
+            // One bad id would fail the shared batch and with it every sequence in flight
+            const int32_t nVocab = llama_vocab_n_tokens(llama_model_get_vocab(model_));
+            for (int32_t token : *promptTokens) {
+                if (token < 0 || token >= nVocab) {
+                    return "Invalid token id in prompt: " + std::to_string(token);
+                }
+            }
+            request->prompt.assign(promptTokens->begin(), promptTokens->end());
+        } else {
+            request->prompt = tokenize(prompt, true);
+        }
+        if (request->prompt.empty()) {
+            return "Failed to tokenize prompt";
+        }
+        stats.tokenizeMs = elapsedMs(tStart);
+        
+        // Each sequence only owns its share of the context
+        const int maxPromptTokens = scheduler_->contextPerSequence() - cfg.maxTokens - 16;
+        if ((int)request->prompt.size() > maxPromptTokens) {
+            if (maxPromptTokens < 64) {
+                return "Context too small for generation. Increase contextSize or reduce parallelSequences.";
+            }
+            request->prompt = smartTruncate(request->prompt, maxPromptTokens);
+            stats.truncated = true;
+        }
+        stats.promptTokens = (int)request->prompt.size();
+        stats.batchCapacity = (int)llama_n_batch(context_);
+        
+        // Each sequence samples with its own copy of the cached chain and its own RNG state
+        llama_sampler* shared = cachedSampler(cfg);
+        if (shared == nullptr) {
+            return lastError_;  // Set by withGrammar() under the lock held here
+        }
+        request->sampler = llama_sampler_clone(shared);
+        llama_sampler_reset(request->sampler);
+        request->maxTokens = cfg.maxTokens;
+        request->cancelEpoch = cancelEpoch_.load();
+        
+        LOGI("Submitting parallel request: %zu prompt tokens", request->prompt.size());
+        
+        // Submit under the lock so unloadModel() can't destroy the scheduler in between
+        activeParallelRequests_++;
+        scheduler_->submit(request);
+    }
+    
+    // Deliver tokens on the calling thread while the scheduler keeps decoding.
+    // Prefill is shared with other sequences, so only wall-clock TTFT and decode time are reported.
+    std::chrono::steady_clock::time_point tFirst;
+    Utf8StreamDecoder utf8;
+    std::string text;
+    std::string reply;
+    std::string error = request->drain([&](const std::string& piece) {
+        if (stats.generatedTokens++ == 0) {
+            tFirst = std::chrono::steady_clock::now();
+            stats.timeToFirstTokenMs = elapsedMs(tStart);
+        }
+        if (conversationId != 0) {
+            reply += piece;
+        }
+        utf8.push(piece, text);
+        if (!text.empty()) {
+            callback(text);
+        }
+    });
+    utf8.flush(text);
+    if (!text.empty()) {
+        callback(text);
+    }
+    activeParallelRequests_--;
+    
+    if (stats.generatedTokens > 0) {
+        stats.decodeMs = elapsedMs(tFirst);
+        stats.tokensPerSecond = stats.decodeMs > 0.0 ? 1000.0 * (stats.generatedTokens - 1) / stats.decodeMs : 0.0;
+    }
+    
     std::lock_guard<std::mutex> lock(mutex_);
-    return lastError_;
+    lastStats_ = stats;
+    
+    // The tokens the sequence sampled, which are also what its KV cache holds
+    Conversation* conversation = conversationId != 0 ? findConversation(conversationId) : nullptr;
+    if (conversation != nullptr && !reply.empty()) {
+        conversation->appendReply(request->sampledTokens(), reply);
+    }
+    return error;
 }
-
-std::string LlamaContextWrapper::getVersion() {
-#if LLAMA_AVAILABLE
-    std::string version = LIBRARY_VERSION;
-    version += " (llama.cpp)";
-    return version;
-#else
-    return std::string(LIBRARY_VERSION) + " (stub)";
 #endif
-}
 
-void LlamaContextWrapper::setError(const std::string& error) {
-    lastError_ = error;
-    LOGE("Error: %s", error.c_str());
-}
-
-void LlamaContextWrapper::clearError() {
-    lastError_.clear();
+void LlamaContextWrapper::cancelGeneration() {
+    LOGI("Generation cancellation requested");
+    shouldCancel_ = true;
+    cancelEpoch_++;
 }
 
+BenchmarkResult LlamaContextWrapper::benchmark(int promptTokens, int genTokens, int reps) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    BenchmarkResult result;
+    
 #if LLAMA_AVAILABLE
-
-std::vector<llama_token> LlamaContextWrapper::tokenize(const std::string& text, bool addBos) {
-    // Get vocab from model
-    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    if (!isModelLoaded()) {
+        setError("Model not loaded");
+        return result;
+    }
+    if (scheduler_) {
+        setError("Benchmark is not supported with parallelSequences > 1");
+        return result;
+    }
     
-    // Estimate number of tokens (rough: 1 token per 4 chars)
-    int n_tokens_estimate = text.length() / 4 + 16;
-    std::vector<llama_token> tokens(n_tokens_estimate);
+    const int n_ctx = (int)llama_n_ctx(context_);
+    const int n_batch = (int)llama_n_batch(context_);
+    promptTokens = std::max(1, std::min(promptTokens, n_ctx - 1));
+    genTokens = std::max(1, std::min(genTokens, n_ctx - 1));
+    reps = std::max(1, reps);
     
-    // Tokenize using vocab
-    int n_tokens = llama_tokenize(
-        vocab,
-        text.c_str(),
-        text.length(),
+    LOGI("Benchmark: pp=%d tg=%d reps=%d", promptTokens, genTokens, reps);
+    
+    isGenerating_ = true;
+    shouldCancel_ = false;
+    
+    // Synthetic prompt - fixed seed so runs are comparable across devices
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> dist(0, n_vocab - 1);
+    std::vector<llama_token> tokens(std::max(promptTokens, genTokens));
+    for (auto& t : tokens) {
+        t = dist(rng);
+    }
+    tokens[0] = llama_vocab_bos(vocab) >= 0 ? llama_vocab_bos(vocab) : tokens[0];
+    
+    llama_batch batch = llama_batch_init(n_batch, 0, 1);
+    if (batch.token == nullptr) {
+        setError("Failed to allocate benchmark batch");
+        isGenerating_ = false;
+        return result;
+    }
+    llama_memory_t mem = llama_get_memory(context_);
+    
+    // Decode tokens[0, count) in chunks of chunkSize, logits only for the last token
+    auto prefill = [&](int count, int chunkSize) -> bool {
+        llama_memory_clear(mem, true);
+        for (int start = 0; start < count; start += chunkSize) {
+            const int n = std::min(chunkSize, count - start);
+            batch.n_tokens = 0;
+            for (int i = 0; i < n; i++) {
+                batch.token[i] = tokens[start + i];
+                batch.pos[i] = start + i;
+                batch.n_seq_id[i] = 1;
+                batch.seq_id[i][0] = 0;
+                batch.logits[i] = (start + i == count - 1);
+                batch.n_tokens++;
+            }
+            if (llama_decode(context_, batch) != 0 || shouldCancel_) {
+                return false;
+            }
+        }
+        llama_synchronize(context_);
+        return true;
+    };
+    
+    bool ok = true;
+    
+    // 1. Prefill throughput at several batch sizes
+    std::vector<int> batchSizes;
+    for (int bs : {32, 64, 128, 256, 512, 1024, 2048}) {
+        if (bs < n_batch && bs < promptTokens) batchSizes.push_back(bs);
+    }
+    batchSizes.push_back(std::min(n_batch, promptTokens));
+    
+    for (int bs : batchSizes) {
+        double totalMs = 0.0;
+        for (int r = 0; r < reps && ok; r++) {
+            auto start = std::chrono::steady_clock::now();
+            ok = prefill(promptTokens, bs);
+            totalMs += elapsedMs(start);
+        }
+        if (!ok) break;
+        result.prefill.push_back({bs, 1000.0 * promptTokens * reps / totalMs});
+        LOGI("Benchmark pp%d @ batch %d: %.2f t/s", promptTokens, bs, result.prefill.back().tokensPerSecond);
+    }
+    
+    // 2. Time to first token: full prompt at the configured batch size + one sampled token
+    if (ok) {
+        double totalMs = 0.0;
+        for (int r = 0; r < reps && ok; r++) {
+            auto start = std::chrono::steady_clock::now();
+            ok = prefill(promptTokens, n_batch);
+            if (ok) {
+                llama_sampler_sample(sampler_, context_, -1);
+            }
+            totalMs += elapsedMs(start);
+        }
+        result.ttftMs = totalMs / reps;
+    }
+    
+    // 3. Decode throughput and per-token latency at several thread counts
+    // The pinned pool of automatic threads caps llama_set_n_threads at its size,
+    // so larger counts would run on the pool size but be reported as measured
+    const int maxThreads = threadpool_ != nullptr ? currentConfig_.threads
+                                                  : std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int t : {1, 2, 4, 6, 8}) {
+        if (t <= maxThreads) threadCounts.push_back(t);
+    }
+    if (std::find(threadCounts.begin(), threadCounts.end(), currentConfig_.threads) == threadCounts.end()) {
+        threadCounts.push_back(currentConfig_.threads);
+    }
+    
+    std::vector<double> latencies;
+    for (int threads : threadCounts) {
+        if (!ok) break;
+        llama_set_n_threads(context_, threads, currentConfig_.threadsBatch);
+        latencies.clear();
+        double totalMs = 0.0;
+        
+        for (int r = 0; r < reps && ok; r++) {
+            llama_memory_clear(mem, true);
+            for (int i = 0; i < genTokens && ok; i++) {
+                batch.n_tokens = 1;
+                batch.token[0] = tokens[i];
+                batch.pos[0] = i;
+                batch.n_seq_id[0] = 1;
+                batch.seq_id[0][0] = 0;
+                batch.logits[0] = true;
+                
+                auto start = std::chrono::steady_clock::now();
+                ok = llama_decode(context_, batch) == 0 && !shouldCancel_;
+                llama_synchronize(context_);
+                double ms = elapsedMs(start);
+                latencies.push_back(ms);
+                totalMs += ms;
+            }
+        }
+        if (!ok) break;
+        
+        BenchmarkResult::Decode entry;
+        entry.threads = threads;
+        entry.tokensPerSecond = 1000.0 * genTokens * reps / totalMs;
+        entry.p50Ms = percentile(latencies, 0.50);
+        entry.p99Ms = percentile(latencies, 0.99);
+        result.decode.push_back(entry);
+        LOGI("Benchmark tg%d @ %d threads: %.2f t/s (p50 %.2f ms, p99 %.2f ms)",
+             genTokens, threads, entry.tokensPerSecond, entry.p50Ms, entry.p99Ms);
+    }
+    
+    // Restore the configured threads and leave an empty cache behind
+    llama_set_n_threads(context_, currentConfig_.threads, currentConfig_.threadsBatch);
+    llama_batch_free(batch);
+    invalidateKvCache();
+    isGenerating_ = false;
+    
+    result.peakRssKb = readPeakRssKb();
+    
+    if (!ok) {
+        setError(shouldCancel_ ? "Benchmark cancelled" : "Benchmark decode failed");
+        return BenchmarkResult();
+    }
+    
+    LOGI("Benchmark complete: TTFT %.1f ms, peak RSS %ld kB", result.ttftMs, result.peakRssKb);
+    return result;
+#else
+    setError("Benchmark requires llama.cpp");
+    return result;
+#endif
+}
+
+float LlamaContextWrapper::getDraftAcceptanceRate() const {
+    const int drafted = lastDraftedTokens_;
+    if (drafted <= 0) {
+        return -1.0f;
+    }
+    return (float)lastAcceptedTokens_ / (float)drafted;
+}
+
+GenerationStats LlamaContextWrapper::getLastGenerationStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastStats_;
+}
+
+void LlamaContextWrapper::trimMemory(int level) {
+    // Compute buffers are reserved at context creation, only the caches give memory back
+    const bool critical = level == TRIM_MEMORY_RUNNING_CRITICAL || level >= TRIM_MEMORY_BACKGROUND;
+    if (!critical) {
+        return;
+    }
+    LOGI("trimMemory(%d): evicting caches", level);
+    
+#if LLAMA_AVAILABLE
+    // Never block the caller (onTrimMemory runs on the main thread) behind a running generation
+    std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        evictPending_ = true;
+        return;
+    }
+    evictCaches();
+#endif
+}
+
+int LlamaContextWrapper::embed(const std::vector<std::string>& texts, int pooling, bool normalize,
+                               std::vector<float>& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    out.clear();
+    
+    if (!isModelLoaded()) {
+        setError("Model not loaded");
+        return 0;
+    }
+    
+#if LLAMA_AVAILABLE
+    if (!ensureEmbedContext(pooling)) {
+        LOGE("%s", lastError_.c_str());
+        return 0;
+    }
+    
+    const int nEmbd = llama_model_n_embd(model_);
+    const int nBatch = batchCapacity_;
+    llama_memory_t mem = llama_get_memory(embedContext_);  // nullptr for encoder-only models
+    llama_batch& batch = batch_;
+    std::vector<llama_token>& tokens = tokenScratch_;
+    
+    // One contiguous result, every vector is written in place
+    out.assign(texts.size() * (size_t)nEmbd, 0.0f);
+    
+    // Decode the texts [first, end) currently packed in the batch and read one vector per sequence
+    size_t first = 0;
+    auto decodePacked = [&](size_t end) -> bool {
+        if (mem != nullptr) {
+            llama_memory_clear(mem, true);
+        }
+        if (llama_decode(embedContext_, batch) != 0) {
+            setError("Failed to decode embeddings batch");
+            return false;
+        }
+        for (size_t t = first; t < end; t++) {
+            const float* embedding = llama_get_embeddings_seq(embedContext_, (llama_seq_id)(t - first));
+            if (embedding == nullptr) {
+                continue;  // Empty text, keeps a zero vector
+            }
+            float* dst = out.data() + t * nEmbd;
+            double norm = 0.0;
+            for (int k = 0; k < nEmbd; k++) {
+                norm += (double)embedding[k] * embedding[k];
+            }
+            const float scale = (normalize && norm > 0.0) ? (float)(1.0 / std::sqrt(norm)) : 1.0f;
+            for (int k = 0; k < nEmbd; k++) {
+                dst[k] = embedding[k] * scale;
+            }
+        }
+        batch.n_tokens = 0;
+        first = end;
+        return true;
+    };
+    
+    batch.n_tokens = 0;
+    for (size_t i = 0; i < texts.size(); i++) {
+        if (!tokenizeInto(texts[i].data(), texts[i].size(), true, tokens)) {
+            setError("Failed to tokenize embedding input");
+            out.clear();
+            return 0;
+        }
+        if ((int)tokens.size() > nBatch) {
+            LOGW("Embedding input %zu has %zu tokens, truncating to %d", i, tokens.size(), nBatch);
+            tokens.resize(nBatch);
+        }
+        
+        // Flush when this text doesn't fit next to the ones already packed
+        if (batch.n_tokens + (int)tokens.size() > nBatch || i - first >= (size_t)kMaxEmbedSequences) {
+            if (!decodePacked(i)) {
+                out.clear();
+                return 0;
+            }
+        }
+        
+        for (size_t j = 0; j < tokens.size(); j++) {
+            const int n = batch.n_tokens++;
+            batch.token[n] = tokens[j];
+            batch.pos[n] = (llama_pos)j;
+            batch.n_seq_id[n] = 1;
+            batch.seq_id[n][0] = (llama_seq_id)(i - first);
+            batch.logits[n] = true;  // Pooling reads every token of the sequence
+        }
+    }
+    if (batch.n_tokens > 0 && !decodePacked(texts.size())) {
+        out.clear();
+        return 0;
+    }
+    
+    LOGI("Embedded %zu texts (dimension %d)", texts.size(), nEmbd);
+    return nEmbd;
+#else
+    // Stub implementation for testing - deterministic unit vectors
+    const int nEmbd = 8;
+    out.assign(texts.size() * (size_t)nEmbd, 0.0f);
+    for (size_t t = 0; t < texts.size(); t++) {
+        out[t * nEmbd + texts[t].size() % nEmbd] = 1.0f;
+    }
+    return nEmbd;
+#endif
+}
+
+size_t LlamaContextWrapper::estimateKvCacheBytes(const LlamaConfig& config) const {
+#if LLAMA_AVAILABLE
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    KvCacheType typeK;
+    KvCacheType typeV;
+    if (model_ == nullptr || !parseKvCacheType(config.cacheTypeK, typeK) || !parseKvCacheType(config.cacheTypeV, typeV)) {
+        return 0;
+    }
+    return llamaandroid::estimateKvCacheBytes(kvCacheShape(model_), config.contextSize, typeK, typeV);
+#else
+    return 0;
+#endif
+}
+
+bool LlamaContextWrapper::isGenerating() const {
+    return isGenerating_ || activeParallelRequests_ > 0;
+}
+
+std::string LlamaContextWrapper::getLastError() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lastError_;
+}
+
+bool LlamaContextWrapper::planLoad(const std::string& modelPath, const LlamaConfig& config, LoadPlan& plan,
+                                   std::string& error) {
+#if LLAMA_AVAILABLE
+    KvCacheType typeK;
+    KvCacheType typeV;
+    if (!parseKvCacheType(config.cacheTypeK, typeK) || !parseKvCacheType(config.cacheTypeV, typeV)) {
+        error = "Invalid KV cache type";
+        return false;
+    }
+    ModelFootprint footprint;
+    if (!readModelFootprint(modelPath, footprint, error)) {
+        return false;
+    }
+    
+    plan = LoadPlan();
+    plan.weightBytes = footprint.weightBytes;
+    plan.kvCacheBytes = llamaandroid::estimateKvCacheBytes(footprint.shape, config.contextSize, typeK, typeV);
+    // At the largest n_ubatch loadModel() would pick, before any low-memory reduction
+    const int microBatch = std::max(1, std::min(config.batchSize, kDefaultMicroBatch));
+    plan.computeBytes = (size_t)microBatch * computeBytesPerToken(footprint.nVocab, footprint.nEmbd, footprint.nHead,
+                                                                  config.contextSize, config.flashAttention);
+    plan.availableBytes = MemoryInfo::read().availableBytes;
+    plan.layerCount = footprint.shape.nLayer;
+    plan.contextLength = footprint.contextLength;
+    
+    // The requested device, otherwise the GPU with the most free memory
+    size_t gpuFree = 0;
+    for (const BackendDevice& device : listBackendDevices()) {
+        if (device.type == 0) {
+            continue;
+        }
+        if (config.gpuDevice.empty() ? device.memoryFree > gpuFree : device.name == config.gpuDevice) {
+            gpuFree = device.memoryFree;
+        }
+    }
+    
+    // llama.cpp offloads the last gpuLayers layers, each with its share of the KV cache
+    size_t budget = gpuFree > plan.computeBytes ? gpuFree - plan.computeBytes : 0;
+    const size_t kvPerLayer = plan.kvCacheBytes / (size_t)plan.layerCount;
+    for (int i = plan.layerCount - 1; i >= 0; i--) {
+        const size_t layer = footprint.layerBytes[i] + kvPerLayer;
+        if (layer > budget) {
+            break;
+        }
+        budget -= layer;
+        plan.gpuLayers++;
+    }
+    
+    LOGI("Load plan for %s: weights %zu MB, KV cache %zu MB, compute %zu MB, %zu MB available, %d/%d GPU layers",
+         modelPath.c_str(), plan.weightBytes >> 20, plan.kvCacheBytes >> 20, plan.computeBytes >> 20,
+         plan.availableBytes >> 20, plan.gpuLayers, plan.layerCount);
+    return true;
+#else
+    error = "Load planning requires llama.cpp";
+    return false;
+#endif
+}
+
+std::vector<BackendDevice> LlamaContextWrapper::getBackendDevices() {
+    return listBackendDevices();
+}
+
+std::string LlamaContextWrapper::getVersion() {
+#if LLAMA_AVAILABLE
+    std::string version = LIBRARY_VERSION;
+    version += " (llama.cpp)";
+    return version;
+#else
+    return std::string(LIBRARY_VERSION) + " (stub)";
+#endif
+}
+
+// In-memory snapshot layout: header, cached tokens, then llama.cpp's sequence state
+namespace {
+constexpr uint32_t STATE_MAGIC = 0x4C4B5653;  // 'LKVS'
+constexpr uint32_t STATE_VERSION = 1;
+
+struct StateHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nTokens;
+    uint32_t reserved;
+};
+} // namespace
+
+bool LlamaContextWrapper::saveState(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    if (context_ == nullptr) {
+        setError("Model not loaded");
+        return false;
+    }
+    if (isGenerating_) {
+        setError("Cannot save state while generating");
+        return false;
+    }
+    if (scheduler_) {
+        setError("State snapshots are not supported with parallelSequences > 1");
+        return false;
+    }
+    
+    // llama_state_seq_save_file streams the state to disk chunk by chunk
+    size_t written = llama_state_seq_save_file(context_, path.c_str(), 0,
+                                               lastPromptTokens_.data(), lastPromptTokens_.size());
+    if (written == 0) {
+        setError("Failed to save state to: " + path);
+        return false;
+    }
+    
+    LOGI("Saved state: %zu tokens, %zu bytes -> %s", lastPromptTokens_.size(), written, path.c_str());
+    return true;
+#else
+    setError("State snapshots require llama.cpp");
+    return false;
+#endif
+}
+
+bool LlamaContextWrapper::restoreState(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    if (context_ == nullptr) {
+        setError("Model not loaded");
+        return false;
+    }
+    if (isGenerating_) {
+        setError("Cannot restore state while generating");
+        return false;
+    }
+    if (scheduler_) {
+        setError("State snapshots are not supported with parallelSequences > 1");
+        return false;
+    }
+    
+    invalidateKvCache();
+    
+    std::vector<llama_token> tokens(llama_n_ctx(context_));
+    size_t nTokens = 0;
+    size_t read = llama_state_seq_load_file(context_, path.c_str(), 0,
+                                            tokens.data(), tokens.size(), &nTokens);
+    if (read == 0) {
+        invalidateKvCache();
+        setError("Failed to restore state from: " + path);
+        return false;
+    }
+    
+    tokens.resize(nTokens);
+    lastPromptTokens_ = std::move(tokens);
+    
+    LOGI("Restored state: %zu tokens, %zu bytes <- %s", lastPromptTokens_.size(), read, path.c_str());
+    return true;
+#else
+    setError("State snapshots require llama.cpp");
+    return false;
+#endif
+}
+
+size_t LlamaContextWrapper::getStateSize() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+#if LLAMA_AVAILABLE
+    if (context_ == nullptr) {
+        return 0;
+    }
+    return sizeof(StateHeader) + lastPromptTokens_.size() * sizeof(llama_token) +
+           llama_state_seq_get_size(context_, 0);
+#else
+    return 0;
+#endif
+}
+
+size_t LlamaContextWrapper::saveStateToBuffer(uint8_t* dst, size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    if (context_ == nullptr) {
+        setError("Model not loaded");
+        return 0;
+    }
+    if (isGenerating_) {
+        setError("Cannot save state while generating");
+        return 0;
+    }
+    if (scheduler_) {
+        setError("State snapshots are not supported with parallelSequences > 1");
+        return 0;
+    }
+    
+    const size_t tokenBytes = lastPromptTokens_.size() * sizeof(llama_token);
+    const size_t headerBytes = sizeof(StateHeader) + tokenBytes;
+    const size_t seqBytes = llama_state_seq_get_size(context_, 0);
+    if (dst == nullptr || capacity < headerBytes + seqBytes) {
+        setError("State buffer too small: need " + std::to_string(headerBytes + seqBytes) +
+                 " bytes, have " + std::to_string(capacity));
+        return 0;
+    }
+    
+    StateHeader header = {STATE_MAGIC, STATE_VERSION, (uint32_t)lastPromptTokens_.size(), 0};
+    memcpy(dst, &header, sizeof(header));
+    // data() may be null for an empty vector, and memcpy from null is undefined even for 0 bytes
+    if (tokenBytes > 0) {
+        memcpy(dst + sizeof(header), lastPromptTokens_.data(), tokenBytes);
+    }
+    
+    // Serialize straight into the caller's buffer
+    size_t written = llama_state_seq_get_data(context_, dst + headerBytes, capacity - headerBytes, 0);
+    if (written == 0 && seqBytes > 0) {
+        setError("Failed to serialize state");
+        return 0;
+    }
+    
+    LOGI("Saved state to buffer: %zu tokens, %zu bytes", lastPromptTokens_.size(), headerBytes + written);
+    return headerBytes + written;
+#else
+    setError("State snapshots require llama.cpp");
+    return 0;
+#endif
+}
+
+bool LlamaContextWrapper::restoreStateFromBuffer(const uint8_t* src, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    if (context_ == nullptr) {
+        setError("Model not loaded");
+        return false;
+    }
+    if (isGenerating_) {
+        setError("Cannot restore state while generating");
+        return false;
+    }
+    if (scheduler_) {
+        setError("State snapshots are not supported with parallelSequences > 1");
+        return false;
+    }
+    
+    StateHeader header;
+    if (src == nullptr || size < sizeof(header)) {
+        setError("State buffer too small");
+        return false;
+    }
+    memcpy(&header, src, sizeof(header));
+    
+    if (header.magic != STATE_MAGIC || header.version != STATE_VERSION) {
+        setError("Invalid state buffer (bad magic or version)");
+        return false;
+    }
+    
+    const size_t tokenBytes = (size_t)header.nTokens * sizeof(llama_token);
+    const size_t headerBytes = sizeof(header) + tokenBytes;
+    if (size < headerBytes || header.nTokens > llama_n_ctx(context_)) {
+        setError("State buffer is truncated or does not fit the context");
+        return false;
+    }
+    
+    invalidateKvCache();
+    
+    size_t read = llama_state_seq_set_data(context_, src + headerBytes, size - headerBytes, 0);
+    if (read == 0) {
+        invalidateKvCache();
+        setError("Failed to restore state from buffer");
+        return false;
+    }
+    
+    lastPromptTokens_.resize(header.nTokens);
+    if (tokenBytes > 0) {
+        memcpy(lastPromptTokens_.data(), src + sizeof(header), tokenBytes);
+    }
+    
+    LOGI("Restored state from buffer: %zu tokens, %zu bytes", lastPromptTokens_.size(), headerBytes + read);
+    return true;
+#else
+    setError("State snapshots require llama.cpp");
+    return false;
+#endif
+}
+
+void LlamaContextWrapper::setError(const std::string& error) {
+    lastError_ = error;
+    LOGE("Error: %s", error.c_str());
+}
+
+void LlamaContextWrapper::clearError() {
+    lastError_.clear();
+}
+
+#if LLAMA_AVAILABLE
+
+std::vector<llama_token> LlamaContextWrapper::tokenize(const std::string& text, bool addBos) {
+    std::vector<llama_token> tokens;
+    if (!tokenizeInto(text.data(), text.size(), addBos, tokens)) {
+        return {};
+    }
+    return tokens;
+}
+
+bool LlamaContextWrapper::tokenizeInto(const char* text, size_t length, bool addBos, std::vector<llama_token>& tokens) {
+    LLAMA_TRACE_SCOPE("llama:tokenize");
+    // Get vocab from model
+    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    
+    // Every token covers at least one byte, so bytes + a few special tokens (BOS, EOS, SPM's
+    // leading space) is an upper bound and one pass is enough - also for CJK, ~1 token per 3 bytes.
+    // Any capacity the buffer already has is used too.
+    const size_t n_tokens_bound = length + 4;
+    tokens.resize(std::max(n_tokens_bound, tokens.capacity()));
+    
+    // Tokenize using vocab
+    int n_tokens = llama_tokenize(
+        vocab,
+        text,
+        (int32_t)length,
         tokens.data(),
-        tokens.size(),
+        (int32_t)tokens.size(),
         addBos,
         true  // parse special tokens
     );
     
-    if (n_tokens < 0) {
-        // Need more space
+    if (n_tokens < 0 && n_tokens != INT32_MIN) {
+        // Not expected with the bound above, kept as a safety net
         tokens.resize(-n_tokens);
         n_tokens = llama_tokenize(
             vocab,
-            text.c_str(),
-            text.length(),
+            text,
+            (int32_t)length,
             tokens.data(),
-            tokens.size(),
+            (int32_t)tokens.size(),
             addBos,
             true
         );
     }
     
-    if (n_tokens < 0) {
-        LOGE("Failed to tokenize text");
-        return {};
+    if (n_tokens < 0) {
+        LOGE("Failed to tokenize text");
+        tokens.clear();
+        return false;
+    }
+    
+    tokens.resize(n_tokens);
+    return true;
+}
+
+std::string LlamaContextWrapper::detokenize(const std::vector<llama_token>& tokens) {
+    std::string result;
+    
+    // Get vocab from model
+    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    
+    for (llama_token token : tokens) {
+        // Get token text
+        char buf[256];
+        int n = llama_token_to_piece(vocab, token, buf, sizeof(buf) - 1, 0, true);
+        
+        if (n < 0) {
+            LOGW("Failed to detokenize token: %d", token);
+            continue;
+        }
+        
+        buf[n] = '\0';
+        result += buf;
+    }
+    
+    return result;
+}
+
+const std::string& LlamaContextWrapper::tokenToPiece(llama_token token) {
+    LLAMA_TRACE_SCOPE("llama:detokenize");
+    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    
+    // Write straight into the reused piece buffer, growing it only for unusually long pieces
+    piece_.resize(piece_.capacity());
+    int n = llama_token_to_piece(vocab, token, &piece_[0], (int32_t)piece_.size(), 0, true);
+    if (n < 0) {
+        piece_.resize(-n);
+        n = llama_token_to_piece(vocab, token, &piece_[0], (int32_t)piece_.size(), 0, true);
+    }
+    if (n < 0) {
+        LOGW("Failed to detokenize token: %d", token);
+        n = 0;
+    }
+    piece_.resize(n);
+    return piece_;
+}
+
+bool LlamaContextWrapper::allocateBuffers(int batchSize, int nCtx) {
+    // Halve the capacity until it fits; prefill chunks and drafts are bounded by it
+    batchCapacity_ = std::max(batchSize, kMinMicroBatch);
+    batch_ = llama_batch_init(batchCapacity_, 0, 1);
+    while ((batch_.token == nullptr || batch_.pos == nullptr) && batchCapacity_ > kMinMicroBatch) {
+        LOGW("Failed to allocate batch with capacity %d, retrying with %d", batchCapacity_, batchCapacity_ / 2);
+        llama_batch_free(batch_);
+        batchCapacity_ /= 2;
+        batch_ = llama_batch_init(batchCapacity_, 0, 1);
+    }
+    if (batch_.token == nullptr || batch_.pos == nullptr) {
+        llama_batch_free(batch_);
+        batch_ = {};
+        batchCapacity_ = 0;
+        return false;
+    }
+    
+    // Everything a generation appends to is bounded by the context
+    tokenScratch_.reserve(nCtx);
+    lastPromptTokens_.reserve(nCtx);
+    drafts_.reserve(batchCapacity_);
+    piece_.reserve(256);
+    emitted_.reserve(256);
+    return true;
+}
+
+void LlamaContextWrapper::freeBuffers() {
+    if (batch_.token != nullptr) {
+        llama_batch_free(batch_);
+        batch_ = {};
+    }
+    batchCapacity_ = 0;
+    // Release the capacity, not just the contents
+    std::vector<llama_token>().swap(tokenScratch_);
+    std::vector<llama_token>().swap(drafts_);
+    std::string().swap(piece_);
+    std::string().swap(emitted_);
+}
+
+size_t LlamaContextWrapper::findLongestCommonPrefix(const std::vector<llama_token>& a, const std::vector<llama_token>& b) {
+    // A single linear scan: exact, and it stops at the first difference
+    const size_t maxLen = std::min(a.size(), b.size());
+    auto mismatch = std::mismatch(a.begin(), a.begin() + maxLen, b.begin());
+    return static_cast<size_t>(mismatch.first - a.begin());
+}
+
+void LlamaContextWrapper::invalidateKvCache() {
+    lastPromptTokens_.clear();
+    for (llama_context* ctx : {context_, draftContext_}) {
+        if (ctx != nullptr) {
+            llama_memory_t mem = llama_get_memory(ctx);
+            if (mem != nullptr) {
+                llama_memory_clear(mem, true);
+            }
+        }
+    }
+    draftCachedTokens_.clear();
+}
+
+namespace {
+// Threadpool functions live in the CPU backend, which is a separate module in LLAMA_BACKEND_DL builds,
+// so they are resolved through the backend registry instead of being linked directly
+template <typename Fn>
+Fn* cpuBackendProc(const char* name) {
+    ggml_backend_reg_t reg = ggml_backend_reg_by_name("CPU");
+    return reg != nullptr ? reinterpret_cast<Fn*>(ggml_backend_reg_get_proc_address(reg, name)) : nullptr;
+}
+} // namespace
+
+void LlamaContextWrapper::createThreadpools(int nThreads, int nThreadsBatch) {
+    const CpuTopology& topology = CpuTopology::get();
+    auto* threadpoolNew = cpuBackendProc<decltype(ggml_threadpool_new)>("ggml_threadpool_new");
+    if (threadpoolNew == nullptr) {
+        LOGW("CPU backend has no threadpool API, using llama.cpp's default threads");
+        return;
+    }
+    
+    // Decode runs on the performance cores only; prefill may also use the efficiency cores
+    ggml_threadpool_params params;
+    ggml_threadpool_params_init(&params, nThreads);
+    const std::vector<int>& decodeCores = topology.performanceCores;
+    for (int cpu : decodeCores) {
+        if (cpu < GGML_MAX_N_THREADS) params.cpumask[cpu] = true;
+    }
+    
+    ggml_threadpool_params batchParams;
+    ggml_threadpool_params_init(&batchParams, nThreadsBatch);
+    for (const std::vector<int>* cores : {&topology.performanceCores, &topology.efficiencyCores}) {
+        for (int cpu : *cores) {
+            if (cpu < GGML_MAX_N_THREADS) batchParams.cpumask[cpu] = true;
+        }
+    }
+    
+    threadpool_ = threadpoolNew(&params);
+    threadpoolBatch_ = (nThreadsBatch != nThreads || topology.isHeterogeneous())
+        ? threadpoolNew(&batchParams)
+        : nullptr;
+    if (threadpool_ == nullptr) {
+        LOGW("Failed to create threadpool, using llama.cpp's default threads");
+        freeThreadpools();
+        return;
+    }
+    
+    llama_attach_threadpool(context_, threadpool_, threadpoolBatch_);
+    LOGI("Threadpools attached: decode %d threads on %zu performance cores, batch %d threads",
+         nThreads, decodeCores.size(), nThreadsBatch);
+}
+
+void LlamaContextWrapper::freeThreadpools() {
+    if (threadpool_ == nullptr && threadpoolBatch_ == nullptr) {
+        return;
+    }
+    auto* threadpoolFree = cpuBackendProc<decltype(ggml_threadpool_free)>("ggml_threadpool_free");
+    if (threadpoolFree == nullptr) {
+        return;
+    }
+    if (threadpool_ != nullptr) {
+        threadpoolFree(threadpool_);
+        threadpool_ = nullptr;
+    }
+    if (threadpoolBatch_ != nullptr) {
+        threadpoolFree(threadpoolBatch_);
+        threadpoolBatch_ = nullptr;
+    }
+}
+
+bool LlamaContextWrapper::loadDraftModel(const LlamaConfig& config, const llama_model_params& modelParams,
+                                         const llama_context_params& ctxParams) {
+    LOGI("Loading draft model from: %s", config.draftModelPath.c_str());
+    
+    draftModelRef_ = ModelRegistry::get().acquire(config.draftModelPath, modelParams);
+    draftModel_ = draftModelRef_.get();
+    if (draftModel_ == nullptr) {
+        setError("Failed to load draft model from: " + config.draftModelPath);
+        return false;
+    }
+    
+    // Draft tokens are verified by id, so both models need the same vocabulary
+    const llama_vocab* vocab = llama_model_get_vocab(model_);
+    const llama_vocab* draftVocab = llama_model_get_vocab(draftModel_);
+    if (llama_vocab_n_tokens(vocab) != llama_vocab_n_tokens(draftVocab) ||
+        llama_vocab_bos(vocab) != llama_vocab_bos(draftVocab) ||
+        llama_vocab_eos(vocab) != llama_vocab_eos(draftVocab)) {
+        setError("Draft model vocabulary does not match the target model");
+        unloadDraftModel();
+        return false;
+    }
+    
+    llama_context_params draftParams = ctxParams;
+    draftParams.n_seq_max = 1;
+    draftContext_ = llama_init_from_model(draftModel_, draftParams);
+    if (draftContext_ == nullptr) {
+        setError("Failed to create draft context");
+        unloadDraftModel();
+        return false;
+    }
+    llama_set_abort_callback(draftContext_, abortCallback, this);
+    
+    // The draft decodes in lockstep with the target, so it can share the same threads
+    if (threadpool_ != nullptr) {
+        llama_attach_threadpool(draftContext_, threadpool_, threadpoolBatch_);
+    }
+    
+    draftSampler_ = llama_sampler_init_greedy();
+    draftBatch_ = llama_batch_init(ctxParams.n_batch, 0, 1);
+    if (draftBatch_.token == nullptr) {
+        setError("Failed to allocate draft batch");
+        unloadDraftModel();
+        return false;
+    }
+    
+    LOGI("Draft model loaded, drafting %d tokens per step", config.draftTokens);
+    return true;
+}
+
+void LlamaContextWrapper::evictCaches() {
+    // Recreated on the next embed() call
+    freeEmbedContext();
+    
+    // The scheduler owns the sequences of parallel requests
+    if (scheduler_) {
+        return;
+    }
+    invalidateKvCache();
+    // The draft model is optional - free it and continue without speculative decoding
+    if (draftModel_ != nullptr) {
+        unloadDraftModel();
+        LOGW("Draft model released under memory pressure, speculative decoding disabled until reload");
+    }
+    LOGI("Evicted KV cache under memory pressure");
+}
+
+void LlamaContextWrapper::warmUp(llama_context* ctx) {
+    // Like llama.cpp's common warm-up: decode BOS/EOS once in warm-up mode, which runs every
+    // weight (all experts of MoE models), then drop the result. This faults in the mmapped
+    // weights and builds the kernels, which would otherwise slow down the first reply.
+    const auto tStart = std::chrono::steady_clock::now();
+    const llama_vocab* vocab = llama_model_get_vocab(llama_get_model(ctx));
+    llama_token tokens[2];
+    int nTokens = 0;
+    if (llama_vocab_bos(vocab) != LLAMA_TOKEN_NULL) {
+        tokens[nTokens++] = llama_vocab_bos(vocab);
+    }
+    if (llama_vocab_eos(vocab) != LLAMA_TOKEN_NULL) {
+        tokens[nTokens++] = llama_vocab_eos(vocab);
+    }
+    if (nTokens == 0) {
+        tokens[nTokens++] = 0;
     }
     
-    tokens.resize(n_tokens);
-    return tokens;
+    shouldCancel_ = false;
+    llama_set_warmup(ctx, true);
+    if (llama_decode(ctx, llama_batch_get_one(tokens, nTokens)) != 0) {
+        LOGW("Warm-up decode failed, the first prompt will run cold");
+    }
+    llama_synchronize(ctx);
+    llama_set_warmup(ctx, false);
+    llama_memory_clear(llama_get_memory(ctx), true);
+    llama_perf_context_reset(ctx);
+    LOGI("Warm-up done in %.1f ms", elapsedMs(tStart));
 }
 
-std::string LlamaContextWrapper::detokenize(const std::vector<llama_token>& tokens) {
-    std::string result;
+bool LlamaContextWrapper::abortCallback(void* data) {
+    return static_cast<LlamaContextWrapper*>(data)->shouldCancel_.load(std::memory_order_relaxed);
+}
+
+bool LlamaContextWrapper::ensureEmbedContext(int pooling) {
+    if (embedContext_ != nullptr && embedPooling_ == pooling) {
+        return true;
+    }
+    freeEmbedContext();
+    
+    // A whole batch is one micro-batch: non-causal models must see each sequence at once.
+    // Sequences share the unified cache instead of getting n_ctx / n_seq_max cells each.
+    llama_context_params params = llama_context_default_params();
+    params.n_ctx = batchCapacity_;
+    params.n_batch = batchCapacity_;
+    params.n_ubatch = batchCapacity_;
+    params.n_seq_max = kMaxEmbedSequences;
+    params.kv_unified = true;
+    params.embeddings = true;
+    params.pooling_type = (enum llama_pooling_type)pooling;
+    params.n_threads = currentConfig_.threads;
+    params.n_threads_batch = currentConfig_.threadsBatch;
+    
+    embedContext_ = llama_init_from_model(model_, params);
+    if (embedContext_ == nullptr) {
+        setError("Failed to create embeddings context");
+        return false;
+    }
+    if (llama_pooling_type(embedContext_) == LLAMA_POOLING_TYPE_NONE) {
+        setError("Model has no pooling layer, pass an explicit pooling type");
+        freeEmbedContext();
+        return false;
+    }
+    if (threadpool_ != nullptr) {
+        llama_attach_threadpool(embedContext_, threadpool_, threadpoolBatch_);
+    }
+    embedPooling_ = pooling;
+    LOGI("Embeddings context created (pooling %d, %d tokens per batch)", (int)llama_pooling_type(embedContext_), batchCapacity_);
+    return true;
+}
+
+void LlamaContextWrapper::freeEmbedContext() {
+    if (embedContext_ != nullptr) {
+        llama_free(embedContext_);
+        embedContext_ = nullptr;
+        LOGD("Embeddings context freed");
+    }
+}
+
+void LlamaContextWrapper::unloadDraftModel() {
+    if (draftBatch_.token != nullptr) {
+        llama_batch_free(draftBatch_);
+        draftBatch_ = {};
+    }
+    if (draftSampler_ != nullptr) {
+        llama_sampler_free(draftSampler_);
+        draftSampler_ = nullptr;
+    }
+    if (draftContext_ != nullptr) {
+        llama_free(draftContext_);
+        draftContext_ = nullptr;
+    }
+    if (draftModel_ != nullptr) {
+        draftModelRef_.reset();
+        draftModel_ = nullptr;
+        LOGD("Draft model released");
+    }
+    draftCachedTokens_.clear();
+}
+
+void LlamaContextWrapper::draftTokens(llama_token idLast, int nDraft, std::vector<llama_token>& drafts) {
+    llama_memory_t mem = llama_get_memory(draftContext_);
+    const llama_vocab* vocab = llama_model_get_vocab(draftModel_);
+    const int nBatch = (int)llama_n_batch(draftContext_);
+    
+    // Keep the part of the draft cache that still matches the target sequence
+    size_t nKeep = findLongestCommonPrefix(draftCachedTokens_, lastPromptTokens_);
+    if (nKeep < draftCachedTokens_.size()) {
+        if (!llama_memory_seq_rm(mem, 0, (llama_pos)nKeep, -1)) {
+            llama_memory_clear(mem, true);
+            nKeep = 0;
+        }
+        draftCachedTokens_.resize(nKeep);
+    }
     
-    // Get vocab from model
-    const llama_vocab * vocab = llama_model_get_vocab(model_);
+    bool ok = true;
+    draftBatch_.n_tokens = 0;
+    auto flush = [&]() {
+        if (ok && draftBatch_.n_tokens > 0) {
+            ok = llama_decode(draftContext_, draftBatch_) == 0;
+        }
+        draftBatch_.n_tokens = 0;
+    };
+    auto push = [&](llama_token token, bool logits) {
+        if (draftBatch_.n_tokens >= nBatch) {
+            flush();
+        }
+        const int i = draftBatch_.n_tokens++;
+        draftBatch_.token[i] = token;
+        draftBatch_.pos[i] = (llama_pos)draftCachedTokens_.size();
+        draftBatch_.n_seq_id[i] = 1;
+        draftBatch_.seq_id[i][0] = 0;
+        draftBatch_.logits[i] = logits;
+        draftCachedTokens_.push_back(token);
+    };
+    
+    // Catch up on tokens the draft model hasn't seen, then feed the last accepted token
+    const size_t start = draftCachedTokens_.size();
+    for (size_t i = start; i < lastPromptTokens_.size(); i++) {
+        push(lastPromptTokens_[i], false);
+    }
+    push(idLast, true);
+    flush();
     
-    for (llama_token token : tokens) {
-        // Get token text
-        char buf[256];
-        int n = llama_token_to_piece(vocab, token, buf, sizeof(buf) - 1, 0, true);
-        
-        if (n < 0) {
-            LOGW("Failed to detokenize token: %d", token);
-            continue;
+    // Greedy drafting
+    for (int i = 0; ok && i < nDraft; i++) {
+        llama_token token = llama_sampler_sample(draftSampler_, draftContext_, -1);
+        if (token < 0 || llama_vocab_is_eog(vocab, token)) {
+            break;
         }
-        
-        buf[n] = '\0';
-        result += buf;
+        drafts.push_back(token);
+        if (i + 1 == nDraft) {
+            break;
+        }
+        push(token, true);
+        flush();
     }
     
-    return result;
+    if (!ok) {
+        LOGW("Draft decode failed, resetting draft cache");
+        llama_memory_clear(mem, true);
+        draftCachedTokens_.clear();
+        drafts.clear();
+    }
 }
 
-// Rolling hash using Rabin-Karp algorithm for fast prefix matching
-// Time: O(n), much faster than token-by-token comparison for long sequences
-uint64_t LlamaContextWrapper::computeRollingHash(const std::vector<llama_token>& tokens, size_t start, size_t len) {
-    const uint64_t BASE = 31;
-    const uint64_t MOD = 1e9 + 7;
-    uint64_t hash = 0;
-    uint64_t power = 1;
+bool LlamaContextWrapper::shiftKvCache(llama_context* ctx, std::vector<llama_token>& cached, size_t nKeep, size_t nDiscard) {
+    llama_memory_t mem = llama_get_memory(ctx);
+    if (mem == nullptr || !llama_memory_can_shift(mem) || nKeep + nDiscard > cached.size()) {
+        return false;
+    }
     
-    const size_t end = std::min(start + len, tokens.size());
-    for (size_t i = start; i < end; i++) {
-        hash = (hash + (tokens[i] % MOD) * power) % MOD;
-        power = (power * BASE) % MOD;
+    if (!llama_memory_seq_rm(mem, 0, (llama_pos)nKeep, (llama_pos)(nKeep + nDiscard))) {
+        return false;
     }
-    return hash;
+    llama_memory_seq_add(mem, 0, (llama_pos)(nKeep + nDiscard), -1, -(llama_pos)nDiscard);
+    
+    cached.erase(cached.begin() + nKeep, cached.begin() + nKeep + nDiscard);
+    return true;
 }
 
-// Binary search + rolling hash for O(log n) prefix matching
-size_t LlamaContextWrapper::findLongestCommonPrefix(const std::vector<llama_token>& a, const std::vector<llama_token>& b) {
-    if (a.empty() || b.empty()) return 0;
-    
-    const size_t maxLen = std::min(a.size(), b.size());
-    
-    // Quick check: if first tokens differ, no common prefix
-    if (a[0] != b[0]) return 0;
+std::vector<llama_token> LlamaContextWrapper::truncateKeepingHead(const std::vector<llama_token>& tokens, int maxTokens, int nKeep) {
+    if ((int)tokens.size() <= maxTokens) {
+        return tokens;
+    }
+    nKeep = std::max(0, std::min(nKeep, maxTokens / 2));
     
-    // Binary search for longest common prefix
-    // This gives O(log n * n) worst case, but with hash comparison it's typically O(log n)
-    size_t lo = 1, hi = maxLen;
-    size_t result = 0;
+    std::vector<llama_token> result(tokens.begin(), tokens.begin() + nKeep);
+    result.insert(result.end(), tokens.end() - (maxTokens - nKeep), tokens.end());
+    return result;
+}
+
+size_t LlamaContextWrapper::prepareKvCache(const std::vector<llama_token>& promptTokens, bool allowReuse, int shiftKeep) {
+    llama_memory_t mem = llama_get_memory(context_);
+    if (mem == nullptr) {
+        lastPromptTokens_.clear();
+        return 0;
+    }
     
-    while (lo <= hi) {
-        size_t mid = lo + (hi - lo) / 2;
-        
-        // Check if prefix of length 'mid' matches using rolling hash
-        uint64_t hashA = computeRollingHash(a, 0, mid);
-        uint64_t hashB = computeRollingHash(b, 0, mid);
-        
-        if (hashA == hashB) {
-            // Verify match (hash collision check) - sample check for speed
-            bool match = true;
-            // Check every 64th token for verification (fast probabilistic check)
-            for (size_t i = 0; i < mid && match; i += std::max(1UL, mid / 16)) {
-                if (a[i] != b[i]) match = false;
+    size_t n_reuse = 0;
+    if (allowReuse && !lastPromptTokens_.empty()) {
+        // The cache must hold exactly the tokens we think it does, otherwise don't trust it
+        const llama_pos pos_max = llama_memory_seq_pos_max(mem, 0);
+        if (pos_max + 1 == (llama_pos)lastPromptTokens_.size()) {
+            n_reuse = findLongestCommonPrefix(lastPromptTokens_, promptTokens);
+            
+            // With context shifting, a head + tail truncated prompt usually continues at a later
+            // point of the cache: drop the skipped block and shift the rest down instead of re-prefilling
+            if (shiftKeep >= 0 && n_reuse >= (size_t)shiftKeep &&
+                n_reuse < lastPromptTokens_.size() && n_reuse < promptTokens.size()) {
+                n_reuse += reuseShifted(n_reuse, promptTokens);
             }
-            if (match) {
-                result = mid;
-                lo = mid + 1;
-            } else {
-                hi = mid - 1;
+            
+            // Always decode at least the last prompt token to get fresh logits
+            if (n_reuse >= promptTokens.size()) {
+                n_reuse = promptTokens.size() - 1;
+            }
+            
+            // Drop the diverging tail [n_reuse, end) from sequence 0
+            if (n_reuse > 0 && !llama_memory_seq_rm(mem, 0, (llama_pos)n_reuse, -1)) {
+                LOGW("KV cache could not be trimmed at %zu, falling back to full clear", n_reuse);
+                n_reuse = 0;
             }
         } else {
-            hi = mid - 1;
+            LOGW("KV cache out of sync (pos_max=%d, tracked=%zu), falling back to full clear",
+                 pos_max, lastPromptTokens_.size());
         }
     }
     
-    return result;
+    if (n_reuse == 0) {
+        llama_memory_clear(mem, true);
+        LOGD("Memory cleared for new generation");
+    } else {
+        LOGI("KV cache reuse: %zu/%zu prompt tokens already cached", n_reuse, promptTokens.size());
+    }
+    
+    lastPromptTokens_.resize(n_reuse);
+    return n_reuse;
+}
+
+size_t LlamaContextWrapper::reuseShifted(size_t nKeep, const std::vector<llama_token>& promptTokens) {
+    // Minimum run of matching tokens worth a shift over a plain prefill
+    constexpr size_t kMinShiftReuse = 16;
+    
+    const size_t nCached = lastPromptTokens_.size();
+    const size_t nPrompt = promptTokens.size();
+    
+    size_t bestOffset = 0;
+    size_t bestLen = 0;
+    for (size_t d = 1; nKeep + d < nCached; d++) {
+        if (lastPromptTokens_[nKeep + d] != promptTokens[nKeep]) {
+            continue;
+        }
+        const size_t maxLen = std::min(nCached - nKeep - d, nPrompt - nKeep);
+        auto mm = std::mismatch(lastPromptTokens_.begin() + nKeep + d, lastPromptTokens_.begin() + nKeep + d + maxLen,
+                                promptTokens.begin() + nKeep);
+        const size_t len = (size_t)(mm.first - (lastPromptTokens_.begin() + nKeep + d));
+        if (len > bestLen) {
+            bestLen = len;
+            bestOffset = d;
+            if (len == maxLen) break;  // Matches up to the end of the cache or prompt
+        }
+    }
+    
+    if (bestLen < kMinShiftReuse ||
+        !shiftKvCache(context_, lastPromptTokens_, nKeep, bestOffset)) {
+        return 0;
+    }
+    
+    LOGI("Context shift reuse: dropped %zu cached tokens after the first %zu, reusing %zu more",
+         bestOffset, nKeep, bestLen);
+    return bestLen;
 }
 
 // Smart truncation using sliding window and importance scoring
@@ -561,15 +2272,13 @@ std::vector<llama_token> LlamaContextWrapper::smartTruncate(const std::vector<ll
     
     // Find good truncation point - look for conversation boundaries
     // Search for assistant/user turn markers in the middle region
-    const size_t searchStart = tokens.size() - keepEnd - 128;  // Search window
+    const size_t searchStart = tokens.size() - keepEnd - std::min<size_t>(128, tokens.size() - keepEnd - keepStart);  // Search window
     const size_t searchEnd = tokens.size() - keepEnd;
     size_t bestCutPoint = tokens.size() - keepEnd;
     
-    // Look for newlines or special markers as good cut points
-    for (size_t i = searchStart; i < searchEnd && i < tokens.size(); i++) {
-        // Check if this is a good boundary (newline tokens often have value < 50)
-        // This is a heuristic - actual implementation would check token content
-        if (tokens[i] < 50 || (i > 0 && tokens[i-1] < 50)) {
+    // Cut right after the first newline (or control token) in the window
+    for (size_t i = std::max(searchStart, (size_t)1); i < searchEnd && i < tokens.size(); i++) {
+        if (llama_vocab_is_control(vocab, tokens[i - 1]) || detokenize({tokens[i - 1]}).find('\n') != std::string::npos) {
             bestCutPoint = i;
             break;
         }
@@ -587,21 +2296,150 @@ std::vector<llama_token> LlamaContextWrapper::smartTruncate(const std::vector<ll
     return result;
 }
 
-void LlamaContextWrapper::setupSampler(const LlamaConfig& config) {
-    // Free existing sampler
-    if (sampler_ != nullptr) {
-        llama_sampler_free(sampler_);
+void LlamaContextWrapper::computeChatSegments(const char* tmpl, const std::vector<llama_chat_message>& messages,
+                                              const std::string& formatted) {
+    // A boundary only depends on the messages before it. The previous chat's last segment ends
+    // at its generation prompt rather than a boundary, so it is computed again.
+    size_t keep = 0;
+    while (keep + 1 < chatSegments_.size() && keep + 1 < messages.size() &&
+           chatSegments_[keep].role == messages[keep].role && chatSegments_[keep].content == messages[keep].content) {
+        keep++;
+    }
+    if (keep > 0) {
+        const size_t keptEnd = chatSegments_[keep - 1].end;
+        if (keptEnd > formatted.size() || formatted.compare(0, keptEnd, chatPrompt_, 0, keptEnd) != 0) {
+            keep = 0;
+        }
+    }
+    if (keep == 0) {
+        chatTurnCut_ = 0;   // A different chat, the previous cut doesn't apply
+    }
+    chatSegments_.resize(keep);
+    chatPrompt_ = formatted;
+    
+    // Each message prefix must format to a prefix of the full chat
+    std::vector<char> buf(formatted.size() + 1);
+    size_t begin = keep > 0 ? chatSegments_.back().end : 0;
+    for (size_t i = keep; i < messages.size(); i++) {
+        size_t end = formatted.size();
+        if (i + 1 < messages.size()) {
+            int n = llama_chat_apply_template(tmpl, messages.data(), i + 1, false, buf.data(), (int32_t)buf.size());
+            if (n < (int)begin || n > (int)formatted.size() || formatted.compare(0, n, buf.data(), n) != 0) {
+                LOGD("Chat template is not prefix-stable, turn-aware truncation disabled");
+                chatSegments_.clear();
+                return;
+            }
+            end = (size_t)n;
+        }
+        chatSegments_.push_back({messages[i].role, messages[i].content, begin, end});
+        begin = end;
+    }
+}
+
+std::vector<llama_token> LlamaContextWrapper::tokenizeTurns(const std::string& prompt,
+                                                            std::vector<std::vector<llama_token>>& turns) {
+    turns.clear();
+    std::vector<llama_token> tokens;
+    if (llama_vocab_get_add_bos(llama_model_get_vocab(model_))) {
+        tokens.push_back(llama_vocab_bos(llama_model_get_vocab(model_)));
+    }
+    
+    for (const ChatSegment& segment : chatSegments_) {
+        turns.push_back(tokenize(prompt.substr(segment.begin, segment.end - segment.begin), false));
+        tokens.insert(tokens.end(), turns.back().begin(), turns.back().end());
+    }
+    return tokens;
+}
+
+std::vector<llama_token> LlamaContextWrapper::truncateTurns(const std::vector<std::vector<llama_token>>& turns,
+                                                            bool firstIsSystem, int maxTokens, size_t& turnCut) {
+    const size_t nTurns = turns.size();
+    const bool keepSystem = nTurns > 1 && firstIsSystem;
+    const size_t firstDroppable = keepSystem ? 1 : 0;
+    const bool addBos = llama_vocab_get_add_bos(llama_model_get_vocab(model_));
+    
+    size_t fixed = (addBos ? 1 : 0) + (keepSystem ? turns[0].size() : 0);
+    
+    // Tokens from turn i to the end
+    std::vector<size_t> suffix(nTurns + 1, 0);
+    for (size_t i = nTurns; i-- > 0;) {
+        suffix[i] = suffix[i + 1] + turns[i].size();
+    }
+    
+    if (fixed + turns[nTurns - 1].size() > (size_t)maxTokens) {
+        return {};  // System prompt + latest message alone don't fit
+    }
+    
+    // Keep the previous cut while it still fits. When it doesn't, cut down to 3/4 of the limit
+    // so the next few turns fit without moving the cut (and invalidating the cached prefix) again.
+    size_t cut = std::max(firstDroppable, std::min(turnCut, nTurns - 1));
+    if (fixed + suffix[cut] > (size_t)maxTokens) {
+        const size_t target = (size_t)maxTokens * 3 / 4;
+        while (cut < nTurns - 1 && fixed + suffix[cut] > target) {
+            cut++;
+        }
+    }
+    turnCut = cut;
+    
+    std::vector<llama_token> result;
+    result.reserve(fixed + suffix[cut]);
+    if (addBos) {
+        result.push_back(llama_vocab_bos(llama_model_get_vocab(model_)));
+    }
+    if (keepSystem) {
+        result.insert(result.end(), turns[0].begin(), turns[0].end());
+    }
+    for (size_t i = cut; i < nTurns; i++) {
+        result.insert(result.end(), turns[i].begin(), turns[i].end());
+    }
+    
+    LOGI("Turn-aware truncation: dropped %zu of %zu messages%s",
+         cut - firstDroppable, nTurns, keepSystem ? " (system message kept)" : "");
+    return result;
+}
+
+bool LlamaContextWrapper::setupSampler(const LlamaConfig& config) {
+    sampler_ = cachedSampler(config);
+    return sampler_ != nullptr;
+}
+
+llama_sampler* LlamaContextWrapper::cachedSampler(const LlamaConfig& config) {
+    std::string key = samplerKey(config);
+    auto it = samplerCache_.find(key);
+    if (it != samplerCache_.end()) {
+        return it->second;
+    }
+    
+    llama_sampler* sampler = createSamplerChain(config);
+    if (sampler == nullptr) {
+        return nullptr;
     }
     
+    // Full: drop everything except the chain the single-sequence path currently holds
+    if (samplerCache_.size() >= kMaxCachedSamplers) {
+        for (auto entry = samplerCache_.begin(); entry != samplerCache_.end();) {
+            if (entry->second == sampler_) {
+                ++entry;
+            } else {
+                llama_sampler_free(entry->second);
+                entry = samplerCache_.erase(entry);
+            }
+        }
+    }
+    samplerCache_.emplace(std::move(key), sampler);
+    return sampler;
+}
+
+llama_sampler* LlamaContextWrapper::createSamplerChain(const LlamaConfig& config) {
     // Create sampler chain
     llama_sampler_chain_params chainParams = llama_sampler_chain_default_params();
-    sampler_ = llama_sampler_chain_init(chainParams);
+    llama_sampler* sampler = llama_sampler_chain_init(chainParams);
     
     // Add samplers in order
     
     // Repetition penalty (new signature: 4 args)
     if (config.repeatPenalty != 1.0f) {
-        llama_sampler_chain_add(sampler_, 
+        llama_sampler_chain_add(sampler, 
             llama_sampler_init_penalties(
                 64,                       // penalty_last_n
                 config.repeatPenalty,    // penalty_repeat
@@ -611,29 +2449,257 @@ void LlamaContextWrapper::setupSampler(const LlamaConfig& config) {
         );
     }
     
+    if (config.temperature <= 0.0f) {
+        // Greedy: a single argmax pass - top-k / top-p can't change the most likely token,
+        // and skipping them avoids sorting the vocabulary every token
+        llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+        LOGI("Sampler configured: greedy, repeat_penalty=%.2f", config.repeatPenalty);
+        return withGrammar(sampler, config);
+    }
+    
     // Top-K sampling
     if (config.topK > 0) {
-        llama_sampler_chain_add(sampler_, llama_sampler_init_top_k(config.topK));
+        llama_sampler_chain_add(sampler, llama_sampler_init_top_k(config.topK));
     }
     
     // Top-P (nucleus) sampling
     if (config.topP < 1.0f) {
-        llama_sampler_chain_add(sampler_, llama_sampler_init_top_p(config.topP, 1));
+        llama_sampler_chain_add(sampler, llama_sampler_init_top_p(config.topP, 1));
     }
     
     // Temperature
-    if (config.temperature > 0.0f) {
-        llama_sampler_chain_add(sampler_, llama_sampler_init_temp(config.temperature));
-    }
+    llama_sampler_chain_add(sampler, llama_sampler_init_temp(config.temperature));
     
-    // Distribution sampling with seed
-    uint32_t seed = config.seed >= 0 ? config.seed : static_cast<uint32_t>(std::time(nullptr));
-    llama_sampler_chain_add(sampler_, llama_sampler_init_dist(seed));
+    // Distribution sampling. LLAMA_DEFAULT_SEED draws a fresh random seed on every reset,
+    // so requests started in the same second (or in parallel) still differ
+    uint32_t seed = config.seed >= 0 ? (uint32_t)config.seed : LLAMA_DEFAULT_SEED;
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(seed));
     
     LOGI("Sampler configured: temp=%.2f, top_p=%.2f, top_k=%d, repeat_penalty=%.2f",
          config.temperature, config.topP, config.topK, config.repeatPenalty);
+    
+    return withGrammar(sampler, config);
+}
+
+llama_sampler* LlamaContextWrapper::withGrammar(llama_sampler* sampler, const LlamaConfig& config) {
+    GrammarSpec spec{config.grammar, config.jsonSchema, config.grammarTriggers};
+    if (spec.empty()) {
+        return sampler;
+    }
+    
+    std::string error;
+    llama_sampler* grammar = createGrammarSampler(llama_model_get_vocab(model_), spec, error);
+    if (grammar == nullptr) {
+        setError(error);
+        llama_sampler_free(sampler);
+        return nullptr;
+    }
+    return makeConstrainedSampler(sampler, grammar);
+}
+
+int LlamaContextWrapper::tokenizeText(const char* text, size_t length, bool addSpecial, std::vector<int32_t>& tokens) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    if (model_ == nullptr) {
+        setError("Model not loaded");
+        return -1;
+    }
+    if (!tokenizeInto(text, length, addSpecial, tokens)) {
+        setError("Failed to tokenize text");
+        return -1;
+    }
+    return (int)tokens.size();
+#else
+    // Stub: one token per byte
+    tokens.assign(text, text + length);
+    return (int)tokens.size();
+#endif
+}
+
+int LlamaContextWrapper::countTokens(const char* text, size_t length, bool addSpecial) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    if (model_ == nullptr) {
+        setError("Model not loaded");
+        return -1;
+    }
+    // With no room for output llama_tokenize returns minus the token count
+    const int n = llama_tokenize(llama_model_get_vocab(model_), text, (int32_t)length, nullptr, 0, addSpecial, true);
+    if (n == INT32_MIN) {
+        setError("Text too long to tokenize");
+        return -1;
+    }
+    return n < 0 ? -n : n;
+#else
+    return (int)length;
+#endif
+}
+
+int LlamaContextWrapper::createConversation() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    if (model_ == nullptr) {
+        setError("Model not loaded");
+        return 0;
+    }
+    const int id = nextConversationId_++;
+    conversations_[id] = std::make_unique<Conversation>(modelRef_);
+    return id;
+#else
+    return nextConversationId_++;
+#endif
+}
+
+void LlamaContextWrapper::freeConversation(int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+#if LLAMA_AVAILABLE
+    conversations_.erase(id);
+#else
+#endif
+}
+
+int LlamaContextWrapper::appendMessage(int id, const std::string& role, const std::string& content) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    Conversation* conversation = findConversation(id);
+    if (conversation == nullptr) {
+        setError("Invalid conversation");
+        return -1;
+    }
+    std::string error;
+    const int added = conversation->append(role, content, error);
+    if (added < 0) {
+        setError(error);
+    }
+    return added;
+#else
+    return (int)content.size();
+#endif
+}
+
+int LlamaContextWrapper::getConversationTokenCount(int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+#if LLAMA_AVAILABLE
+    Conversation* conversation = findConversation(id);
+    return conversation != nullptr ? (int)conversation->tokenCount() : -1;
+#else
+    return 0;
+#endif
+}
+
+int LlamaContextWrapper::loadLoraAdapter(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    if (model_ == nullptr) {
+        setError("Model not loaded");
+        return 0;
+    }
+    llama_adapter_lora* adapter = llama_adapter_lora_init(model_, path.c_str());
+    if (adapter == nullptr) {
+        setError("Failed to load LoRA adapter: " + path);
+        return 0;
+    }
+    const int id = nextLoraId_++;
+    loraAdapters_[id] = adapter;
+    LOGI("LoRA adapter %d loaded: %s", id, path.c_str());
+    return id;
+#else
+    setError("LoRA adapters require llama.cpp");
+    return 0;
+#endif
+}
+
+bool LlamaContextWrapper::setLoraAdapter(int id, float scale) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    clearError();
+    
+#if LLAMA_AVAILABLE
+    if (context_ == nullptr) {
+        setError("Model not loaded");
+        return false;
+    }
+    auto adapter = loraAdapters_.find(id);
+    if (adapter == loraAdapters_.end()) {
+        setError("Invalid LoRA adapter");
+        return false;
+    }
+    if (scheduler_) {
+        // The scheduler's worker decodes on context_ at any time
+        setError("LoRA adapters are not supported with parallelSequences > 1");
+        return false;
+    }
+    
+    auto active = loraScales_.find(id);
+    if (scale == 0.0f) {
+        if (active == loraScales_.end()) {
+            return true;
+        }
+        llama_rm_adapter_lora(context_, adapter->second);
+        loraScales_.erase(active);
+    } else {
+        if (active != loraScales_.end() && active->second == scale) {
+            return true;
+        }
+        if (llama_set_adapter_lora(context_, adapter->second, scale) != 0) {
+            setError("Failed to apply LoRA adapter");
+            return false;
+        }
+        loraScales_[id] = scale;
+    }
+    
+    invalidateKvCache();
+    LOGI("LoRA adapter %d scale %.2f, %zu active", id, scale, loraScales_.size());
+    return true;
+#else
+    setError("LoRA adapters require llama.cpp");
+    return false;
+#endif
+}
+
+void LlamaContextWrapper::clearLoraAdapters() {
+    std::lock_guard<std::mutex> lock(mutex_);
+#if LLAMA_AVAILABLE
+    if (context_ != nullptr && !loraScales_.empty()) {
+        llama_clear_adapter_lora(context_);
+        loraScales_.clear();
+        invalidateKvCache();
+    }
+#endif
+}
+
+void LlamaContextWrapper::unloadLoraAdapter(int id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+#if LLAMA_AVAILABLE
+    auto adapter = loraAdapters_.find(id);
+    if (adapter == loraAdapters_.end()) {
+        return;
+    }
+    if (loraScales_.erase(id) > 0) {
+        llama_rm_adapter_lora(context_, adapter->second);
+        invalidateKvCache();
+    }
+    llama_adapter_lora_free(adapter->second);
+    loraAdapters_.erase(adapter);
+#endif
 }
 
+#if LLAMA_AVAILABLE
+Conversation* LlamaContextWrapper::findConversation(int id) {
+    auto it = conversations_.find(id);
+    return it != conversations_.end() && it->second->model() == model_ ? it->second.get() : nullptr;
+}
+#endif
+
 std::string LlamaContextWrapper::getChatTemplate() {
     std::lock_guard<std::mutex> lock(mutex_);
     
@@ -793,7 +2859,9 @@ std::string LlamaContextWrapper::applyChatTemplate(const std::string& messagesJs
         return "";
     }
     
-    return std::string(buf.data(), result);
+    std::string formatted(buf.data(), result);
+    computeChatSegments(tmpl, messages, formatted);
+    return formatted;
     
 #else
     // Stub implementation
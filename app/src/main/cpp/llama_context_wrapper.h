@@ -4,12 +4,22 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <cstdint>
 #include <functional>
 #include <mutex>
 #include <atomic>
+#include <unordered_map>
+
+#include "backend_loader.h"
+#include "conversation.h"
+#include "grammar_sampler.h"
+#include "model_registry.h"
+#include "utf8_stream.h"
 
 #if LLAMA_AVAILABLE
 #include "llama.h"
+#include "ggml-cpu.h"
+#include "sequence_scheduler.h"
 #endif
 
 namespace llamaandroid {
@@ -22,7 +32,10 @@ struct LlamaConfig {
     int contextSize = 2048;
     int batchSize = 512;
     
-    // Threading
+    // Concurrent requests decoded together (continuous batching), 1 = single stream
+    int parallelSequences = 1;
+    
+    // Threading (0 = auto: decode on performance cores, prefill on all cores, pinned via threadpools)
     int threads = 4;
     int threadsBatch = 4;
     
@@ -32,18 +45,101 @@ struct LlamaConfig {
     int topK = 40;
     float repeatPenalty = 1.1f;
     
+    // Constrained output: GBNF grammar or JSON schema (at most one), lazily applied from the
+    // first trigger on when grammarTriggers is not empty
+    std::string grammar;
+    std::string jsonSchema;
+    std::vector<std::string> grammarTriggers;
+    
     // Generation limits
     int maxTokens = 512;
     
+    // KV cache reuse - keep the shared prefix with the previous request and only prefill the new suffix
+    bool cacheReuse = true;
+    
+    // Context shifting - when the window is full, drop the oldest tokens after the first keepTokens
+    // and shift the rest in place instead of re-prefilling a truncated prompt
+    bool contextShift = false;
+    int keepTokens = 4;             // "Sink" tokens never discarded (e.g. the system prompt length)
+    
+    // KV cache element types: "f16", "q8_0" or "q4_0" - quantized caches fit a longer context in RAM
+    std::string cacheTypeK = "f16";
+    std::string cacheTypeV = "f16";  // Quantized V cache requires flashAttention
+    
+    // Flash attention - fused attention kernel, avoids materializing the full attention matrix
+    bool flashAttention = false;
+    
     // Memory options
     bool useMmap = true;
     bool useMlock = false;
     
+    // Dummy decode at the end of loadModel() to fault in weights and build kernels before the first prompt
+    bool warmup = false;
+    
     // GPU layers (0 = CPU only)
     int gpuLayers = 0;
     
+    // Device to offload to, e.g. "Vulkan0" (empty = every GPU device llama.cpp finds)
+    std::string gpuDevice;
+    
     // Seed for reproducibility (-1 = random)
     int seed = -1;
+    
+    // Speculative decoding - optional small draft model from the same family (empty = disabled)
+    std::string draftModelPath;
+    int draftTokens = 4;            // Tokens drafted per verification step
+};
+
+/**
+ * Results of LlamaContextWrapper::benchmark()
+ */
+struct BenchmarkResult {
+    struct Prefill {
+        int batchSize;
+        double tokensPerSecond;
+    };
+    struct Decode {
+        int threads;
+        double tokensPerSecond;
+        double p50Ms;       // Median per-token latency
+        double p99Ms;       // 99th percentile per-token latency
+    };
+    
+    std::vector<Prefill> prefill;
+    std::vector<Decode> decode;
+    double ttftMs = 0.0;    // Prefill of the full prompt + first sampled token
+    long peakRssKb = 0;     // VmHWM of the process after the run
+};
+
+/**
+ * Memory a model would need with a configuration, see LlamaContextWrapper::planLoad()
+ */
+struct LoadPlan {
+    size_t weightBytes = 0;     // All tensors; mmapped, but every one is read for each token
+    size_t kvCacheBytes = 0;    // For contextSize and the cache types
+    size_t computeBytes = 0;    // Worst-case compute buffer of one micro-batch
+    size_t availableBytes = 0;  // MemAvailable right now, 0 if unknown
+    int layerCount = 0;
+    int contextLength = 0;      // Context length the model was trained with
+    int gpuLayers = 0;          // Layers (weights + KV cache) that fit the GPU device's free memory
+};
+
+/**
+ * Timings and counters of the last generateStream() call
+ */
+struct GenerationStats {
+    double tokenizeMs = 0.0;
+    double prefillMs = 0.0;             // Decoding the non-reused part of the prompt
+    double timeToFirstTokenMs = 0.0;    // Request start until the first token is sampled
+    double decodeMs = 0.0;              // First sampled token until generation stops
+    double tokensPerSecond = 0.0;       // Generated tokens / decodeMs
+    int promptTokens = 0;               // After truncation
+    int reusedTokens = 0;               // Prompt tokens served from the KV cache
+    int generatedTokens = 0;
+    bool truncated = false;
+    int batchCapacity = 0;              // Batch size actually allocated (after low-memory retries)
+    int draftedTokens = 0;
+    int acceptedTokens = 0;
 };
 
 /**
@@ -51,6 +147,16 @@ struct LlamaConfig {
  */
 using TokenCallback = std::function<void(const std::string& token)>;
 
+/**
+ * Model load progress callback, 0..1 (the last part is the warm-up when LlamaConfig::warmup is set)
+ */
+using LoadProgressCallback = std::function<void(float progress)>;
+
+/**
+ * Prefill progress callback: prompt tokens in the KV cache so far, out of the total
+ */
+using ProgressCallback = std::function<void(int processed, int total)>;
+
 /**
  * Wrapper class for llama.cpp context management
  */
@@ -71,15 +177,34 @@ public:
      * Load a GGUF model from the specified path
      * @param modelPath Path to the .gguf model file
      * @param config Configuration for model loading
+     * @param progress Called on the loading thread as weights are read and warm-up runs (optional)
      * @return true if successful, false otherwise
      */
-    bool loadModel(const std::string& modelPath, const LlamaConfig& config);
+    bool loadModel(const std::string& modelPath, const LlamaConfig& config, LoadProgressCallback progress = nullptr);
+    
+    /**
+     * Load a GGUF model from an open file descriptor, e.g. from a content provider or
+     * a downloaded blob, mapping it without copying. The fd can be closed afterwards.
+     * @param offset Start of the model in the file; llama.cpp maps models from the
+     *               start of a file, so only 0 is supported
+     * @return true if successful, false otherwise
+     */
+    bool loadModelFromFd(int fd, int64_t offset, const LlamaConfig& config, LoadProgressCallback progress = nullptr);
     
     /**
      * Unload the current model and free resources
      */
     void unloadModel();
     
+    /**
+     * Estimate the memory loadModel() would need for a model file and config, reading only the
+     * GGUF header and tensor table. Lets the app pick a model, quantization and context size
+     * that fit before committing memory. Uses the same estimates loadModel() sizes buffers with.
+     * @param error Set on failure
+     * @return false if the file is not a readable GGUF model or a cache type is invalid
+     */
+    static bool planLoad(const std::string& modelPath, const LlamaConfig& config, LoadPlan& plan, std::string& error);
+    
     /**
      * Check if a model is currently loaded
      */
@@ -89,20 +214,110 @@ public:
      * Generate a complete response for the given prompt
      * @param prompt Input text prompt
      * @param config Sampling configuration (optional, uses default if not provided)
+     * @param error Receives the error message, empty on success (optional)
      * @return Generated text response
      */
-    std::string generate(const std::string& prompt, const LlamaConfig* config = nullptr);
+    std::string generate(const std::string& prompt, const LlamaConfig* config = nullptr, std::string* error = nullptr);
     
     /**
-     * Generate a streaming response, calling the callback for each token
+     * Generate a streaming response, calling the callback for each token.
+     * With parallelSequences > 1 the error is only returned, getLastError() is shared by
+     * the concurrent requests and isn't updated.
      * @param prompt Input text prompt
      * @param callback Function to call for each generated token
      * @param config Sampling configuration (optional)
+     * @param progress Called after each prefill chunk (optional, single sequence only)
+     * @return Error message of this request, empty on success
+     */
+    std::string generateStream(const std::string& prompt, TokenCallback callback, const LlamaConfig* config = nullptr,
+                               ProgressCallback progress = nullptr);
+    
+    /**
+     * Generate a streaming response from already tokenized input (see tokenizeText()).
+     * The tokens are used as-is, no BOS is added.
+     * @return Error message of this request, empty on success
+     */
+    std::string generateStream(const std::vector<int32_t>& promptTokens, TokenCallback callback,
+                               const LlamaConfig* config = nullptr, ProgressCallback progress = nullptr);
+    
+    /**
+     * Tokenize text with the model's vocabulary in a single pass.
+     * tokens only grows, so a buffer reused across calls stops allocating.
+     * @param addSpecial Add BOS (and EOS where the model expects it)
+     * @return Number of tokens, -1 on failure (see getLastError())
+     */
+    int tokenizeText(const char* text, size_t length, bool addSpecial, std::vector<int32_t>& tokens);
+    
+    /**
+     * Count the tokens of text without keeping them
+     * @return Number of tokens, -1 on failure (see getLastError())
+     */
+    int countTokens(const char* text, size_t length, bool addSpecial);
+    
+    /**
+     * Create a native multi-turn chat history for the loaded model (see Conversation).
+     * Freed by freeConversation() or with the model.
+     * @return Conversation id (> 0), 0 on failure
+     */
+    int createConversation();
+    
+    /**
+     * Free a conversation created by createConversation()
+     */
+    void freeConversation(int id);
+    
+    /**
+     * Append a message to a conversation. Only the new message is formatted and tokenized.
+     * @param role Message role ("system", "user", "assistant", ...)
+     * @return Number of tokens the message added, -1 on failure (see getLastError())
+     */
+    int appendMessage(int id, const std::string& role, const std::string& content);
+    
+    /**
+     * Generate the assistant's reply to a conversation and append it to the history.
+     * The prompt is built from the history's tokens, and the reply is recorded from the
+     * sampled tokens, so the next turn reuses the KV cache up to the end of this reply.
+     * Old turns are dropped (system message kept) when the history outgrows the context.
+     * @return Error message of this request, empty on success
+     */
+    std::string generateConversation(int id, TokenCallback callback, const LlamaConfig* config = nullptr,
+                                     ProgressCallback progress = nullptr);
+    
+    /**
+     * Tokens in a conversation's history, -1 if the id is unknown
+     */
+    int getConversationTokenCount(int id);
+    
+    /**
+     * Load a LoRA adapter (GGUF) trained for the loaded model. Only the adapter weights are
+     * read; the base weights stay shared. The adapter has no effect until setLoraAdapter().
+     * Freed by unloadLoraAdapter() or with the model.
+     * @return Adapter id (> 0), 0 on failure (see getLastError())
+     */
+    int loadLoraAdapter(const std::string& path);
+    
+    /**
+     * Apply a loaded adapter to the following generations, or remove it with scale 0.
+     * Several adapters can be active at once. Any change drops the reusable KV cache, whose
+     * entries were computed with the previous adapters. Not supported with parallelSequences > 1.
+     * @param scale Adapter strength, 1 = as trained
+     * @return true if successful
+     */
+    bool setLoraAdapter(int id, float scale);
+    
+    /**
+     * Remove every active adapter, back to the base model
+     */
+    void clearLoraAdapters();
+    
+    /**
+     * Remove an adapter if active and free it
      */
-    void generateStream(const std::string& prompt, TokenCallback callback, const LlamaConfig* config = nullptr);
+    void unloadLoraAdapter(int id);
     
     /**
      * Cancel ongoing generation
+     * With parallelSequences > 1 this cancels every in-flight request
      */
     void cancelGeneration();
     
@@ -111,6 +326,57 @@ public:
      */
     bool isGenerating() const;
     
+    /**
+     * Run a synthetic prefill/decode benchmark on the loaded model.
+     * Prefill is measured at several batch sizes, decode at several thread counts
+     * (with automatic threads, only up to the size of the pinned decode pool).
+     * Uses random tokens and bypasses sampling/detokenization, so only llama_decode is timed.
+     * Clears the KV cache.
+     * @param promptTokens Number of prompt tokens for prefill and TTFT
+     * @param genTokens Number of tokens decoded per decode run
+     * @param reps Repetitions per measurement
+     * @return Benchmark results (empty on failure, see getLastError())
+     */
+    BenchmarkResult benchmark(int promptTokens, int genTokens, int reps);
+    
+    /**
+     * Compute one pooled embedding per text.
+     * Texts are packed into shared batches as separate sequences, decoded on a dedicated
+     * embeddings context that is created on first use. Texts longer than the batch are truncated.
+     * @param texts Input texts
+     * @param pooling llama_pooling_type (-1 = the model's default)
+     * @param normalize L2-normalize each vector
+     * @param out Receives texts.size() vectors back to back
+     * @return Embedding dimension, 0 on failure (see getLastError())
+     */
+    int embed(const std::vector<std::string>& texts, int pooling, bool normalize, std::vector<float>& out);
+    
+    /**
+     * Estimate the KV cache memory of the loaded model for config's contextSize and cache types.
+     * Lets the app pick the largest context that fits before reloading with it.
+     * @return Bytes, or 0 if no model is loaded or a cache type is invalid
+     */
+    size_t estimateKvCacheBytes(const LlamaConfig& config) const;
+    
+    /**
+     * React to ComponentCallbacks2.onTrimMemory.
+     * At critical levels the reusable KV cache contents and the draft model are dropped
+     * (deferred until an active generation ends).
+     * @param level onTrimMemory level
+     */
+    void trimMemory(int level);
+    
+    /**
+     * Fraction of drafted tokens accepted by the target model during the last generation
+     * @return Acceptance rate in [0, 1], or -1 if speculative decoding was not used
+     */
+    float getDraftAcceptanceRate() const;
+    
+    /**
+     * Timings and counters of the most recently finished generation
+     */
+    GenerationStats getLastGenerationStats() const;
+    
     /**
      * Get the last error message
      */
@@ -121,6 +387,11 @@ public:
      */
     static std::string getVersion();
     
+    /**
+     * Compute devices of the registered ggml backends (CPU, Vulkan, OpenCL, ...)
+     */
+    static std::vector<BackendDevice> getBackendDevices();
+    
     /**
      * Apply chat template to format messages
      * Uses llama.cpp's llama_chat_apply_template with model's embedded template
@@ -130,6 +401,45 @@ public:
      */
     std::string applyChatTemplate(const std::string& messagesJson, bool addGenerationPrompt);
     
+    /**
+     * Save the KV cache state of the current conversation to a file.
+     * The file also stores the cached token list, so a later restoreState()
+     * followed by a prompt with the same prefix skips its prefill.
+     * Written through llama.cpp's streaming file writer (no second copy of the state in RAM).
+     * @param path Destination file path
+     * @return true if successful
+     */
+    bool saveState(const std::string& path);
+    
+    /**
+     * Restore a KV cache state previously written by saveState().
+     * Must be used with the same model and a context at least as large.
+     * @param path Source file path
+     * @return true if successful
+     */
+    bool restoreState(const std::string& path);
+    
+    /**
+     * Size in bytes needed by saveStateToBuffer() for the current state
+     */
+    size_t getStateSize();
+    
+    /**
+     * Save the KV cache state and cached tokens into a caller-provided buffer
+     * @param dst Destination buffer
+     * @param capacity Size of the destination buffer
+     * @return Number of bytes written, 0 on failure
+     */
+    size_t saveStateToBuffer(uint8_t* dst, size_t capacity);
+    
+    /**
+     * Restore a state written by saveStateToBuffer()
+     * @param src Source buffer
+     * @param size Number of valid bytes in the buffer
+     * @return true if successful
+     */
+    bool restoreStateFromBuffer(const uint8_t* src, size_t size);
+    
     /**
      * Get the chat template embedded in the model
      * @return Chat template string or empty if not available
@@ -138,19 +448,83 @@ public:
     
 private:
 #if LLAMA_AVAILABLE
+    // model_ is borrowed from modelRef_, which may be shared with other wrappers via ModelRegistry
+    std::shared_ptr<llama_model> modelRef_;
     llama_model* model_ = nullptr;
     llama_context* context_ = nullptr;
-    llama_sampler* sampler_ = nullptr;
+    llama_sampler* sampler_ = nullptr;     // Borrowed from samplerCache_
     
-    // KV cache optimization - store last prompt tokens + rolling hash
+    // Sampler chains by sampling parameters; a request only resets the matching chain
+    std::unordered_map<std::string, llama_sampler*> samplerCache_;
+    
+    // Speculative decoding draft model, context and its cached tokens
+    std::shared_ptr<llama_model> draftModelRef_;
+    llama_model* draftModel_ = nullptr;
+    llama_context* draftContext_ = nullptr;
+    llama_sampler* draftSampler_ = nullptr;
+    llama_batch draftBatch_ = {};
+    std::vector<llama_token> draftCachedTokens_;
+    
+    // Buffers sized in loadModel() and reused by every single-sequence generation,
+    // so the per-token loop runs without heap allocations
+    llama_batch batch_ = {};
+    int batchCapacity_ = 0;
+    std::vector<llama_token> tokenScratch_;     // Prompt tokens of the current request
+    std::vector<llama_token> drafts_;           // Tokens proposed by the draft model this step
+    std::string piece_;                         // Text of the token being emitted
+    std::string emitted_;                       // Complete UTF-8 handed to the callback
+    Utf8StreamDecoder utf8_;
+    
+    // Embeddings context, created lazily by embed() for the requested pooling type
+    llama_context* embedContext_ = nullptr;
+    int embedPooling_ = 0;
+    
+    // CPU threadpools pinned to the core topology, only created for automatic thread counts
+    ggml_threadpool* threadpool_ = nullptr;
+    ggml_threadpool* threadpoolBatch_ = nullptr;
+    
+    // Continuous batching scheduler, only created when parallelSequences > 1
+    std::unique_ptr<SequenceScheduler> scheduler_;
+    
+    // Message boundaries of the last applyChatTemplate() result, used for turn-aware truncation
+    struct ChatSegment {
+        std::string role;
+        std::string content;    // To recognise the same message in the next call
+        size_t begin;
+        size_t end;
+    };
+    std::string chatPrompt_;
+    std::vector<ChatSegment> chatSegments_;
+    size_t chatTurnCut_ = 0;    // First non-system message kept by turn-aware truncation of this chat
+    
+    // Native chat histories by id, see createConversation()
+    std::unordered_map<int, std::unique_ptr<Conversation>> conversations_;
+    std::vector<llama_token> replyTokens_;      // Tokens sampled for the conversation being answered
+    std::string replyText_;                     // Their raw text
+    
+    // LoRA adapters by id, see loadLoraAdapter(); the active ones with their scales
+    std::unordered_map<int, llama_adapter_lora*> loraAdapters_;
+    std::unordered_map<int, float> loraScales_;
+    
+    // KV cache optimization - tokens currently held in the KV cache for sequence 0
+    // (last prompt + generated tokens)
     std::vector<llama_token> lastPromptTokens_;
-    uint64_t lastPromptHash_ = 0;
+    
+    void evictCaches();
 #endif
     
     LlamaConfig currentConfig_;
+    int nextConversationId_ = 1;
+    int nextLoraId_ = 1;
+    GenerationStats lastStats_;
     std::string lastError_;
     std::atomic<bool> isGenerating_{false};
     std::atomic<bool> shouldCancel_{false};
+    std::atomic<uint32_t> cancelEpoch_{0};      // Bumped by cancelGeneration() for scheduled requests
+    std::atomic<int> activeParallelRequests_{0};
+    std::atomic<int> lastDraftedTokens_{0};
+    std::atomic<int> lastAcceptedTokens_{0};
+    std::atomic<bool> evictPending_{false};     // trimMemory() asked to evict while a generation was running
     mutable std::mutex mutex_;
     
     // Magic number for validity checking - initialized in constructor, changed to FREED in destructor
@@ -158,16 +532,106 @@ private:
     
     void setError(const std::string& error);
     void clearError();
+    std::string generateStreamImpl(const std::string& prompt, const std::vector<int32_t>* promptTokens,
+                                   TokenCallback callback, const LlamaConfig* config, ProgressCallback progress,
+                                   int conversationId = 0);
+    // Single-sequence generation, caller holds mutex_; the result is left in lastError_
+    void generateStreamLocked(const std::string& prompt, const std::vector<int32_t>* promptTokens,
+                              TokenCallback callback, const LlamaConfig* config, ProgressCallback progress,
+                              int conversationId);
     
 #if LLAMA_AVAILABLE
     std::vector<llama_token> tokenize(const std::string& text, bool addBos);
+    bool tokenizeInto(const char* text, size_t length, bool addBos, std::vector<llama_token>& tokens);
+    Conversation* findConversation(int id);
     std::string detokenize(const std::vector<llama_token>& tokens);
-    void setupSampler(const LlamaConfig& config);
+    const std::string& tokenToPiece(llama_token token);
+    bool allocateBuffers(int batchSize, int nCtx);
+    void freeBuffers();
+    bool ensureEmbedContext(int pooling);
+    void warmUp(llama_context* ctx);
+    static bool abortCallback(void* data);
+    void freeEmbedContext();
+    bool setupSampler(const LlamaConfig& config);
+    llama_sampler* cachedSampler(const LlamaConfig& config);
+    llama_sampler* createSamplerChain(const LlamaConfig& config);
+    llama_sampler* withGrammar(llama_sampler* chain, const LlamaConfig& config);
+    
+    // Multi-sequence path used when the scheduler is active
+    std::string generateStreamParallel(const std::string& prompt, const std::vector<int32_t>* promptTokens,
+                                       TokenCallback callback, const LlamaConfig* config, int conversationId);
     
     // Advanced algorithms for optimization
     std::vector<llama_token> smartTruncate(const std::vector<llama_token>& tokens, int maxTokens);
-    uint64_t computeRollingHash(const std::vector<llama_token>& tokens, size_t start, size_t len);
+    
+    /**
+     * Record per-message boundaries of a formatted chat by re-applying the template to each
+     * message prefix. Boundaries of the messages the previous call started with are carried
+     * over, so a new turn only formats its new messages. Left empty when the template output
+     * isn't prefix-stable.
+     */
+    void computeChatSegments(const char* tmpl, const std::vector<llama_chat_message>& messages,
+                             const std::string& formatted);
+    
+    /**
+     * Tokenize a prompt produced by applyChatTemplate() one message at a time, so each
+     * message's tokens don't depend on its neighbours and stay identical when older turns are dropped.
+     * @param turns Receives the tokens of each message (without BOS)
+     * @return Full prompt tokens (BOS + all turns)
+     */
+    std::vector<llama_token> tokenizeTurns(const std::string& prompt, std::vector<std::vector<llama_token>>& turns);
+    
+    /**
+     * Drop whole old turns until the prompt fits, keeping the system message and the
+     * latest message. Resumes from the previous cut so the kept prefix is stable across turns.
+     * @param firstIsSystem Whether turns[0] is the system message
+     * @param turnCut Cut of the previous truncation of the same history, updated to the new one
+     * @return Truncated prompt tokens, empty if the kept messages alone don't fit
+     */
+    std::vector<llama_token> truncateTurns(const std::vector<std::vector<llama_token>>& turns, bool firstIsSystem,
+                                           int maxTokens, size_t& turnCut);
     size_t findLongestCommonPrefix(const std::vector<llama_token>& a, const std::vector<llama_token>& b);
+    
+    /**
+     * Prepare the KV cache for a new prompt.
+     * Keeps the prefix shared with lastPromptTokens_ and removes the diverging tail,
+     * falling back to a full clear when the cache can't be trimmed.
+     * @return Number of prompt tokens already present in the KV cache
+     */
+    size_t prepareKvCache(const std::vector<llama_token>& promptTokens, bool allowReuse, int shiftKeep = -1);
+    void invalidateKvCache();
+    
+    /**
+     * Context shift: remove nDiscard cells after the first nKeep from sequence 0 and move
+     * the remaining cells down so positions stay contiguous. cached is updated to match.
+     * @return false if the memory doesn't support shifting (cache left untouched)
+     */
+    static bool shiftKvCache(llama_context* ctx, std::vector<llama_token>& cached, size_t nKeep, size_t nDiscard);
+    
+    /**
+     * Find where promptTokens[nKeep..] continues later in lastPromptTokens_ (a window that slid forward)
+     * and shift that run down behind the first nKeep cached tokens.
+     * @return Number of additional prompt tokens now matching the cache
+     */
+    size_t reuseShifted(size_t nKeep, const std::vector<llama_token>& promptTokens);
+    
+    // Truncate to maxTokens keeping the first nKeep tokens and the most recent tail
+    static std::vector<llama_token> truncateKeepingHead(const std::vector<llama_token>& tokens, int maxTokens, int nKeep);
+    
+    // Create decode/batch threadpools masked to the probed core topology
+    void createThreadpools(int nThreads, int nThreadsBatch);
+    void freeThreadpools();
+    
+    // Speculative decoding
+    bool loadDraftModel(const LlamaConfig& config, const llama_model_params& modelParams,
+                        const llama_context_params& ctxParams);
+    void unloadDraftModel();
+    
+    /**
+     * Propose up to nDraft tokens following idLast with the draft model.
+     * Syncs the draft KV cache with lastPromptTokens_ first.
+     */
+    void draftTokens(llama_token idLast, int nDraft, std::vector<llama_token>& drafts);
 #endif
 };
 
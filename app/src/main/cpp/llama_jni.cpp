@@ -2,9 +2,14 @@
 #include <string>
 #include <unordered_map>
 #include <mutex>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
 #include <android/log.h>
 
 #include "llama_context_wrapper.h"
+#include "async_generation.h"
+#include "trace.h"
 
 #define LOG_TAG "LlamaJNI"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
@@ -19,6 +24,69 @@ static std::unordered_map<jlong, std::unique_ptr<LlamaContextWrapper>> g_context
 static std::mutex g_contextsMutex;
 static jlong g_nextContextId = 1;
 
+// Generations running on native worker threads (nativeStartGeneration), by job handle
+struct AsyncJob {
+    jlong context;
+    std::shared_ptr<AsyncGeneration> generation;
+};
+static std::unordered_map<jlong, AsyncJob> g_jobs;
+static std::mutex g_jobsMutex;
+static jlong g_nextJobId = 1;
+
+// Text a worker may run ahead of its collector before decoding waits
+constexpr size_t kAsyncRingBytes = 64 * 1024;
+
+// Class refs, field and method IDs resolved once in JNI_OnLoad
+struct JniCache {
+    jclass nativeConfigClass = nullptr;
+    jfieldID contextSize = nullptr;
+    jfieldID batchSize = nullptr;
+    jfieldID parallelSequences = nullptr;
+    jfieldID threads = nullptr;
+    jfieldID threadsBatch = nullptr;
+    jfieldID temperature = nullptr;
+    jfieldID topP = nullptr;
+    jfieldID topK = nullptr;
+    jfieldID repeatPenalty = nullptr;
+    jfieldID grammar = nullptr;
+    jfieldID jsonSchema = nullptr;
+    jfieldID grammarTriggers = nullptr;
+    jfieldID maxTokens = nullptr;
+    jfieldID cacheReuse = nullptr;
+    jfieldID contextShift = nullptr;
+    jfieldID keepTokens = nullptr;
+    jfieldID flashAttention = nullptr;
+    jfieldID cacheTypeK = nullptr;
+    jfieldID cacheTypeV = nullptr;
+    jfieldID useMmap = nullptr;
+    jfieldID useMlock = nullptr;
+    jfieldID warmup = nullptr;
+    jfieldID gpuLayers = nullptr;
+    jfieldID gpuDevice = nullptr;
+    jfieldID seed = nullptr;
+    jfieldID draftModelPath = nullptr;
+    jfieldID draftTokens = nullptr;
+    
+    jclass tokenCallbackClass = nullptr;
+    jmethodID onToken = nullptr;
+    jclass chunkCallbackClass = nullptr;
+    jmethodID onChunk = nullptr;
+    jclass progressCallbackClass = nullptr;
+    jmethodID onPrefillProgress = nullptr;
+    jclass loadProgressCallbackClass = nullptr;
+    jmethodID onLoadProgress = nullptr;
+    
+    jclass generationErrorClass = nullptr;
+    jmethodID generationErrorInit = nullptr;
+    
+    jclass backendDeviceClass = nullptr;
+    jmethodID backendDeviceInit = nullptr;
+    
+    jclass loadPlanClass = nullptr;
+    jmethodID loadPlanInit = nullptr;
+};
+static JniCache g_jni;
+
 // Helper to get context from handle
 static LlamaContextWrapper* getContext(jlong handle) {
     std::lock_guard<std::mutex> lock(g_contextsMutex);
@@ -40,6 +108,40 @@ static std::string jstringToString(JNIEnv* env, jstring jstr) {
     return result;
 }
 
+// UTF-8 view of a jstring, released on scope exit - avoids copying it into a std::string
+class ScopedUtfChars {
+public:
+    ScopedUtfChars(JNIEnv* env, jstring jstr) : env_(env), jstr_(jstr) {
+        if (jstr != nullptr) {
+            chars_ = env->GetStringUTFChars(jstr, nullptr);
+            length_ = (size_t)env->GetStringUTFLength(jstr);
+        }
+    }
+    ~ScopedUtfChars() {
+        if (chars_ != nullptr) {
+            env_->ReleaseStringUTFChars(jstr_, chars_);
+        }
+    }
+    ScopedUtfChars(const ScopedUtfChars&) = delete;
+    ScopedUtfChars& operator=(const ScopedUtfChars&) = delete;
+    
+    const char* data() const { return chars_ != nullptr ? chars_ : ""; }
+    size_t size() const { return length_; }
+    
+private:
+    JNIEnv* env_;
+    jstring jstr_;
+    const char* chars_ = nullptr;
+    size_t length_ = 0;
+};
+
+// Copy a pre-tokenized prompt from Java
+static std::vector<int32_t> tokensFromJava(JNIEnv* env, jintArray array) {
+    std::vector<int32_t> tokens((size_t)env->GetArrayLength(array));
+    env->GetIntArrayRegion(array, 0, (jsize)tokens.size(), reinterpret_cast<jint*>(tokens.data()));
+    return tokens;
+}
+
 // Helper to validate UTF-8 string and replace invalid bytes
 static std::string sanitizeUtf8(const std::string& str) {
     std::string result;
@@ -110,6 +212,22 @@ static std::string sanitizeUtf8(const std::string& str) {
     return result;
 }
 
+// Length of the longest prefix of str that doesn't end in an incomplete UTF-8 sequence
+static size_t utf8CompleteLength(const std::string& str, size_t maxLen) {
+    size_t len = std::min(str.size(), maxLen);
+    size_t i = len;
+    // Walk back over at most 3 continuation bytes to the last lead byte
+    while (i > 0 && len - i < 4 && (static_cast<unsigned char>(str[i - 1]) & 0xC0) == 0x80) {
+        i--;
+    }
+    if (i == 0) {
+        return len;
+    }
+    unsigned char lead = static_cast<unsigned char>(str[i - 1]);
+    size_t need = (lead & 0xE0) == 0xC0 ? 2 : (lead & 0xF0) == 0xE0 ? 3 : (lead & 0xF8) == 0xF0 ? 4 : 1;
+    return (len - (i - 1) < need) ? i - 1 : len;
+}
+
 // Helper to convert std::string to jstring with UTF-8 validation
 static jstring stringToJstring(JNIEnv* env, const std::string& str) {
     // Validate and sanitize UTF-8 to prevent JNI crash
@@ -137,28 +255,120 @@ static void throwException(JNIEnv* env, const char* className, const char* messa
 
 // Helper to throw LlamaException.GenerationError
 static void throwGenerationError(JNIEnv* env, const char* message) {
-    jclass exClass = env->FindClass("org/codeshipping/llamakotlin/exception/LlamaException$GenerationError");
-    if (exClass != nullptr && !env->ExceptionCheck()) {
-        // Find constructor
-        jmethodID constructor = env->GetMethodID(exClass, "<init>", "(Ljava/lang/String;Ljava/lang/Throwable;)V");
-        if (constructor != nullptr) {
-            jstring jmsg = env->NewStringUTF(message);
-            jobject ex = env->NewObject(exClass, constructor, jmsg, nullptr);
-            if (ex != nullptr) {
-                env->Throw((jthrowable)ex);
-                env->DeleteLocalRef(ex);
-            }
-            env->DeleteLocalRef(jmsg);
-        } else {
-            // Fallback to RuntimeException
-            env->ExceptionClear();
-            throwException(env, "java/lang/RuntimeException", message);
-        }
-        env->DeleteLocalRef(exClass);
+    jstring jmsg = env->NewStringUTF(message);
+    jobject ex = jmsg != nullptr ? env->NewObject(g_jni.generationErrorClass, g_jni.generationErrorInit, jmsg, nullptr) : nullptr;
+    if (ex != nullptr) {
+        env->Throw((jthrowable)ex);
+        env->DeleteLocalRef(ex);
     } else {
+        // Fallback to RuntimeException
         env->ExceptionClear();
         throwException(env, "java/lang/RuntimeException", message);
     }
+    if (jmsg != nullptr) env->DeleteLocalRef(jmsg);
+}
+
+// Resolve a class as a global ref, nullptr (with the exception cleared) if missing
+static jclass findGlobalClass(JNIEnv* env, const char* name) {
+    jclass local = env->FindClass(name);
+    if (local == nullptr) {
+        env->ExceptionClear();
+        LOGE("JNI_OnLoad: class not found: %s", name);
+        return nullptr;
+    }
+    jclass global = (jclass)env->NewGlobalRef(local);
+    env->DeleteLocalRef(local);
+    return global;
+}
+
+// Member lookups for initJniCache(): a missing member is logged and its NoSuchFieldError /
+// NoSuchMethodError cleared; ok turns false and later lookups are skipped
+static jfieldID fieldId(JNIEnv* env, jclass clazz, const char* name, const char* sig, bool& ok) {
+    if (!ok) {
+        return nullptr;
+    }
+    jfieldID id = env->GetFieldID(clazz, name, sig);
+    if (id == nullptr) {
+        env->ExceptionClear();
+        LOGE("JNI_OnLoad: field not found: %s %s", name, sig);
+        ok = false;
+    }
+    return id;
+}
+
+static jmethodID methodId(JNIEnv* env, jclass clazz, const char* name, const char* sig, bool& ok) {
+    if (!ok) {
+        return nullptr;
+    }
+    jmethodID id = env->GetMethodID(clazz, name, sig);
+    if (id == nullptr) {
+        env->ExceptionClear();
+        LOGE("JNI_OnLoad: method not found: %s%s", name, sig);
+        ok = false;
+    }
+    return id;
+}
+
+// Populate g_jni - called once from JNI_OnLoad
+static bool initJniCache(JNIEnv* env) {
+    g_jni.nativeConfigClass = findGlobalClass(env, "org/codeshipping/llamakotlin/LlamaNative$NativeConfig");
+    g_jni.tokenCallbackClass = findGlobalClass(env, "org/codeshipping/llamakotlin/LlamaNative$NativeTokenCallback");
+    g_jni.chunkCallbackClass = findGlobalClass(env, "org/codeshipping/llamakotlin/LlamaNative$NativeChunkCallback");
+    g_jni.progressCallbackClass = findGlobalClass(env, "org/codeshipping/llamakotlin/LlamaNative$NativeProgressCallback");
+    g_jni.loadProgressCallbackClass = findGlobalClass(env, "org/codeshipping/llamakotlin/LlamaNative$NativeLoadProgressCallback");
+    g_jni.generationErrorClass = findGlobalClass(env, "org/codeshipping/llamakotlin/exception/LlamaException$GenerationError");
+    g_jni.backendDeviceClass = findGlobalClass(env, "org/codeshipping/llamakotlin/BackendDevice");
+    g_jni.loadPlanClass = findGlobalClass(env, "org/codeshipping/llamakotlin/LoadPlan");
+    if (g_jni.nativeConfigClass == nullptr || g_jni.tokenCallbackClass == nullptr ||
+        g_jni.chunkCallbackClass == nullptr || g_jni.progressCallbackClass == nullptr ||
+        g_jni.loadProgressCallbackClass == nullptr ||
+        g_jni.generationErrorClass == nullptr ||
+        g_jni.backendDeviceClass == nullptr || g_jni.loadPlanClass == nullptr) {
+        return false;
+    }
+    
+    // Each lookup is skipped once one has failed, so no JNI call runs with an exception pending
+    bool ok = true;
+    jclass cfg = g_jni.nativeConfigClass;
+    g_jni.contextSize = fieldId(env, cfg, "contextSize", "I", ok);
+    g_jni.batchSize = fieldId(env, cfg, "batchSize", "I", ok);
+    g_jni.parallelSequences = fieldId(env, cfg, "parallelSequences", "I", ok);
+    g_jni.threads = fieldId(env, cfg, "threads", "I", ok);
+    g_jni.threadsBatch = fieldId(env, cfg, "threadsBatch", "I", ok);
+    g_jni.temperature = fieldId(env, cfg, "temperature", "F", ok);
+    g_jni.topP = fieldId(env, cfg, "topP", "F", ok);
+    g_jni.topK = fieldId(env, cfg, "topK", "I", ok);
+    g_jni.repeatPenalty = fieldId(env, cfg, "repeatPenalty", "F", ok);
+    g_jni.grammar = fieldId(env, cfg, "grammar", "Ljava/lang/String;", ok);
+    g_jni.jsonSchema = fieldId(env, cfg, "jsonSchema", "Ljava/lang/String;", ok);
+    g_jni.grammarTriggers = fieldId(env, cfg, "grammarTriggers", "[Ljava/lang/String;", ok);
+    g_jni.maxTokens = fieldId(env, cfg, "maxTokens", "I", ok);
+    g_jni.cacheReuse = fieldId(env, cfg, "cacheReuse", "Z", ok);
+    g_jni.contextShift = fieldId(env, cfg, "contextShift", "Z", ok);
+    g_jni.keepTokens = fieldId(env, cfg, "keepTokens", "I", ok);
+    g_jni.flashAttention = fieldId(env, cfg, "flashAttention", "Z", ok);
+    g_jni.cacheTypeK = fieldId(env, cfg, "cacheTypeK", "Ljava/lang/String;", ok);
+    g_jni.cacheTypeV = fieldId(env, cfg, "cacheTypeV", "Ljava/lang/String;", ok);
+    g_jni.useMmap = fieldId(env, cfg, "useMmap", "Z", ok);
+    g_jni.useMlock = fieldId(env, cfg, "useMlock", "Z", ok);
+    g_jni.warmup = fieldId(env, cfg, "warmup", "Z", ok);
+    g_jni.gpuLayers = fieldId(env, cfg, "gpuLayers", "I", ok);
+    g_jni.gpuDevice = fieldId(env, cfg, "gpuDevice", "Ljava/lang/String;", ok);
+    g_jni.seed = fieldId(env, cfg, "seed", "I", ok);
+    g_jni.draftModelPath = fieldId(env, cfg, "draftModelPath", "Ljava/lang/String;", ok);
+    g_jni.draftTokens = fieldId(env, cfg, "draftTokens", "I", ok);
+    
+    g_jni.onToken = methodId(env, g_jni.tokenCallbackClass, "onToken", "(Ljava/lang/String;)V", ok);
+    g_jni.onChunk = methodId(env, g_jni.chunkCallbackClass, "onChunk", "(I)V", ok);
+    g_jni.onPrefillProgress = methodId(env, g_jni.progressCallbackClass, "onPrefillProgress", "(II)V", ok);
+    g_jni.onLoadProgress = methodId(env, g_jni.loadProgressCallbackClass, "onLoadProgress", "(F)V", ok);
+    g_jni.generationErrorInit = methodId(env, g_jni.generationErrorClass, "<init>",
+                                         "(Ljava/lang/String;Ljava/lang/Throwable;)V", ok);
+    g_jni.backendDeviceInit = methodId(env, g_jni.backendDeviceClass, "<init>",
+                                       "(Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;IJJ)V", ok);
+    g_jni.loadPlanInit = methodId(env, g_jni.loadPlanClass, "<init>", "(JJJJIII)V", ok);
+    
+    return ok;
 }
 
 // Convert Java LlamaConfig to native LlamaConfig
@@ -169,37 +379,61 @@ static LlamaConfig configFromJava(JNIEnv* env, jobject jconfig) {
         return config;
     }
     
-    jclass configClass = env->GetObjectClass(jconfig);
-    
-    // Get field IDs
-    jfieldID contextSizeField = env->GetFieldID(configClass, "contextSize", "I");
-    jfieldID batchSizeField = env->GetFieldID(configClass, "batchSize", "I");
-    jfieldID threadsField = env->GetFieldID(configClass, "threads", "I");
-    jfieldID temperatureField = env->GetFieldID(configClass, "temperature", "F");
-    jfieldID topPField = env->GetFieldID(configClass, "topP", "F");
-    jfieldID topKField = env->GetFieldID(configClass, "topK", "I");
-    jfieldID repeatPenaltyField = env->GetFieldID(configClass, "repeatPenalty", "F");
-    jfieldID maxTokensField = env->GetFieldID(configClass, "maxTokens", "I");
-    jfieldID useMmapField = env->GetFieldID(configClass, "useMmap", "Z");
-    jfieldID useMlockField = env->GetFieldID(configClass, "useMlock", "Z");
-    jfieldID gpuLayersField = env->GetFieldID(configClass, "gpuLayers", "I");
-    jfieldID seedField = env->GetFieldID(configClass, "seed", "I");
-    
-    // Read values
-    if (contextSizeField) config.contextSize = env->GetIntField(jconfig, contextSizeField);
-    if (batchSizeField) config.batchSize = env->GetIntField(jconfig, batchSizeField);
-    if (threadsField) config.threads = env->GetIntField(jconfig, threadsField);
-    if (temperatureField) config.temperature = env->GetFloatField(jconfig, temperatureField);
-    if (topPField) config.topP = env->GetFloatField(jconfig, topPField);
-    if (topKField) config.topK = env->GetIntField(jconfig, topKField);
-    if (repeatPenaltyField) config.repeatPenalty = env->GetFloatField(jconfig, repeatPenaltyField);
-    if (maxTokensField) config.maxTokens = env->GetIntField(jconfig, maxTokensField);
-    if (useMmapField) config.useMmap = env->GetBooleanField(jconfig, useMmapField);
-    if (useMlockField) config.useMlock = env->GetBooleanField(jconfig, useMlockField);
-    if (gpuLayersField) config.gpuLayers = env->GetIntField(jconfig, gpuLayersField);
-    if (seedField) config.seed = env->GetIntField(jconfig, seedField);
-    
-    env->DeleteLocalRef(configClass);
+    // Field IDs are cached in JNI_OnLoad, so this is plain field reads
+    config.contextSize = env->GetIntField(jconfig, g_jni.contextSize);
+    config.batchSize = env->GetIntField(jconfig, g_jni.batchSize);
+    config.parallelSequences = env->GetIntField(jconfig, g_jni.parallelSequences);
+    config.threads = env->GetIntField(jconfig, g_jni.threads);
+    config.threadsBatch = env->GetIntField(jconfig, g_jni.threadsBatch);
+    config.temperature = env->GetFloatField(jconfig, g_jni.temperature);
+    config.topP = env->GetFloatField(jconfig, g_jni.topP);
+    config.topK = env->GetIntField(jconfig, g_jni.topK);
+    config.repeatPenalty = env->GetFloatField(jconfig, g_jni.repeatPenalty);
+    config.maxTokens = env->GetIntField(jconfig, g_jni.maxTokens);
+    config.cacheReuse = env->GetBooleanField(jconfig, g_jni.cacheReuse);
+    config.contextShift = env->GetBooleanField(jconfig, g_jni.contextShift);
+    config.keepTokens = env->GetIntField(jconfig, g_jni.keepTokens);
+    config.flashAttention = env->GetBooleanField(jconfig, g_jni.flashAttention);
+    config.useMmap = env->GetBooleanField(jconfig, g_jni.useMmap);
+    config.useMlock = env->GetBooleanField(jconfig, g_jni.useMlock);
+    config.warmup = env->GetBooleanField(jconfig, g_jni.warmup);
+    config.gpuLayers = env->GetIntField(jconfig, g_jni.gpuLayers);
+    config.seed = env->GetIntField(jconfig, g_jni.seed);
+    
+    jstring cacheTypeK = (jstring)env->GetObjectField(jconfig, g_jni.cacheTypeK);
+    config.cacheTypeK = jstringToString(env, cacheTypeK);
+    if (cacheTypeK != nullptr) env->DeleteLocalRef(cacheTypeK);
+    jstring cacheTypeV = (jstring)env->GetObjectField(jconfig, g_jni.cacheTypeV);
+    config.cacheTypeV = jstringToString(env, cacheTypeV);
+    if (cacheTypeV != nullptr) env->DeleteLocalRef(cacheTypeV);
+    
+    jstring gpuDevice = (jstring)env->GetObjectField(jconfig, g_jni.gpuDevice);
+    config.gpuDevice = jstringToString(env, gpuDevice);
+    if (gpuDevice != nullptr) env->DeleteLocalRef(gpuDevice);
+    
+    jstring draftPath = (jstring)env->GetObjectField(jconfig, g_jni.draftModelPath);
+    config.draftModelPath = jstringToString(env, draftPath);
+    if (draftPath != nullptr) env->DeleteLocalRef(draftPath);
+    config.draftTokens = env->GetIntField(jconfig, g_jni.draftTokens);
+    
+    jstring grammar = (jstring)env->GetObjectField(jconfig, g_jni.grammar);
+    config.grammar = jstringToString(env, grammar);
+    if (grammar != nullptr) env->DeleteLocalRef(grammar);
+    
+    jstring jsonSchema = (jstring)env->GetObjectField(jconfig, g_jni.jsonSchema);
+    config.jsonSchema = jstringToString(env, jsonSchema);
+    if (jsonSchema != nullptr) env->DeleteLocalRef(jsonSchema);
+    
+    jobjectArray triggers = (jobjectArray)env->GetObjectField(jconfig, g_jni.grammarTriggers);
+    if (triggers != nullptr) {
+        const jsize count = env->GetArrayLength(triggers);
+        for (jsize i = 0; i < count; i++) {
+            jstring trigger = (jstring)env->GetObjectArrayElement(triggers, i);
+            config.grammarTriggers.push_back(jstringToString(env, trigger));
+            if (trigger != nullptr) env->DeleteLocalRef(trigger);
+        }
+        env->DeleteLocalRef(triggers);
+    }
     
     return config;
 }
@@ -210,6 +444,21 @@ extern "C" {
 // Native Library Management
 // ============================================================================
 
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* /* reserved */) {
+    JNIEnv* env = nullptr;
+    if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
+        return JNI_ERR;
+    }
+    
+    // Fail loadLibrary() loudly rather than silently ignoring config fields later
+    if (!initJniCache(env)) {
+        return JNI_ERR;
+    }
+    
+    LOGI("JNI_OnLoad: class, field and method IDs cached");
+    return JNI_VERSION_1_6;
+}
+
 JNIEXPORT jstring JNICALL
 Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetVersion(
     JNIEnv* env,
@@ -217,6 +466,36 @@ Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetVersion(
     return stringToJstring(env, LlamaContextWrapper::getVersion());
 }
 
+JNIEXPORT jobjectArray JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetBackendDevices(
+    JNIEnv* env,
+    jclass /* clazz */) {
+    std::vector<BackendDevice> devices = LlamaContextWrapper::getBackendDevices();
+    
+    jobjectArray array = env->NewObjectArray((jsize)devices.size(), g_jni.backendDeviceClass, nullptr);
+    if (array == nullptr) {
+        return nullptr;  // OutOfMemoryError pending
+    }
+    
+    for (size_t i = 0; i < devices.size(); i++) {
+        const BackendDevice& device = devices[i];
+        jstring name = stringToJstring(env, device.name);
+        jstring description = stringToJstring(env, device.description);
+        jstring backend = stringToJstring(env, device.backend);
+        jobject obj = env->NewObject(g_jni.backendDeviceClass, g_jni.backendDeviceInit,
+                                     name, description, backend, (jint)device.type,
+                                     (jlong)device.memoryFree, (jlong)device.memoryTotal);
+        if (obj != nullptr) {
+            env->SetObjectArrayElement(array, (jsize)i, obj);
+            env->DeleteLocalRef(obj);
+        }
+        env->DeleteLocalRef(name);
+        env->DeleteLocalRef(description);
+        env->DeleteLocalRef(backend);
+    }
+    return array;
+}
+
 // ============================================================================
 // Context Management
 // ============================================================================
@@ -245,6 +524,28 @@ Java_org_codeshipping_llamakotlin_LlamaNative_nativeDestroyContext(
     jlong handle) {
     LOGI("Destroying context: %lld", (long long)handle);
     
+    // Stop this context's worker threads before the wrapper they decode on goes away
+    std::vector<std::shared_ptr<AsyncGeneration>> jobs;
+    {
+        std::lock_guard<std::mutex> lock(g_jobsMutex);
+        for (auto job = g_jobs.begin(); job != g_jobs.end();) {
+            if (job->second.context == handle) {
+                jobs.push_back(job->second.generation);
+                job = g_jobs.erase(job);
+            } else {
+                ++job;
+            }
+        }
+    }
+    if (!jobs.empty()) {
+        if (LlamaContextWrapper* context = getContext(handle)) {
+            context->cancelGeneration();
+        }
+        for (const auto& job : jobs) {
+            job->join();
+        }
+    }
+    
     std::lock_guard<std::mutex> lock(g_contextsMutex);
     
     auto it = g_contexts.find(handle);
@@ -260,13 +561,28 @@ Java_org_codeshipping_llamakotlin_LlamaNative_nativeDestroyContext(
 // Model Loading
 // ============================================================================
 
+// Wrap an optional NativeLoadProgressCallback; llama.cpp reports from the loading thread
+static LoadProgressCallback loadProgressFromJava(JNIEnv* env, jobject progress) {
+    if (progress == nullptr) {
+        return nullptr;
+    }
+    return [env, progress](float value) {
+        env->CallVoidMethod(progress, g_jni.onLoadProgress, (jfloat)value);
+        if (env->ExceptionCheck()) {
+            LOGE("Exception in load progress callback");
+            env->ExceptionClear();
+        }
+    };
+}
+
 JNIEXPORT jboolean JNICALL
 Java_org_codeshipping_llamakotlin_LlamaNative_nativeLoadModel(
     JNIEnv* env,
     jclass /* clazz */,
     jlong handle,
     jstring modelPath,
-    jobject jconfig) {
+    jobject jconfig,
+    jobject progress) {
     
     LlamaContextWrapper* context = getContext(handle);
     if (context == nullptr) {
@@ -279,7 +595,7 @@ Java_org_codeshipping_llamakotlin_LlamaNative_nativeLoadModel(
     
     LOGI("Loading model: %s", path.c_str());
     
-    bool success = context->loadModel(path, config);
+    bool success = context->loadModel(path, config, loadProgressFromJava(env, progress));
     
     if (!success) {
         std::string error = context->getLastError();
@@ -290,6 +606,35 @@ Java_org_codeshipping_llamakotlin_LlamaNative_nativeLoadModel(
     return JNI_TRUE;
 }
 
+JNIEXPORT jboolean JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeLoadModelFromFd(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jint fd,
+    jlong offset,
+    jobject jconfig,
+    jobject progress) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return JNI_FALSE;
+    }
+    
+    LlamaConfig config = configFromJava(env, jconfig);
+    
+    LOGI("Loading model from fd %d", (int)fd);
+    
+    if (!context->loadModelFromFd((int)fd, (int64_t)offset, config, loadProgressFromJava(env, progress))) {
+        std::string error = context->getLastError();
+        throwGenerationError(env, error.c_str());
+        return JNI_FALSE;
+    }
+    
+    return JNI_TRUE;
+}
+
 JNIEXPORT void JNICALL
 Java_org_codeshipping_llamakotlin_LlamaNative_nativeUnloadModel(
     JNIEnv* env,
@@ -346,14 +691,35 @@ Java_org_codeshipping_llamakotlin_LlamaNative_nativeGenerate(
         configPtr = &config;
     }
     
-    std::string result = context->generate(promptStr, configPtr);
+    std::string error;
+    std::string result = context->generate(promptStr, configPtr, &error);
     
-    if (result.empty() && !context->getLastError().empty()) {
-        throwGenerationError(env, context->getLastError().c_str());
+    if (!error.empty()) {
+        throwGenerationError(env, error.c_str());
         return nullptr;
     }
     
-    return stringToJstring(env, result);
+    // Generated text is already valid UTF-8 (streamed through Utf8StreamDecoder)
+    return env->NewStringUTF(result.c_str());
+}
+
+// Wrap an optional NativeProgressCallback; called on the generating thread, so env stays valid
+static ProgressCallback progressFromJava(JNIEnv* env, jobject progress, bool& hasCallbackError) {
+    if (progress == nullptr) {
+        return nullptr;
+    }
+    return [env, progress, &hasCallbackError](int processed, int total) {
+        if (hasCallbackError) {
+            return;
+        }
+        LLAMA_TRACE_SCOPE("jni:onPrefillProgress");
+        env->CallVoidMethod(progress, g_jni.onPrefillProgress, (jint)processed, (jint)total);
+        if (env->ExceptionCheck()) {
+            LOGE("Exception in progress callback");
+            hasCallbackError = true;
+            env->ExceptionClear();
+        }
+    };
 }
 
 // Callback structure for streaming
@@ -372,7 +738,10 @@ Java_org_codeshipping_llamakotlin_LlamaNative_nativeGenerateStream(
     jlong handle,
     jstring prompt,
     jobject callback,
-    jobject jconfig) {
+    jobject jconfig,
+    jobject progress,
+    jintArray promptTokens,
+    jint conversationId) {
     
     LlamaContextWrapper* context = getContext(handle);
     if (context == nullptr) {
@@ -394,28 +763,22 @@ Java_org_codeshipping_llamakotlin_LlamaNative_nativeGenerateStream(
         configPtr = &config;
     }
     
-    // Get callback method
-    jclass callbackClass = env->GetObjectClass(callback);
-    jmethodID onTokenMethod = env->GetMethodID(callbackClass, "onToken", "(Ljava/lang/String;)V");
-    
-    if (onTokenMethod == nullptr) {
-        env->DeleteLocalRef(callbackClass);
-        throwException(env, "java/lang/NoSuchMethodException", "Callback must have onToken(String) method");
-        return;
-    }
+    jmethodID onTokenMethod = g_jni.onToken;
     
     // Create global ref for callback
     jobject globalCallback = env->NewGlobalRef(callback);
     bool hasCallbackError = false;
     
     // Stream generation with callback
-    context->generateStream(promptStr, [env, globalCallback, onTokenMethod, &hasCallbackError](const std::string& token) {
+    TokenCallback onToken = [env, globalCallback, onTokenMethod, &hasCallbackError](const std::string& token) {
         // Skip if we already had an error
         if (hasCallbackError) {
             return;
         }
         
-        // Note: This callback is called from the same thread, so we can use env directly
+        LLAMA_TRACE_SCOPE("jni:onToken");
+        // Note: This callback is called from the same thread, so we can use env directly.
+        // Tokens arrive as complete UTF-8 characters, no sanitizing needed
         jstring jtoken = env->NewStringUTF(token.c_str());
         if (jtoken == nullptr) {
             LOGE("Failed to create jstring for token");
@@ -432,108 +795,857 @@ Java_org_codeshipping_llamakotlin_LlamaNative_nativeGenerateStream(
             hasCallbackError = true;
             env->ExceptionClear(); // Clear to allow cleanup
         }
-    }, configPtr);
+    };
+    std::string error;
+    if (conversationId != 0) {
+        error = context->generateConversation(conversationId, onToken, configPtr,
+                                              progressFromJava(env, progress, hasCallbackError));
+    } else if (promptTokens != nullptr) {
+        error = context->generateStream(tokensFromJava(env, promptTokens), onToken, configPtr,
+                                        progressFromJava(env, progress, hasCallbackError));
+    } else {
+        error = context->generateStream(promptStr, onToken, configPtr,
+                                        progressFromJava(env, progress, hasCallbackError));
+    }
     
     // Clean up global ref first
     env->DeleteGlobalRef(globalCallback);
-    env->DeleteLocalRef(callbackClass);
     
     // Check for errors - don't throw if already completed successfully
-    std::string error = context->getLastError();
     if (!error.empty() && !hasCallbackError) {
         LOGE("Generation error: %s", error.c_str());
         throwGenerationError(env, error.c_str());
     }
 }
 
-// ============================================================================
-// Generation Control
-// ============================================================================
-
 JNIEXPORT void JNICALL
-Java_org_codeshipping_llamakotlin_LlamaNative_nativeCancelGeneration(
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeGenerateStreamChunked(
     JNIEnv* env,
     jclass /* clazz */,
-    jlong handle) {
+    jlong handle,
+    jstring prompt,
+    jobject buffer,
+    jobject callback,
+    jobject jconfig,
+    jint chunkTokens,
+    jint flushIntervalMs,
+    jobject progress,
+    jintArray promptTokens,
+    jint conversationId) {
     
     LlamaContextWrapper* context = getContext(handle);
-    if (context != nullptr) {
-        context->cancelGeneration();
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return;
     }
-}
-
-JNIEXPORT jboolean JNICALL
-Java_org_codeshipping_llamakotlin_LlamaNative_nativeIsGenerating(
-    JNIEnv* env,
-    jclass /* clazz */,
-    jlong handle) {
     
-    LlamaContextWrapper* context = getContext(handle);
-    if (context == nullptr) {
-        return JNI_FALSE;
+    if (callback == nullptr) {
+        throwException(env, "java/lang/IllegalArgumentException", "Callback cannot be null");
+        return;
     }
     
-    return context->isGenerating() ? JNI_TRUE : JNI_FALSE;
+    char* bufferData = buffer != nullptr ? static_cast<char*>(env->GetDirectBufferAddress(buffer)) : nullptr;
+    const jlong bufferCapacity = buffer != nullptr ? env->GetDirectBufferCapacity(buffer) : -1;
+    if (bufferData == nullptr || bufferCapacity < 4) {
+        throwException(env, "java/lang/IllegalArgumentException", "Buffer must be a direct ByteBuffer of at least 4 bytes");
+        return;
+    }
+    
+    std::string promptStr = jstringToString(env, prompt);
+    
+    LlamaConfig config;
+    LlamaConfig* configPtr = nullptr;
+    if (jconfig != nullptr) {
+        config = configFromJava(env, jconfig);
+        configPtr = &config;
+    }
+    
+    jmethodID onChunkMethod = g_jni.onChunk;
+    
+    // Tokens are collected here and copied into the shared buffer once per chunk
+    // Reserved once, so steady-state chunking doesn't allocate
+    std::string pending;
+    pending.reserve((size_t)bufferCapacity * 2);
+    int pendingTokens = 0;
+    auto lastFlush = std::chrono::steady_clock::now();
+    bool hasCallbackError = false;
+    
+    // Emit complete UTF-8 characters; an incomplete tail stays pending unless this is the final flush
+    auto flush = [&](bool final) {
+        while (!pending.empty() && !hasCallbackError) {
+            size_t n = utf8CompleteLength(pending, (size_t)bufferCapacity);
+            if (n == 0) {
+                if (!final) break;
+                n = std::min(pending.size(), (size_t)bufferCapacity);
+            }
+            
+            // Tokens arrive as valid UTF-8, only the cut at the buffer size needs care
+            memcpy(bufferData, pending.data(), n);
+            pending.erase(0, n);
+            
+            LLAMA_TRACE_SCOPE("jni:onChunk");
+            env->CallVoidMethod(callback, onChunkMethod, (jint)n);
+            if (env->ExceptionCheck()) {
+                LOGE("Exception in chunk callback");
+                hasCallbackError = true;
+                env->ExceptionClear();
+            }
+            
+            if (!final && utf8CompleteLength(pending, (size_t)bufferCapacity) == 0) {
+                break;
+            }
+        }
+        pendingTokens = 0;
+        lastFlush = std::chrono::steady_clock::now();
+    };
+    
+    // The interval is checked as tokens arrive, there is no separate timer thread
+    const auto flushInterval = std::chrono::milliseconds(std::max(0, (int)flushIntervalMs));
+    TokenCallback onToken = [&](const std::string& token) {
+        if (hasCallbackError) {
+            return;
+        }
+        pending += token;
+        pendingTokens++;
+        if (pendingTokens >= chunkTokens || (size_t)bufferCapacity <= pending.size() ||
+            (flushIntervalMs > 0 && std::chrono::steady_clock::now() - lastFlush >= flushInterval)) {
+            flush(false);
+        }
+    };
+    std::string error;
+    if (conversationId != 0) {
+        error = context->generateConversation(conversationId, onToken, configPtr,
+                                              progressFromJava(env, progress, hasCallbackError));
+    } else if (promptTokens != nullptr) {
+        error = context->generateStream(tokensFromJava(env, promptTokens), onToken, configPtr,
+                                        progressFromJava(env, progress, hasCallbackError));
+    } else {
+        error = context->generateStream(promptStr, onToken, configPtr,
+                                        progressFromJava(env, progress, hasCallbackError));
+    }
+    
+    flush(true);
+    
+    if (!error.empty() && !hasCallbackError) {
+        LOGE("Generation error: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+    }
 }
 
 // ============================================================================
-// Chat Template Support
+// Async Generation
 // ============================================================================
 
-JNIEXPORT jstring JNICALL
-Java_org_codeshipping_llamakotlin_LlamaNative_nativeApplyChatTemplate(
+static std::shared_ptr<AsyncGeneration> getJob(jlong job) {
+    std::lock_guard<std::mutex> lock(g_jobsMutex);
+    auto it = g_jobs.find(job);
+    return it != g_jobs.end() ? it->second.generation : nullptr;
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeStartGeneration(
     JNIEnv* env,
     jclass /* clazz */,
     jlong handle,
-    jstring messagesJson,
-    jboolean addGenerationPrompt) {
+    jstring prompt,
+    jobject jconfig,
+    jintArray promptTokens,
+    jint conversationId) {
     
     LlamaContextWrapper* context = getContext(handle);
     if (context == nullptr) {
-        throwException(env, "java/lang/IllegalStateException", "Invalid context handle - context was destroyed");
-        return nullptr;
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
     }
     
-    // Check if model is still loaded before using it
-    if (!context->isModelLoaded()) {
-        LOGW("applyChatTemplate called but model is not loaded");
-        throwException(env, "java/lang/IllegalStateException", "Model is not loaded. The model may have been unloaded or freed.");
-        return nullptr;
-    }
+    // Everything the worker needs is copied out of the JVM here; it never calls back into Java
+    std::string promptStr = jstringToString(env, prompt);
+    const bool hasConfig = jconfig != nullptr;
+    LlamaConfig config = hasConfig ? configFromJava(env, jconfig) : LlamaConfig();
+    const bool hasTokens = promptTokens != nullptr;
+    std::vector<int32_t> tokens = hasTokens ? tokensFromJava(env, promptTokens) : std::vector<int32_t>();
     
-    std::string jsonStr = jstringToString(env, messagesJson);
-    bool addPrompt = (addGenerationPrompt == JNI_TRUE);
+    auto task = [context, promptStr = std::move(promptStr), hasConfig, config = std::move(config), hasTokens,
+                 tokens = std::move(tokens), conversationId](const AsyncGeneration::Sink& sink,
+                                                             const AsyncGeneration::Progress& progress) {
+        const LlamaConfig* configPtr = hasConfig ? &config : nullptr;
+        if (conversationId != 0) {
+            return context->generateConversation(conversationId, sink, configPtr, progress);
+        }
+        if (hasTokens) {
+            return context->generateStream(tokens, sink, configPtr, progress);
+        }
+        return context->generateStream(promptStr, sink, configPtr, progress);
+    };
     
-    std::string result = context->applyChatTemplate(jsonStr, addPrompt);
+    std::lock_guard<std::mutex> lock(g_jobsMutex);
+    const jlong job = g_nextJobId++;
+    g_jobs[job] = {handle, std::make_shared<AsyncGeneration>(kAsyncRingBytes, std::move(task))};
+    return job;
+}
+
+JNIEXPORT jint JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativePollGeneration(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong job,
+    jobject buffer) {
     
-    if (result.empty() && !context->getLastError().empty()) {
-        throwGenerationError(env, context->getLastError().c_str());
-        return nullptr;
+    std::shared_ptr<AsyncGeneration> generation = getJob(job);
+    if (generation == nullptr) {
+        return -1;  // Finished, or torn down with its context
     }
     
-    return stringToJstring(env, result);
+    char* bufferData = buffer != nullptr ? static_cast<char*>(env->GetDirectBufferAddress(buffer)) : nullptr;
+    const jlong bufferCapacity = buffer != nullptr ? env->GetDirectBufferCapacity(buffer) : -1;
+    if (bufferData == nullptr || bufferCapacity < 4) {
+        throwException(env, "java/lang/IllegalArgumentException", "Buffer must be a direct ByteBuffer of at least 4 bytes");
+        return -1;
+    }
+    return (jint)generation->poll(bufferData, (size_t)bufferCapacity);
 }
 
-JNIEXPORT jstring JNICALL
-Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetChatTemplate(
+JNIEXPORT jboolean JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeAwaitGeneration(
     JNIEnv* env,
     jclass /* clazz */,
-    jlong handle) {
+    jlong job,
+    jint timeoutMs) {
     
-    LlamaContextWrapper* context = getContext(handle);
-    if (context == nullptr) {
-        throwException(env, "java/lang/IllegalStateException", "Invalid context handle - context was destroyed");
-        return nullptr;
+    std::shared_ptr<AsyncGeneration> generation = getJob(job);
+    return generation == nullptr || generation->await(timeoutMs) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetGenerationProgress(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong job) {
+    
+    std::shared_ptr<AsyncGeneration> generation = getJob(job);
+    if (generation == nullptr) {
+        return 0;
     }
+    return ((jlong)generation->processed() << 32) | (jlong)(uint32_t)generation->total();
+}
+
+JNIEXPORT void JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeFinishGeneration(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong job) {
     
-    // Check if model is still loaded
-    if (!context->isModelLoaded()) {
-        LOGW("getChatTemplate called but model is not loaded");
-        throwException(env, "java/lang/IllegalStateException", "Model is not loaded. The model may have been unloaded or freed.");
-        return nullptr;
+    std::shared_ptr<AsyncGeneration> generation = getJob(job);
+    if (generation == nullptr) {
+        return;
     }
     
-    return stringToJstring(env, context->getChatTemplate());
+    // The job stays listed until the worker is gone, so a concurrent nativeDestroyContext
+    // still finds it and waits instead of freeing the wrapper under the worker
+    std::string error = generation->join();
+    {
+        std::lock_guard<std::mutex> lock(g_jobsMutex);
+        auto it = g_jobs.find(job);
+        if (it != g_jobs.end() && it->second.generation == generation) {
+            g_jobs.erase(it);
+        }
+    }
+    if (!error.empty()) {
+        LOGE("Generation error: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+    }
+}
+
+// ============================================================================
+// Tokenization
+// ============================================================================
+
+JNIEXPORT jintArray JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeTokenize(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring text,
+    jboolean addSpecial) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    // Grows to the largest text seen on this thread and is reused from then on
+    static thread_local std::vector<int32_t> tokens;
+    ScopedUtfChars chars(env, text);
+    const int n = context->tokenizeText(chars.data(), chars.size(), addSpecial == JNI_TRUE, tokens);
+    if (n < 0) {
+        std::string error = context->getLastError();
+        LOGE("Tokenize error: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return nullptr;
+    }
+    
+    jintArray array = env->NewIntArray(n);
+    if (array == nullptr) {
+        return nullptr;  // OutOfMemoryError pending
+    }
+    env->SetIntArrayRegion(array, 0, n, reinterpret_cast<const jint*>(tokens.data()));
+    return array;
+}
+
+JNIEXPORT jint JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeCountTokens(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring text,
+    jboolean addSpecial) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    
+    ScopedUtfChars chars(env, text);
+    const int n = context->countTokens(chars.data(), chars.size(), addSpecial == JNI_TRUE);
+    if (n < 0) {
+        std::string error = context->getLastError();
+        LOGE("Tokenize error: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return 0;
+    }
+    return n;
+}
+
+// ============================================================================
+// Conversations
+// ============================================================================
+
+JNIEXPORT jint JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeCreateConversation(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    
+    const int id = context->createConversation();
+    if (id == 0) {
+        throwGenerationError(env, context->getLastError().c_str());
+    }
+    return id;
+}
+
+JNIEXPORT void JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeFreeConversation(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jint conversationId) {
+    
+    // The context may already be gone, which freed its conversations too
+    LlamaContextWrapper* context = getContext(handle);
+    if (context != nullptr) {
+        context->freeConversation(conversationId);
+    }
+}
+
+JNIEXPORT jint JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeAppendMessage(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jint conversationId,
+    jstring role,
+    jstring content) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    
+    const int n = context->appendMessage(conversationId, jstringToString(env, role), jstringToString(env, content));
+    if (n < 0) {
+        std::string error = context->getLastError();
+        LOGE("Append message error: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return 0;
+    }
+    return n;
+}
+
+JNIEXPORT jint JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetConversationTokenCount(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jint conversationId) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    return context->getConversationTokenCount(conversationId);
+}
+
+// ============================================================================
+// LoRA Adapters
+// ============================================================================
+
+JNIEXPORT jint JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeLoadLoraAdapter(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring path) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    return context->loadLoraAdapter(jstringToString(env, path));
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeSetLoraAdapter(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jint adapterId,
+    jfloat scale) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return JNI_FALSE;
+    }
+    return context->setLoraAdapter(adapterId, scale) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeClearLoraAdapters(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context != nullptr) {
+        context->clearLoraAdapters();
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeUnloadLoraAdapter(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jint adapterId) {
+    
+    // The context may already be gone, which freed its adapters too
+    LlamaContextWrapper* context = getContext(handle);
+    if (context != nullptr) {
+        context->unloadLoraAdapter(adapterId);
+    }
+}
+
+// ============================================================================
+// Generation Control
+// ============================================================================
+
+JNIEXPORT void JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeCancelGeneration(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context != nullptr) {
+        context->cancelGeneration();
+    }
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeIsGenerating(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        return JNI_FALSE;
+    }
+    
+    return context->isGenerating() ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jfloat JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetDraftAcceptanceRate(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        return -1.0f;
+    }
+    
+    return context->getDraftAcceptanceRate();
+}
+
+// ============================================================================
+// Benchmark
+// ============================================================================
+
+/**
+ * Result layout (flat so only one array crosses JNI):
+ * [ttftMs, peakRssKb, nPrefill, (batchSize, tokensPerSecond) * nPrefill,
+ *  nDecode, (threads, tokensPerSecond, p50Ms, p99Ms) * nDecode]
+ */
+JNIEXPORT jdoubleArray JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeBenchmark(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jint promptTokens,
+    jint genTokens,
+    jint reps) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    BenchmarkResult result = context->benchmark(promptTokens, genTokens, reps);
+    std::string error = context->getLastError();
+    if (!error.empty()) {
+        LOGE("Benchmark error: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return nullptr;
+    }
+    
+    std::vector<jdouble> values;
+    values.push_back(result.ttftMs);
+    values.push_back((jdouble)result.peakRssKb);
+    values.push_back((jdouble)result.prefill.size());
+    for (const auto& entry : result.prefill) {
+        values.push_back(entry.batchSize);
+        values.push_back(entry.tokensPerSecond);
+    }
+    values.push_back((jdouble)result.decode.size());
+    for (const auto& entry : result.decode) {
+        values.push_back(entry.threads);
+        values.push_back(entry.tokensPerSecond);
+        values.push_back(entry.p50Ms);
+        values.push_back(entry.p99Ms);
+    }
+    
+    jdoubleArray array = env->NewDoubleArray((jsize)values.size());
+    if (array == nullptr) {
+        return nullptr;  // OutOfMemoryError pending
+    }
+    env->SetDoubleArrayRegion(array, 0, (jsize)values.size(), values.data());
+    return array;
+}
+
+/**
+ * Result layout: [tokenizeMs, prefillMs, timeToFirstTokenMs, decodeMs, tokensPerSecond,
+ *  promptTokens, reusedTokens, generatedTokens, truncated, batchCapacity, draftedTokens, acceptedTokens]
+ */
+JNIEXPORT jdoubleArray JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetLastGenerationStats(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    GenerationStats stats = context->getLastGenerationStats();
+    const jdouble values[] = {
+        stats.tokenizeMs,
+        stats.prefillMs,
+        stats.timeToFirstTokenMs,
+        stats.decodeMs,
+        stats.tokensPerSecond,
+        (jdouble)stats.promptTokens,
+        (jdouble)stats.reusedTokens,
+        (jdouble)stats.generatedTokens,
+        stats.truncated ? 1.0 : 0.0,
+        (jdouble)stats.batchCapacity,
+        (jdouble)stats.draftedTokens,
+        (jdouble)stats.acceptedTokens,
+    };
+    const jsize count = (jsize)(sizeof(values) / sizeof(values[0]));
+    
+    jdoubleArray array = env->NewDoubleArray(count);
+    if (array == nullptr) {
+        return nullptr;  // OutOfMemoryError pending
+    }
+    env->SetDoubleArrayRegion(array, 0, count, values);
+    return array;
+}
+
+/**
+ * Result layout: texts.length vectors of equal dimension, back to back
+ */
+JNIEXPORT jfloatArray JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeEmbed(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jobjectArray texts,
+    jint pooling,
+    jboolean normalize) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return nullptr;
+    }
+    
+    const jsize count = env->GetArrayLength(texts);
+    std::vector<std::string> inputs;
+    inputs.reserve(count);
+    for (jsize i = 0; i < count; i++) {
+        jstring text = (jstring)env->GetObjectArrayElement(texts, i);
+        inputs.push_back(jstringToString(env, text));
+        if (text != nullptr) env->DeleteLocalRef(text);
+    }
+    
+    std::vector<float> vectors;
+    if (context->embed(inputs, pooling, normalize == JNI_TRUE, vectors) == 0) {
+        std::string error = context->getLastError();
+        LOGE("Embedding error: %s", error.c_str());
+        throwGenerationError(env, error.c_str());
+        return nullptr;
+    }
+    
+    // One bulk copy into the Java array
+    jfloatArray array = env->NewFloatArray((jsize)vectors.size());
+    if (array == nullptr) {
+        return nullptr;  // OutOfMemoryError pending
+    }
+    env->SetFloatArrayRegion(array, 0, (jsize)vectors.size(), vectors.data());
+    return array;
+}
+
+JNIEXPORT void JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeTrimMemory(
+    JNIEnv* /* env */,
+    jclass /* clazz */,
+    jlong handle,
+    jint level) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context != nullptr) {
+        context->trimMemory(level);
+    }
+}
+
+JNIEXPORT jobject JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativePlanLoad(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jstring modelPath,
+    jobject config) {
+    
+    LoadPlan plan;
+    std::string error;
+    if (!LlamaContextWrapper::planLoad(jstringToString(env, modelPath), configFromJava(env, config), plan, error)) {
+        throwException(env, "java/lang/IllegalArgumentException", error.c_str());
+        return nullptr;
+    }
+    return env->NewObject(g_jni.loadPlanClass, g_jni.loadPlanInit,
+                          (jlong)plan.weightBytes, (jlong)plan.kvCacheBytes, (jlong)plan.computeBytes,
+                          (jlong)plan.availableBytes, (jint)plan.layerCount, (jint)plan.contextLength,
+                          (jint)plan.gpuLayers);
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeEstimateKvCacheBytes(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jobject config) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    
+    return (jlong)context->estimateKvCacheBytes(configFromJava(env, config));
+}
+
+// ============================================================================
+// Chat Template Support
+// ============================================================================
+
+JNIEXPORT jstring JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeApplyChatTemplate(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring messagesJson,
+    jboolean addGenerationPrompt) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle - context was destroyed");
+        return nullptr;
+    }
+    
+    // Check if model is still loaded before using it
+    if (!context->isModelLoaded()) {
+        LOGW("applyChatTemplate called but model is not loaded");
+        throwException(env, "java/lang/IllegalStateException", "Model is not loaded. The model may have been unloaded or freed.");
+        return nullptr;
+    }
+    
+    std::string jsonStr = jstringToString(env, messagesJson);
+    bool addPrompt = (addGenerationPrompt == JNI_TRUE);
+    
+    std::string result = context->applyChatTemplate(jsonStr, addPrompt);
+    
+    if (result.empty() && !context->getLastError().empty()) {
+        throwGenerationError(env, context->getLastError().c_str());
+        return nullptr;
+    }
+    
+    return stringToJstring(env, result);
+}
+
+JNIEXPORT jstring JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetChatTemplate(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle - context was destroyed");
+        return nullptr;
+    }
+    
+    // Check if model is still loaded
+    if (!context->isModelLoaded()) {
+        LOGW("getChatTemplate called but model is not loaded");
+        throwException(env, "java/lang/IllegalStateException", "Model is not loaded. The model may have been unloaded or freed.");
+        return nullptr;
+    }
+    
+    return stringToJstring(env, context->getChatTemplate());
+}
+
+// ============================================================================
+// State Snapshots
+// ============================================================================
+
+JNIEXPORT jboolean JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeSaveState(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring path) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return JNI_FALSE;
+    }
+    
+    return context->saveState(jstringToString(env, path)) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeRestoreState(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jstring path) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return JNI_FALSE;
+    }
+    
+    return context->restoreState(jstringToString(env, path)) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeGetStateSize(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    
+    return (jlong)context->getStateSize();
+}
+
+JNIEXPORT jlong JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeSaveStateToBuffer(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jobject buffer) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return 0;
+    }
+    
+    // Direct buffers let llama.cpp serialize straight into Java-visible memory
+    auto* dst = static_cast<uint8_t*>(env->GetDirectBufferAddress(buffer));
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (dst == nullptr || capacity <= 0) {
+        throwException(env, "java/lang/IllegalArgumentException", "State buffer must be a direct ByteBuffer");
+        return 0;
+    }
+    
+    return (jlong)context->saveStateToBuffer(dst, (size_t)capacity);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_codeshipping_llamakotlin_LlamaNative_nativeRestoreStateFromBuffer(
+    JNIEnv* env,
+    jclass /* clazz */,
+    jlong handle,
+    jobject buffer,
+    jlong length) {
+    
+    LlamaContextWrapper* context = getContext(handle);
+    if (context == nullptr) {
+        throwException(env, "java/lang/IllegalStateException", "Invalid context handle");
+        return JNI_FALSE;
+    }
+    
+    auto* src = static_cast<const uint8_t*>(env->GetDirectBufferAddress(buffer));
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    if (src == nullptr || length < 0 || length > capacity) {
+        throwException(env, "java/lang/IllegalArgumentException", "State buffer must be a direct ByteBuffer");
+        return JNI_FALSE;
+    }
+    
+    return context->restoreStateFromBuffer(src, (size_t)length) ? JNI_TRUE : JNI_FALSE;
 }
 
 // ============================================================================
@@ -0,0 +1,26 @@
+#include "memory_info.h"
+
+#include <cstdio>
+
+namespace llamaandroid {
+
+MemoryInfo MemoryInfo::read() {
+    MemoryInfo info;
+    FILE* f = fopen("/proc/meminfo", "r");
+    if (f == nullptr) {
+        return info;
+    }
+    char line[128];
+    unsigned long kb = 0;
+    while (fgets(line, sizeof(line), f) != nullptr) {
+        if (sscanf(line, "MemTotal: %lu kB", &kb) == 1) {
+            info.totalBytes = (size_t)kb * 1024;
+        } else if (sscanf(line, "MemAvailable: %lu kB", &kb) == 1) {
+            info.availableBytes = (size_t)kb * 1024;
+        }
+    }
+    fclose(f);
+    return info;
+}
+
+} // namespace llamaandroid
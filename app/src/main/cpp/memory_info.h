@@ -0,0 +1,38 @@
+#ifndef LLAMA_MEMORY_INFO_H
+#define LLAMA_MEMORY_INFO_H
+
+#include <cstddef>
+
+namespace llamaandroid {
+
+/**
+ * System memory from /proc/meminfo (the same numbers ActivityManager.MemoryInfo reports)
+ */
+struct MemoryInfo {
+    size_t availableBytes = 0;  // MemAvailable: free plus reclaimable page cache
+    size_t totalBytes = 0;      // MemTotal
+
+    bool isKnown() const { return totalBytes > 0; }
+
+    /**
+     * Read the current values; both are 0 if /proc/meminfo is unreadable
+     */
+    static MemoryInfo read();
+};
+
+/**
+ * Levels passed to ComponentCallbacks2.onTrimMemory
+ */
+enum TrimLevel {
+    TRIM_MEMORY_RUNNING_MODERATE = 5,
+    TRIM_MEMORY_RUNNING_LOW = 10,
+    TRIM_MEMORY_RUNNING_CRITICAL = 15,
+    TRIM_MEMORY_UI_HIDDEN = 20,
+    TRIM_MEMORY_BACKGROUND = 40,
+    TRIM_MEMORY_MODERATE = 60,
+    TRIM_MEMORY_COMPLETE = 80
+};
+
+} // namespace llamaandroid
+
+#endif // LLAMA_MEMORY_INFO_H
@@ -0,0 +1,105 @@
+#include "model_footprint.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if LLAMA_AVAILABLE
+#include "gguf.h"
+#endif
+
+namespace llamaandroid {
+
+size_t computeBytesPerToken(size_t nVocab, int nEmbd, int nHead, int contextSize, bool flashAttention) {
+    const size_t scores = flashAttention ? 0 : (size_t)contextSize * nHead;
+    return sizeof(float) * (nVocab + scores + 16 * (size_t)nEmbd);
+}
+
+#if LLAMA_AVAILABLE
+namespace {
+// Integer metadata value; per-layer arrays (e.g. head_count_kv of hybrid models) give their maximum
+int64_t metaInt(const gguf_context* ctx, const std::string& key, int64_t fallback) {
+    const int64_t id = gguf_find_key(ctx, key.c_str());
+    if (id < 0) {
+        return fallback;
+    }
+    switch (gguf_get_kv_type(ctx, id)) {
+        case GGUF_TYPE_UINT32: return gguf_get_val_u32(ctx, id);
+        case GGUF_TYPE_INT32:  return gguf_get_val_i32(ctx, id);
+        case GGUF_TYPE_UINT64: return (int64_t)gguf_get_val_u64(ctx, id);
+        case GGUF_TYPE_ARRAY: {
+            const gguf_type type = gguf_get_arr_type(ctx, id);
+            if (type != GGUF_TYPE_UINT32 && type != GGUF_TYPE_INT32) {
+                return fallback;
+            }
+            const size_t n = gguf_get_arr_n(ctx, id);
+            const void* data = gguf_get_arr_data(ctx, id);
+            int64_t result = n > 0 ? 0 : fallback;
+            for (size_t i = 0; i < n; i++) {
+                const int64_t value = (type == GGUF_TYPE_UINT32) ? ((const uint32_t*)data)[i] : ((const int32_t*)data)[i];
+                result = std::max(result, value);
+            }
+            return result;
+        }
+        default:
+            return fallback;
+    }
+}
+} // namespace
+
+bool readModelFootprint(const std::string& path, ModelFootprint& footprint, std::string& error) {
+    // no_alloc: parse the header and tensor table, leave the data on disk
+    gguf_init_params params = {true, nullptr};
+    gguf_context* ctx = gguf_init_from_file(path.c_str(), params);
+    if (ctx == nullptr) {
+        error = "Not a readable GGUF file: " + path;
+        return false;
+    }
+
+    const int64_t archKey = gguf_find_key(ctx, "general.architecture");
+    if (archKey < 0 || gguf_get_kv_type(ctx, archKey) != GGUF_TYPE_STRING) {
+        gguf_free(ctx);
+        error = "GGUF file has no architecture: " + path;
+        return false;
+    }
+    const std::string arch = std::string(gguf_get_val_str(ctx, archKey)) + ".";
+
+    // Same dimensions as kvCacheShape() reads from a loaded model
+    footprint = ModelFootprint();
+    footprint.nEmbd = (int)metaInt(ctx, arch + "embedding_length", 0);
+    footprint.nHead = (int)metaInt(ctx, arch + "attention.head_count", 0);
+    footprint.contextLength = (int)metaInt(ctx, arch + "context_length", 0);
+    const int headDim = footprint.nHead > 0 ? footprint.nEmbd / footprint.nHead : 0;
+    footprint.shape.nLayer = (int)metaInt(ctx, arch + "block_count", 0);
+    footprint.shape.nHeadKv = (int)metaInt(ctx, arch + "attention.head_count_kv", footprint.nHead);
+    footprint.shape.headDimK = (int)metaInt(ctx, arch + "attention.key_length", headDim);
+    footprint.shape.headDimV = (int)metaInt(ctx, arch + "attention.value_length", headDim);
+
+    const int64_t tokensKey = gguf_find_key(ctx, "tokenizer.ggml.tokens");
+    footprint.nVocab = tokensKey >= 0 ? gguf_get_arr_n(ctx, tokensKey) : (size_t)metaInt(ctx, arch + "vocab_size", 0);
+
+    footprint.layerBytes.assign(std::max(0, footprint.shape.nLayer), 0);
+    for (int64_t i = 0; i < gguf_get_n_tensors(ctx); i++) {
+        const size_t size = gguf_get_tensor_size(ctx, i);
+        footprint.weightBytes += size;
+
+        const char* name = gguf_get_tensor_name(ctx, i);
+        if (strncmp(name, "blk.", 4) == 0) {
+            const long layer = strtol(name + 4, nullptr, 10);
+            if (layer >= 0 && (size_t)layer < footprint.layerBytes.size()) {
+                footprint.layerBytes[layer] += size;
+            }
+        }
+    }
+    gguf_free(ctx);
+
+    if (footprint.shape.nLayer <= 0 || footprint.nEmbd <= 0) {
+        error = "GGUF file has no model dimensions: " + path;
+        return false;
+    }
+    return true;
+}
+#endif
+
+} // namespace llamaandroid
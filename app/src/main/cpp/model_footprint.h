@@ -0,0 +1,41 @@
+#ifndef LLAMA_MODEL_FOOTPRINT_H
+#define LLAMA_MODEL_FOOTPRINT_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#include "kv_cache.h"
+
+namespace llamaandroid {
+
+/**
+ * Dimensions and tensor sizes of a GGUF model, read from its header without loading weights
+ */
+struct ModelFootprint {
+    KvCacheShape shape;
+    int nEmbd = 0;
+    int nHead = 0;
+    int contextLength = 0;          // Context length the model was trained with
+    size_t nVocab = 0;
+    size_t weightBytes = 0;         // All tensors
+    std::vector<size_t> layerBytes; // Tensors of each repeating block ("blk.N."), the part gpuLayers offloads
+};
+
+/**
+ * Worst-case compute buffer bytes per micro-batch token: the logits, the attention scores
+ * (not materialized with flash attention) and the layer activations
+ */
+size_t computeBytesPerToken(size_t nVocab, int nEmbd, int nHead, int contextSize, bool flashAttention);
+
+#if LLAMA_AVAILABLE
+/**
+ * Read the metadata and tensor table of a GGUF file; only the header is read
+ * @return false if the file is not a readable GGUF model, with error set
+ */
+bool readModelFootprint(const std::string& path, ModelFootprint& footprint, std::string& error);
+#endif
+
+} // namespace llamaandroid
+
+#endif // LLAMA_MODEL_FOOTPRINT_H
@@ -0,0 +1,96 @@
+#include "model_registry.h"
+#include "backend_loader.h"
+
+#include <android/log.h>
+#include <sys/stat.h>
+
+#define LOG_TAG "LlamaModels"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+
+namespace llamaandroid {
+
+void initBackend() {
+#if LLAMA_AVAILABLE
+    static std::once_flag once;
+    std::call_once(once, [] {
+        llama_backend_init();
+        loadBackends();
+        LOGI("llama.cpp backend initialized");
+    });
+#endif
+}
+
+#if LLAMA_AVAILABLE
+namespace {
+// The file (device + inode, so /proc/self/fd paths and a file replaced by a new download resolve
+// correctly) and everything in llama_model_params that changes the weights or where they are placed
+std::string modelKey(const std::string& path, const llama_model_params& params) {
+    struct stat st;
+    std::string key = stat(path.c_str(), &st) == 0
+        ? std::to_string((unsigned long long)st.st_dev) + ":" + std::to_string((unsigned long long)st.st_ino)
+        : path;
+    key += "|gpu=" + std::to_string(params.n_gpu_layers);
+    key += params.use_mmap ? "|mmap" : "";
+    key += params.use_mlock ? "|mlock" : "";
+    if (params.devices != nullptr) {
+        for (ggml_backend_dev_t* dev = params.devices; *dev != nullptr; dev++) {
+            key += "|";
+            key += ggml_backend_dev_name(*dev);
+        }
+    }
+    return key;
+}
+} // namespace
+
+ModelRegistry& ModelRegistry::get() {
+    // Never destroyed, so models released during static destruction still find it
+    static ModelRegistry* registry = new ModelRegistry();
+    return *registry;
+}
+
+std::shared_ptr<llama_model> ModelRegistry::acquire(const std::string& path, const llama_model_params& params) {
+    const std::string key = modelKey(path, params);
+
+    // Loading under the lock keeps two wrappers from mapping the same file twice
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = models_.find(key);
+    if (it != models_.end()) {
+        if (std::shared_ptr<llama_model> model = it->second.lock()) {
+            LOGI("Sharing loaded model %s (%ld references)", path.c_str(), model.use_count());
+            return model;
+        }
+    }
+
+    llama_model* raw = llama_model_load_from_file(path.c_str(), params);
+    if (raw == nullptr) {
+        return nullptr;
+    }
+    std::shared_ptr<llama_model> model(raw, [this, key](llama_model* m) { release(key, m); });
+    models_[key] = model;
+    return model;
+}
+
+size_t ModelRegistry::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t n = 0;
+    for (const auto& entry : models_) {
+        n += entry.second.expired() ? 0 : 1;
+    }
+    return n;
+}
+
+void ModelRegistry::release(const std::string& key, llama_model* model) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = models_.find(key);
+        // A reload of the same key may already have replaced the entry
+        if (it != models_.end() && it->second.expired()) {
+            models_.erase(it);
+        }
+    }
+    llama_model_free(model);
+    LOGI("Model freed, last reference released");
+}
+#endif
+
+} // namespace llamaandroid
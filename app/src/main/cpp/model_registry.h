@@ -0,0 +1,59 @@
+#ifndef LLAMA_MODEL_REGISTRY_H
+#define LLAMA_MODEL_REGISTRY_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstddef>
+
+#if LLAMA_AVAILABLE
+#include "llama.h"
+#endif
+
+namespace llamaandroid {
+
+/**
+ * Initialize llama.cpp and register the ggml backends once per process.
+ * Never torn down: llama_backend_free() would pull the backend out from under
+ * contexts owned by other wrappers.
+ */
+void initBackend();
+
+#if LLAMA_AVAILABLE
+/**
+ * Process-wide cache of loaded models, keyed by file identity and the parameters that
+ * decide where the weights live (GPU layers, devices, mmap/mlock).
+ *
+ * Wrappers that load the same file share one read-only llama_model - the weights are
+ * mapped once - while each keeps its own context, KV cache and sampler. The model is
+ * freed when the last reference goes away.
+ */
+class ModelRegistry {
+public:
+    static ModelRegistry& get();
+
+    /**
+     * Get the model for path/params, loading it if no wrapper holds it yet
+     * @return Shared model, or nullptr if loading failed
+     */
+    std::shared_ptr<llama_model> acquire(const std::string& path, const llama_model_params& params);
+
+    /**
+     * Number of distinct models currently loaded
+     */
+    size_t size();
+
+private:
+    ModelRegistry() = default;
+
+    void release(const std::string& key, llama_model* model);
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::weak_ptr<llama_model>> models_;
+};
+#endif
+
+} // namespace llamaandroid
+
+#endif // LLAMA_MODEL_REGISTRY_H
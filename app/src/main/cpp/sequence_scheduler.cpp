@@ -0,0 +1,291 @@
+#include "sequence_scheduler.h"
+#include "trace.h"
+
+#if LLAMA_AVAILABLE
+
+#include <android/log.h>
+#include <algorithm>
+
+#define LOG_TAG "LlamaScheduler"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#ifdef NDEBUG
+#define LOGD(...) ((void)0)
+#else
+#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
+#endif
+
+namespace llamaandroid {
+
+// ============================================================================
+// SequenceRequest
+// ============================================================================
+
+SequenceRequest::~SequenceRequest() {
+    if (sampler != nullptr) {
+        llama_sampler_free(sampler);
+        sampler = nullptr;
+    }
+}
+
+void SequenceRequest::push(llama_token token, std::string piece) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tokens_.push_back(token);
+        pieces_.push_back(std::move(piece));
+    }
+    cv_.notify_one();
+}
+
+void SequenceRequest::finish(const std::string& error) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finished_ = true;
+        error_ = error;
+    }
+    cv_.notify_one();
+}
+
+std::string SequenceRequest::drain(const std::function<void(const std::string&)>& callback) {
+    std::deque<std::string> ready;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return finished_ || !pieces_.empty(); });
+            ready.swap(pieces_);
+            if (ready.empty() && finished_) {
+                return error_;
+            }
+        }
+
+        // Invoke callbacks without holding the lock so the scheduler never waits on the caller
+        for (const std::string& piece : ready) {
+            callback(piece);
+        }
+        ready.clear();
+    }
+}
+
+std::vector<llama_token> SequenceRequest::sampledTokens() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return tokens_;
+}
+
+// ============================================================================
+// SequenceScheduler
+// ============================================================================
+
+SequenceScheduler::SequenceScheduler(llama_context* ctx, int nSeqMax, const std::atomic<uint32_t>* cancelEpoch)
+    : ctx_(ctx),
+      vocab_(llama_model_get_vocab(llama_get_model(ctx))),
+      nSeqMax_(nSeqMax),
+      nCtxSeq_((int)llama_n_ctx(ctx) / std::max(1, nSeqMax)),
+      nBatch_((int)llama_n_batch(ctx)),
+      cancelEpoch_(cancelEpoch),
+      slotUsed_(nSeqMax, false) {
+    batch_ = llama_batch_init(nBatch_, 0, 1);
+    worker_ = std::thread(&SequenceScheduler::run, this);
+    LOGI("Scheduler started: %d sequences, %d context tokens each, batch %d", nSeqMax_, nCtxSeq_, nBatch_);
+}
+
+SequenceScheduler::~SequenceScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+
+    // Fail anything that never got to run
+    for (auto& request : pending_) {
+        request->finish("Model unloaded");
+    }
+    pending_.clear();
+
+    llama_batch_free(batch_);
+    LOGI("Scheduler stopped");
+}
+
+void SequenceScheduler::submit(std::shared_ptr<SequenceRequest> request) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back(std::move(request));
+    }
+    cv_.notify_one();
+}
+
+void SequenceScheduler::run() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stop_ || !pending_.empty() || !active_.empty(); });
+            if (stop_) {
+                break;
+            }
+
+            // Admit waiting requests into free sequence slots
+            while (!pending_.empty() && (int)active_.size() < nSeqMax_) {
+                admit(pending_.front());
+                pending_.pop_front();
+            }
+        }
+
+        step();
+    }
+
+    for (auto& request : active_) {
+        release(request, "Model unloaded");
+    }
+    active_.clear();
+}
+
+void SequenceScheduler::admit(const std::shared_ptr<SequenceRequest>& request) {
+    for (int slot = 0; slot < nSeqMax_; slot++) {
+        if (!slotUsed_[slot]) {
+            slotUsed_[slot] = true;
+            request->seqId = slot;
+            break;
+        }
+    }
+
+    // Start from an empty sequence
+    llama_memory_seq_rm(llama_get_memory(ctx_), request->seqId, -1, -1);
+    active_.push_back(request);
+    LOGD("Admitted request on seq %d (%zu prompt tokens)", request->seqId, request->prompt.size());
+}
+
+void SequenceScheduler::release(const std::shared_ptr<SequenceRequest>& request, const std::string& error) {
+    if (request->seqId >= 0) {
+        llama_memory_seq_rm(llama_get_memory(ctx_), request->seqId, -1, -1);
+        slotUsed_[request->seqId] = false;
+        LOGD("Released seq %d after %d tokens", request->seqId, request->nGenerated);
+        request->seqId = -1;
+    }
+    request->finish(error);
+}
+
+void SequenceScheduler::step() {
+    const uint32_t epoch = cancelEpoch_->load();
+
+    // Drop cancelled requests before building the batch
+    active_.erase(std::remove_if(active_.begin(), active_.end(), [&](const std::shared_ptr<SequenceRequest>& request) {
+        if (request->cancelEpoch != epoch) {
+            release(request, "");
+            return true;
+        }
+        return false;
+    }), active_.end());
+
+    if (active_.empty()) {
+        return;
+    }
+
+    batch_.n_tokens = 0;
+    auto addToken = [this](llama_token token, llama_pos pos, llama_seq_id seq, bool logits) {
+        const int i = batch_.n_tokens++;
+        batch_.token[i] = token;
+        batch_.pos[i] = pos;
+        batch_.n_seq_id[i] = 1;
+        batch_.seq_id[i][0] = seq;
+        batch_.logits[i] = logits;
+        return i;
+    };
+
+    // 1. One token for every sequence that is already generating
+    std::vector<int> chunkSizes(active_.size(), 0);
+    for (size_t r = 0; r < active_.size(); r++) {
+        auto& request = active_[r];
+        request->logitsIndex = -1;
+        if (request->nPrefilled == request->prompt.size() && request->nextToken >= 0) {
+            request->logitsIndex = addToken(request->nextToken, request->nPast, request->seqId, true);
+            chunkSizes[r] = 1;
+        }
+    }
+
+    // 2. Fill the rest of the batch with prompt chunks, oldest request first
+    for (size_t r = 0; r < active_.size() && batch_.n_tokens < nBatch_; r++) {
+        auto& request = active_[r];
+        const size_t remaining = request->prompt.size() - request->nPrefilled;
+        if (remaining == 0) {
+            continue;
+        }
+
+        const size_t chunk = std::min(remaining, (size_t)(nBatch_ - batch_.n_tokens));
+        for (size_t i = 0; i < chunk; i++) {
+            const size_t idx = request->nPrefilled + i;
+            const bool last = (idx == request->prompt.size() - 1);
+            int batchIdx = addToken(request->prompt[idx], request->nPast + (llama_pos)i, request->seqId, last);
+            if (last) {
+                request->logitsIndex = batchIdx;
+            }
+        }
+        chunkSizes[r] = (int)chunk;
+    }
+
+    if (batch_.n_tokens == 0) {
+        return;
+    }
+
+    int rc;
+    {
+        LLAMA_TRACE_SCOPE("llama:decode_batch");
+        rc = llama_decode(ctx_, batch_);
+    }
+    if (rc != 0) {
+        LOGE("Batched decode failed (%d) for %d tokens across %zu sequences", rc, batch_.n_tokens, active_.size());
+        for (auto& request : active_) {
+            release(request, rc == 1 ? "KV cache is full" : "Failed to decode batch");
+        }
+        active_.clear();
+        return;
+    }
+
+    // Advance positions and sample every sequence that produced logits
+    for (size_t r = 0; r < active_.size(); r++) {
+        auto& request = active_[r];
+        if (request->nPrefilled < request->prompt.size()) {
+            request->nPrefilled += chunkSizes[r];
+        }
+        request->nPast += chunkSizes[r];
+    }
+
+    active_.erase(std::remove_if(active_.begin(), active_.end(), [&](const std::shared_ptr<SequenceRequest>& request) {
+        if (request->logitsIndex < 0) {
+            return false;  // Still prefilling
+        }
+
+        llama_token token = llama_sampler_sample(request->sampler, ctx_, request->logitsIndex);
+        if (token < 0 || llama_vocab_is_eog(vocab_, token)) {
+            release(request, "");
+            return true;
+        }
+
+        request->push(token, tokenToPiece(token));
+        request->nextToken = token;
+        request->nGenerated++;
+
+        if (request->nGenerated >= request->maxTokens || request->nPast + 1 >= nCtxSeq_) {
+            release(request, "");
+            return true;
+        }
+        return false;
+    }), active_.end());
+}
+
+std::string SequenceScheduler::tokenToPiece(llama_token token) const {
+    char buf[256];
+    int n = llama_token_to_piece(vocab_, token, buf, sizeof(buf), 0, true);
+    if (n < 0) {
+        LOGW("Failed to detokenize token: %d", token);
+        return "";
+    }
+    return std::string(buf, n);
+}
+
+} // namespace llamaandroid
+
+#endif // LLAMA_AVAILABLE
@@ -0,0 +1,129 @@
+#ifndef LLAMA_SEQUENCE_SCHEDULER_H
+#define LLAMA_SEQUENCE_SCHEDULER_H
+
+#if LLAMA_AVAILABLE
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include "llama.h"
+
+namespace llamaandroid {
+
+/**
+ * A single generation request running on its own sequence id.
+ * Created by the caller thread, decoded by the scheduler thread; generated
+ * pieces are handed back through a queue so callbacks run on the caller thread.
+ */
+struct SequenceRequest {
+    // Input (set before submit, read-only afterwards)
+    std::vector<llama_token> prompt;
+    llama_sampler* sampler = nullptr;  // Owned - freed with the request
+    int maxTokens = 512;
+    uint32_t cancelEpoch = 0;          // Cancel epoch at submit time
+
+    // Scheduler state (scheduler thread only)
+    llama_seq_id seqId = -1;
+    size_t nPrefilled = 0;
+    llama_pos nPast = 0;
+    llama_token nextToken = -1;
+    int nGenerated = 0;
+    int32_t logitsIndex = -1;
+
+    SequenceRequest() = default;
+    ~SequenceRequest();
+    SequenceRequest(const SequenceRequest&) = delete;
+    SequenceRequest& operator=(const SequenceRequest&) = delete;
+
+    /**
+     * Queue a generated token's piece for the caller and record the token
+     */
+    void push(llama_token token, std::string piece);
+
+    /**
+     * Mark the request as done
+     * @param error Error message, empty on success
+     */
+    void finish(const std::string& error = "");
+
+    /**
+     * Block the caller thread, invoking the callback for each piece until the request finishes
+     * @return Error message, empty on success
+     */
+    std::string drain(const std::function<void(const std::string&)>& callback);
+
+    /**
+     * Every token sampled so far, in order (complete once drain() returned)
+     */
+    std::vector<llama_token> sampledTokens();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::string> pieces_;
+    std::vector<llama_token> tokens_;
+    bool finished_ = false;
+    std::string error_;
+};
+
+/**
+ * Continuous batching scheduler.
+ * Owns a worker thread that packs the next token of every active sequence
+ * (plus prompt chunks of newly admitted ones) into one llama_batch per step.
+ * The llama_context must have been created with n_seq_max >= nSeqMax.
+ */
+class SequenceScheduler {
+public:
+    SequenceScheduler(llama_context* ctx, int nSeqMax, const std::atomic<uint32_t>* cancelEpoch);
+    ~SequenceScheduler();
+
+    SequenceScheduler(const SequenceScheduler&) = delete;
+    SequenceScheduler& operator=(const SequenceScheduler&) = delete;
+
+    /**
+     * Queue a request; it is admitted as soon as a sequence slot is free
+     */
+    void submit(std::shared_ptr<SequenceRequest> request);
+
+    /**
+     * Context length available to each sequence
+     */
+    int contextPerSequence() const { return nCtxSeq_; }
+
+private:
+    llama_context* ctx_;
+    const llama_vocab* vocab_;
+    const int nSeqMax_;
+    const int nCtxSeq_;
+    const int nBatch_;
+    const std::atomic<uint32_t>* cancelEpoch_;
+
+    llama_batch batch_;
+    std::vector<bool> slotUsed_;
+    std::vector<std::shared_ptr<SequenceRequest>> active_;  // Worker thread only
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<SequenceRequest>> pending_;
+    bool stop_ = false;
+    std::thread worker_;
+
+    void run();
+    void step();
+    void admit(const std::shared_ptr<SequenceRequest>& request);
+    void release(const std::shared_ptr<SequenceRequest>& request, const std::string& error);
+    std::string tokenToPiece(llama_token token) const;
+};
+
+} // namespace llamaandroid
+
+#endif // LLAMA_AVAILABLE
+
+#endif // LLAMA_SEQUENCE_SCHEDULER_H
@@ -0,0 +1,53 @@
+#ifndef LLAMA_TRACE_H
+#define LLAMA_TRACE_H
+
+/**
+ * Trace spans for the native hot path, shown in Perfetto / systrace next to the app's own
+ * frames (record with app tracing enabled for the package, e.g. `-a <package>`).
+ *
+ * Compiled in only with LLAMA_ANDROID_TRACING=ON (Gradle property llama.tracing); otherwise
+ * LLAMA_TRACE_SCOPE expands to nothing. When compiled in but no trace is being recorded,
+ * a span costs one ATrace_isEnabled() check.
+ */
+#if LLAMA_TRACING
+
+#include <android/trace.h>
+
+namespace llamaandroid {
+
+class ScopedTrace {
+public:
+    explicit ScopedTrace(const char* name) : active_(ATrace_isEnabled()) {
+        if (active_) {
+            ATrace_beginSection(name);
+        }
+    }
+
+    ~ScopedTrace() {
+        if (active_) {
+            ATrace_endSection();
+        }
+    }
+
+    ScopedTrace(const ScopedTrace&) = delete;
+    ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+private:
+    const bool active_;
+};
+
+} // namespace llamaandroid
+
+#define LLAMA_TRACE_CONCAT_(a, b) a##b
+#define LLAMA_TRACE_CONCAT(a, b) LLAMA_TRACE_CONCAT_(a, b)
+
+// Span from here to the end of the enclosing scope; name must be a string literal
+#define LLAMA_TRACE_SCOPE(name) ::llamaandroid::ScopedTrace LLAMA_TRACE_CONCAT(llamaTrace_, __LINE__)(name)
+
+#else
+
+#define LLAMA_TRACE_SCOPE(name) ((void)0)
+
+#endif // LLAMA_TRACING
+
+#endif // LLAMA_TRACE_H
@@ -0,0 +1,75 @@
+#include "utf8_stream.h"
+
+#include <algorithm>
+
+namespace llamaandroid {
+
+namespace {
+// Sequence length announced by a lead byte, 0 for continuation bytes and invalid leads
+size_t sequenceLength(unsigned char c) {
+    if (c < 0x80) return 1;
+    if ((c & 0xE0) == 0xC0) return 2;
+    if ((c & 0xF0) == 0xE0) return 3;
+    if ((c & 0xF8) == 0xF0) return 4;
+    return 0;
+}
+
+bool isContinuation(unsigned char c) {
+    return (c & 0xC0) == 0x80;
+}
+} // namespace
+
+void Utf8StreamDecoder::push(const std::string& piece, std::string& out) {
+    out.clear();
+    tail_.append(piece);
+
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(tail_.data());
+    const size_t len = tail_.size();
+    size_t i = 0;
+
+    while (i < len) {
+        const unsigned char c = data[i];
+        const size_t need = sequenceLength(c);
+        if (need == 0) {
+            out.push_back('?');
+            i++;
+            continue;
+        }
+        if (c == 0) {
+            // NUL would end the C string handed to NewStringUTF
+            i++;
+            continue;
+        }
+
+        // Validate the continuation bytes that are already here
+        const size_t available = std::min(need, len - i);
+        size_t valid = 1;
+        while (valid < available && isContinuation(data[i + valid])) {
+            valid++;
+        }
+        if (valid < available) {
+            out.push_back('?');
+            i++;
+            continue;
+        }
+        if (available < need) {
+            // Incomplete character at the end - wait for the next piece
+            break;
+        }
+
+        out.append(tail_, i, need);
+        i += need;
+    }
+
+    tail_.erase(0, i);
+}
+
+void Utf8StreamDecoder::flush(std::string& out) {
+    out.clear();
+    if (!tail_.empty()) {
+        out.push_back('?');
+        tail_.clear();
+    }
+}
+
+} // namespace llamaandroid
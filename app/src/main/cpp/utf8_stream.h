@@ -0,0 +1,39 @@
+#ifndef LLAMA_UTF8_STREAM_H
+#define LLAMA_UTF8_STREAM_H
+
+#include <string>
+
+namespace llamaandroid {
+
+/**
+ * Incremental UTF-8 decoder for streamed token pieces.
+ * A multi-byte character (CJK, emoji) is often split across tokens; the incomplete tail
+ * of one piece is held back until the next piece completes it, so only whole, valid code
+ * points are emitted. Invalid bytes become '?' and NUL bytes are dropped, so the output
+ * can go straight to NewStringUTF without another validation pass.
+ */
+class Utf8StreamDecoder {
+public:
+    Utf8StreamDecoder() { tail_.reserve(64); }
+
+    /**
+     * Decode the next piece
+     * @param piece Raw token text
+     * @param out Receives the complete characters (contents replaced, capacity reused; may be empty)
+     */
+    void push(const std::string& piece, std::string& out);
+
+    /**
+     * End of stream: emit a held-back incomplete character as '?' and reset
+     */
+    void flush(std::string& out);
+
+    void reset() { tail_.clear(); }
+
+private:
+    std::string tail_;  // Undecoded bytes: an incomplete sequence from the previous piece plus the new piece
+};
+
+} // namespace llamaandroid
+
+#endif // LLAMA_UTF8_STREAM_H
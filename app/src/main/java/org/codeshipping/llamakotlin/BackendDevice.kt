@@ -0,0 +1,45 @@
+package org.codeshipping.llamakotlin
+
+import androidx.annotation.Keep
+
+/**
+ * A compute device available to llama.cpp, see [LlamaModel.getBackendDevices].
+ *
+ * @property name Device name, usable as [LlamaConfig.gpuDevice]
+ * @property description Human readable description (e.g. the GPU model)
+ * @property backend ggml backend providing the device ("CPU", "Vulkan", "OpenCL", ...)
+ * @property type Kind of device
+ * @property memoryFree Free device memory in bytes (0 if unknown)
+ * @property memoryTotal Total device memory in bytes (0 if unknown)
+ */
+data class BackendDevice(
+    val name: String,
+    val description: String,
+    val backend: String,
+    val type: Type,
+    val memoryFree: Long,
+    val memoryTotal: Long
+) {
+    /**
+     * Device kinds, in the order of ggml_backend_dev_type.
+     */
+    enum class Type {
+        CPU,
+        GPU,
+        INTEGRATED_GPU,
+        ACCELERATOR
+    }
+
+    /**
+     * Called from native code.
+     */
+    @Keep
+    internal constructor(
+        name: String,
+        description: String,
+        backend: String,
+        type: Int,
+        memoryFree: Long,
+        memoryTotal: Long
+    ) : this(name, description, backend, Type.values().getOrElse(type) { Type.ACCELERATOR }, memoryFree, memoryTotal)
+}
@@ -0,0 +1,70 @@
+package org.codeshipping.llamakotlin
+
+/**
+ * Results of [LlamaModel.benchmark].
+ *
+ * @property prefill Prompt processing throughput per batch size
+ * @property decode Token generation throughput and latency per thread count
+ * @property timeToFirstTokenMs Prefill of the full prompt plus the first sampled token
+ * @property peakRssKb Peak resident memory of the process after the run (VmHWM)
+ */
+data class BenchmarkResult(
+    val prefill: List<Prefill>,
+    val decode: List<Decode>,
+    val timeToFirstTokenMs: Double,
+    val peakRssKb: Long
+) {
+    /**
+     * Prefill throughput at one batch size.
+     */
+    data class Prefill(
+        val batchSize: Int,
+        val tokensPerSecond: Double
+    )
+
+    /**
+     * Decode throughput and per-token latency at one thread count.
+     */
+    data class Decode(
+        val threads: Int,
+        val tokensPerSecond: Double,
+        val p50LatencyMs: Double,
+        val p99LatencyMs: Double
+    )
+
+    /** Highest prefill throughput across batch sizes */
+    val bestPrefillTokensPerSecond: Double
+        get() = prefill.maxOfOrNull { it.tokensPerSecond } ?: 0.0
+
+    /** Highest decode throughput across thread counts */
+    val bestDecodeTokensPerSecond: Double
+        get() = decode.maxOfOrNull { it.tokensPerSecond } ?: 0.0
+
+    /** Thread count with the highest decode throughput */
+    val bestDecodeThreads: Int?
+        get() = decode.maxByOrNull { it.tokensPerSecond }?.threads
+
+    internal companion object {
+        /**
+         * Decode the flat array returned by [LlamaNative.nativeBenchmark].
+         */
+        fun fromNative(values: DoubleArray): BenchmarkResult {
+            var i = 0
+            val ttft = values[i++]
+            val peakRss = values[i++].toLong()
+
+            val prefill = List(values[i++].toInt()) {
+                Prefill(batchSize = values[i++].toInt(), tokensPerSecond = values[i++])
+            }
+            val decode = List(values[i++].toInt()) {
+                Decode(
+                    threads = values[i++].toInt(),
+                    tokensPerSecond = values[i++],
+                    p50LatencyMs = values[i++],
+                    p99LatencyMs = values[i++]
+                )
+            }
+            return BenchmarkResult(prefill, decode, ttft, peakRss)
+        }
+    }
+}
@@ -0,0 +1,115 @@
+package org.codeshipping.llamakotlin
+
+import org.codeshipping.llamakotlin.exception.LlamaException
+import kotlinx.coroutines.flow.Flow
+import kotlinx.coroutines.flow.emitAll
+import kotlinx.coroutines.flow.flow
+import java.io.Closeable
+import java.util.concurrent.atomic.AtomicBoolean
+
+/**
+ * Multi-turn chat created by [LlamaModel.createConversation].
+ *
+ * The history lives in native memory as messages plus their tokens. Appending a message
+ * formats and tokenizes only that message, and [reply] records the model's answer from the
+ * generated tokens, so no turn re-parses, re-templates or re-tokenizes the history and the
+ * KV cache of the previous turn is reused.
+ *
+ * Example:
+ * ```kotlin
+ * val chat = model.createConversation("You are a concise assistant.")
+ * chat.appendUserMessage("What is the capital of France?")
+ * chat.reply().collect { print(it) }
+ * chat.appendUserMessage("And of Italy?")
+ * chat.reply().collect { print(it) }
+ * chat.close()
+ * ```
+ */
+class Conversation internal constructor(
+    private val model: LlamaModel,
+    private val conversationId: Int
+) : Closeable {
+
+    private val isClosed = AtomicBoolean(false)
+    private val isReplying = AtomicBoolean(false)
+
+    /**
+     * Tokens in the history, without the prompt for the next reply.
+     */
+    val tokenCount: Int
+        get() {
+            ensureNotClosed()
+            return model.conversationTokenCount(conversationId)
+        }
+
+    /**
+     * Append a user message.
+     * @return Number of tokens the message added to the history
+     */
+    fun appendUserMessage(content: String): Int = appendMessage("user", content)
+
+    /**
+     * Append a system message, usually once at the start.
+     * @return Number of tokens the message added to the history
+     */
+    fun appendSystemMessage(content: String): Int = appendMessage("system", content)
+
+    /**
+     * Append a message with any role the model's chat template knows, e.g. an assistant
+     * message written by the app or a "tool" result.
+     * @return Number of tokens the message added to the history
+     * @throws LlamaException.GenerationError if the template can't be applied
+     */
+    fun appendMessage(role: String, content: String): Int {
+        ensureNotClosed()
+        ensureNotReplying()
+        return model.appendConversationMessage(conversationId, role, content)
+    }
+
+    /**
+     * Generate the assistant's reply to the history and append it once generation ends
+     * (also when cut short by [LlamaConfig.maxTokens] or cancellation).
+     *
+     * When the history no longer fits the context, whole old turns are dropped from the
+     * prompt; the system message and the latest message are kept.
+     *
+     * @param configOverride Optional configuration override for this reply
+     * @param onPrefillProgress See [LlamaModel.generateStream]
+     * @return Flow of generated text
+     */
+    fun reply(
+        configOverride: LlamaConfig? = null,
+        onPrefillProgress: ((processed: Int, total: Int) -> Unit)? = null
+    ): Flow<String> = flow {
+        ensureNotClosed()
+        if (!isReplying.compareAndSet(false, true)) {
+            throw LlamaException.GenerationError("Conversation is already generating a reply")
+        }
+        try {
+            emitAll(model.conversationReply(conversationId, configOverride, onPrefillProgress))
+        } finally {
+            isReplying.set(false)
+        }
+    }
+
+    /**
+     * Free the native history. Also freed when the model is closed.
+     */
+    override fun close() {
+        if (isClosed.compareAndSet(false, true)) {
+            model.freeConversation(conversationId)
+        }
+    }
+
+    private fun ensureNotClosed() {
+        if (isClosed.get()) {
+            throw IllegalStateException("Conversation is closed")
+        }
+    }
+
+    private fun ensureNotReplying() {
+        if (isReplying.get()) {
+            throw LlamaException.GenerationError("Cannot append while a reply is being generated")
+        }
+    }
+}
@@ -0,0 +1,51 @@
+package org.codeshipping.llamakotlin
+
+import java.nio.FloatBuffer
+
+/**
+ * Embedding vectors returned by [LlamaModel.embed], stored back to back in one array.
+ *
+ * @property dimension Length of each vector
+ * @property data All vectors, vector i at `[i * dimension, (i + 1) * dimension)`
+ */
+class Embeddings internal constructor(
+    val dimension: Int,
+    val data: FloatArray
+) {
+    /** Number of vectors */
+    val size: Int
+        get() = if (dimension == 0) 0 else data.size / dimension
+
+    /**
+     * Copy of vector [index].
+     */
+    operator fun get(index: Int): FloatArray {
+        if (index < 0 || index >= size) {
+            throw IndexOutOfBoundsException("index $index, size $size")
+        }
+        return data.copyOfRange(index * dimension, (index + 1) * dimension)
+    }
+
+    /**
+     * View of vector [index] without copying.
+     */
+    fun buffer(index: Int): FloatBuffer {
+        if (index < 0 || index >= size) {
+            throw IndexOutOfBoundsException("index $index, size $size")
+        }
+        return FloatBuffer.wrap(data, index * dimension, dimension).slice()
+    }
+
+    /**
+     * Dot product of vectors [a] and [b] (cosine similarity when normalized).
+     */
+    fun dot(a: Int, b: Int): Float {
+        var sum = 0.0f
+        val offsetA = a * dimension
+        val offsetB = b * dimension
+        for (k in 0 until dimension) {
+            sum += data[offsetA + k] * data[offsetB + k]
+        }
+        return sum
+    }
+}
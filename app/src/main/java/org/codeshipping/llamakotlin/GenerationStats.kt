@@ -0,0 +1,52 @@
+package org.codeshipping.llamakotlin
+
+/**
+ * Timings and counters of a single generation, see [LlamaModel.lastGenerationStats].
+ *
+ * @property tokenizeMs Time spent tokenizing the prompt
+ * @property prefillMs Time spent decoding the part of the prompt not served from the KV cache
+ * @property timeToFirstTokenMs Request start until the first token was sampled
+ * @property decodeMs First sampled token until generation stopped
+ * @property tokensPerSecond Generated tokens per second of [decodeMs]
+ * @property promptTokens Prompt length in tokens after truncation
+ * @property reusedTokens Prompt tokens reused from the KV cache of the previous request
+ * @property generatedTokens Number of tokens emitted
+ * @property truncated Whether the prompt was truncated to fit the context
+ * @property batchCapacity Batch size actually allocated (may be reduced on low memory)
+ * @property draftedTokens Tokens proposed by the draft model (speculative decoding)
+ * @property acceptedTokens Drafted tokens accepted by the target model
+ */
+data class GenerationStats(
+    val tokenizeMs: Double,
+    val prefillMs: Double,
+    val timeToFirstTokenMs: Double,
+    val decodeMs: Double,
+    val tokensPerSecond: Double,
+    val promptTokens: Int,
+    val reusedTokens: Int,
+    val generatedTokens: Int,
+    val truncated: Boolean,
+    val batchCapacity: Int,
+    val draftedTokens: Int,
+    val acceptedTokens: Int
+) {
+    internal companion object {
+        /**
+         * Decode the flat array returned by [LlamaNative.nativeGetLastGenerationStats].
+         */
+        fun fromNative(values: DoubleArray) = GenerationStats(
+            tokenizeMs = values[0],
+            prefillMs = values[1],
+            timeToFirstTokenMs = values[2],
+            decodeMs = values[3],
+            tokensPerSecond = values[4],
+            promptTokens = values[5].toInt(),
+            reusedTokens = values[6].toInt(),
+            generatedTokens = values[7].toInt(),
+            truncated = values[8] != 0.0,
+            batchCapacity = values[9].toInt(),
+            draftedTokens = values[10].toInt(),
+            acceptedTokens = values[11].toInt()
+        )
+    }
+}
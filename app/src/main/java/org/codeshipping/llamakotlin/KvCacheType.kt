@@ -0,0 +1,16 @@
+package org.codeshipping.llamakotlin
+
+/**
+ * Element type of the K or V cache, see [LlamaConfig.cacheTypeK] and [LlamaConfig.cacheTypeV].
+ * Quantized types shrink the KV cache so a larger [LlamaConfig.contextSize] fits in RAM.
+ */
+enum class KvCacheType(internal val nativeName: String) {
+    /** 16-bit floats (llama.cpp default). */
+    F16("f16"),
+
+    /** 8-bit blocks, about half the size of [F16] with near-identical output. */
+    Q8_0("q8_0"),
+
+    /** 4-bit blocks, about a quarter of [F16]; quality loss is noticeable on small models. */
+    Q4_0("q4_0")
+}
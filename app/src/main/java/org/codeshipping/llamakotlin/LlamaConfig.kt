@@ -34,6 +34,16 @@ data class LlamaConfig(
      */
     var batchSize: Int = 512,
 
+    /**
+     * Number of generation requests that can run concurrently on this model.
+     * Values > 1 enable continuous batching: every active request gets its own
+     * sequence and their next tokens are decoded together in one batch.
+     * The context is split evenly, so each request gets contextSize / parallelSequences tokens.
+     * KV cache reuse and state snapshots are only available with a single sequence.
+     * Default: 1
+     */
+    var parallelSequences: Int = 1,
+
     // ========================================================================
     // Threading
     // ========================================================================
@@ -41,12 +51,16 @@ data class LlamaConfig(
     /**
      * Number of threads to use for inference.
      * Recommended: Number of CPU performance cores.
+     * Set to [AUTO_THREADS] to probe the core topology: decode then runs on the
+     * performance cores only, pinned through a dedicated threadpool, which avoids
+     * the tail latency of threads landing on efficiency cores.
      * Default: 4
      */
     var threads: Int = 4,
 
     /**
-     * Number of threads to use for batch processing.
+     * Number of threads to use for batch processing (prompt prefill).
+     * With [AUTO_THREADS] prefill uses every core, including efficiency cores.
      * Default: Same as threads
      */
     var threadsBatch: Int = -1,
@@ -59,6 +73,7 @@ data class LlamaConfig(
      * Temperature for sampling.
      * Higher values (e.g., 1.0) make output more random.
      * Lower values (e.g., 0.2) make output more deterministic.
+     * 0 selects greedy decoding (always the most likely token; topP / topK are ignored).
      * Default: 0.7
      */
     var temperature: Float = 0.7f,
@@ -99,6 +114,33 @@ data class LlamaConfig(
      */
     var presencePenalty: Float = 0.0f,
 
+    // ========================================================================
+    // Constrained Output
+    // ========================================================================
+
+    /**
+     * GBNF grammar the output must match (root rule `root`), e.g. to force a fixed format.
+     * Mutually exclusive with [jsonSchema].
+     * Default: null (unconstrained)
+     */
+    var grammar: String? = null,
+
+    /**
+     * JSON schema the output must conform to; converted to a grammar when the sampler is built.
+     * Requires the native library to be built with `llama.jsonSchema=true`.
+     * Mutually exclusive with [grammar].
+     * Default: null (unconstrained)
+     */
+    var jsonSchema: String? = null,
+
+    /**
+     * Lazy mode for [grammar] / [jsonSchema]: output is unconstrained until one of these
+     * strings appears, and from then on the grammar has to match starting at the trigger
+     * itself (e.g. a grammar for `<tool_call>{...}` triggered by "<tool_call>").
+     * Default: empty list (constrain from the first token)
+     */
+    var grammarTriggers: List<String> = emptyList(),
+
     // ========================================================================
     // Generation Limits
     // ========================================================================
@@ -116,6 +158,90 @@ data class LlamaConfig(
      */
     var stopSequences: List<String> = emptyList(),
 
+    // ========================================================================
+    // Streaming
+    // ========================================================================
+
+    /**
+     * Number of tokens grouped into one [LlamaModel.generateStream] emission.
+     * Values > 1 hand tokens over in chunks through a reusable direct buffer instead of
+     * one JNI call and String allocation per token, which helps small, fast models.
+     * Default: 1 (one emission per token)
+     */
+    var streamChunkTokens: Int = 1,
+
+    /**
+     * Maximum time in milliseconds a partial chunk is held back when [streamChunkTokens] > 1.
+     * Checked whenever a token is generated. Set to 0 to flush only on [streamChunkTokens].
+     * Default: 50
+     */
+    var streamFlushIntervalMs: Int = 50,
+
+    /**
+     * Decode [LlamaModel.generateStream] on a native worker thread that writes the text into a
+     * lock-free ring buffer, which the Flow drains. A slow collector then no longer stalls
+     * decoding (until it lags a 64 KB ring behind), and no JNI callback runs per token.
+     * Each emission holds all text generated since the previous one, so
+     * [streamChunkTokens] and [streamFlushIntervalMs] don't apply.
+     * Default: false (decode on the collecting coroutine's thread)
+     */
+    var asyncStreaming: Boolean = false,
+
+    // ========================================================================
+    // KV Cache
+    // ========================================================================
+
+    /**
+     * Reuse the KV cache across requests.
+     * When the new prompt starts with the previous prompt plus its generated
+     * reply (e.g. a chat history resent every turn), only the new suffix is
+     * processed, so time-to-first-token no longer grows with history length.
+     * Falls back to a full prefill when the prompt diverges from the cache.
+     * Default: true
+     */
+    var cacheReuse: Boolean = true,
+
+    /**
+     * Shift the context instead of stopping or re-prefilling when the window is full.
+     * During generation, half of the tokens after the first [keepTokens] are discarded from
+     * the KV cache and the rest are moved down in place, so long-form generation keeps going
+     * at steady speed. Over-long prompts keep their first [keepTokens] plus the most recent
+     * tail, and the cache from the previous turn is shifted to line up with it.
+     * Only used with a single sequence ([parallelSequences] = 1).
+     * Default: false
+     */
+    var contextShift: Boolean = false,
+
+    /**
+     * Number of tokens at the start of the context never discarded by [contextShift]
+     * (attention sinks; set to the system prompt length to always keep it).
+     * Default: 4
+     */
+    var keepTokens: Int = 4,
+
+    /**
+     * Element type of the K cache.
+     * [KvCacheType.Q8_0] halves the KV cache memory, so roughly twice the [contextSize]
+     * fits in the same RAM. See [LlamaModel.estimateKvCacheBytes].
+     * Default: [KvCacheType.F16]
+     */
+    var cacheTypeK: KvCacheType = KvCacheType.F16,
+
+    /**
+     * Element type of the V cache.
+     * Quantized types require [flashAttention].
+     * Default: [KvCacheType.F16]
+     */
+    var cacheTypeV: KvCacheType = KvCacheType.F16,
+
+    /**
+     * Use flash attention, which computes attention without materializing the full
+     * attention matrix. Lowers memory use on long contexts and is required for a
+     * quantized [cacheTypeV].
+     * Default: false
+     */
+    var flashAttention: Boolean = false,
+
     // ========================================================================
     // Memory Options
     // ========================================================================
@@ -134,6 +260,14 @@ data class LlamaConfig(
      */
     var useMlock: Boolean = false,
 
+    /**
+     * Run a tiny warm-up decode at the end of loading, so the first reply doesn't pay for
+     * faulting in the weights, allocating compute buffers and compiling GPU kernels.
+     * Adds that one-time cost to [LlamaModel.load] instead.
+     * Default: false
+     */
+    var warmup: Boolean = false,
+
     // ========================================================================
     // GPU Options
     // ========================================================================
@@ -141,18 +275,46 @@ data class LlamaConfig(
     /**
      * Number of layers to offload to GPU.
      * Set to 0 for CPU-only inference.
-     * Note: GPU support depends on device capabilities.
+     * Note: GPU support depends on device capabilities and on the library being built
+     * with a GPU backend; see [LlamaModel.getBackendDevices]. If the model can't be
+     * loaded with offloading, it is loaded on the CPU instead.
      * Default: 0
      */
     var gpuLayers: Int = 0,
 
+    /**
+     * Name of the device to offload to (e.g. "Vulkan0"), from [LlamaModel.getBackendDevices].
+     * Default: null (every GPU device found)
+     */
+    var gpuDevice: String? = null,
+
+    // ========================================================================
+    // Speculative Decoding
+    // ========================================================================
+
+    /**
+     * Path to an optional small draft model (e.g. a 0.5B model of the same family)
+     * used for speculative decoding. The draft proposes [draftTokens] tokens which the
+     * main model verifies in a single batched decode. Must share the main model's vocabulary.
+     * Only used with a single sequence ([parallelSequences] = 1).
+     * Default: null (disabled)
+     */
+    var draftModelPath: String? = null,
+
+    /**
+     * Number of tokens the draft model proposes per verification step.
+     * Tune per device using [LlamaModel.draftAcceptanceRate].
+     * Default: 4
+     */
+    var draftTokens: Int = 4,
+
     // ========================================================================
     // Reproducibility
     // ========================================================================
 
     /**
      * Random seed for reproducible generation.
-     * Set to -1 for random seed.
+     * Set to -1 for random seed (a new one for every request).
      * Default: -1
      */
     var seed: Int = -1
@@ -176,6 +338,11 @@ data class LlamaConfig(
             return LlamaConfig().apply(block)
         }
 
+        /**
+         * Thread count that selects threads automatically from the device's core topology.
+         */
+        const val AUTO_THREADS = 0
+
         /**
          * Default configuration for quick start.
          */
@@ -227,8 +394,11 @@ data class LlamaConfig(
         if (batchSize < 1) {
             throw LlamaException.InvalidConfig("batchSize must be positive")
         }
-        if (threads < 1) {
-            throw LlamaException.InvalidConfig("threads must be at least 1")
+        if (parallelSequences < 1 || parallelSequences > 64) {
+            throw LlamaException.InvalidConfig("parallelSequences must be between 1 and 64")
+        }
+        if (threads < 0) {
+            throw LlamaException.InvalidConfig("threads must be at least 1, or AUTO_THREADS")
         }
         if (temperature < 0.0f) {
             throw LlamaException.InvalidConfig("temperature must be non-negative")
@@ -242,9 +412,33 @@ data class LlamaConfig(
         if (maxTokens < 1) {
             throw LlamaException.InvalidConfig("maxTokens must be at least 1")
         }
+        if (keepTokens < 0) {
+            throw LlamaException.InvalidConfig("keepTokens must be non-negative")
+        }
+        if (cacheTypeV != KvCacheType.F16 && !flashAttention) {
+            throw LlamaException.InvalidConfig("cacheTypeV ${cacheTypeV.name} requires flashAttention")
+        }
+        if (streamChunkTokens < 1) {
+            throw LlamaException.InvalidConfig("streamChunkTokens must be at least 1")
+        }
+        if (streamFlushIntervalMs < 0) {
+            throw LlamaException.InvalidConfig("streamFlushIntervalMs must be non-negative")
+        }
+        if (draftTokens < 1 || draftTokens > 32) {
+            throw LlamaException.InvalidConfig("draftTokens must be between 1 and 32")
+        }
         if (gpuLayers < 0) {
             throw LlamaException.InvalidConfig("gpuLayers must be non-negative")
         }
+        if (grammar != null && jsonSchema != null) {
+            throw LlamaException.InvalidConfig("grammar and jsonSchema are mutually exclusive")
+        }
+        if (grammarTriggers.isNotEmpty() && grammar == null && jsonSchema == null) {
+            throw LlamaException.InvalidConfig("grammarTriggers requires grammar or jsonSchema")
+        }
+        if (grammarTriggers.any { it.isEmpty() }) {
+            throw LlamaException.InvalidConfig("grammarTriggers must not contain empty strings")
+        }
     }
 
     /**
@@ -1,7 +1,11 @@
 package org.codeshipping.llamakotlin
 
+import android.content.ComponentCallbacks2
+import android.content.res.AssetFileDescriptor
+import android.os.ParcelFileDescriptor
 import org.codeshipping.llamakotlin.exception.LlamaException
 import kotlinx.coroutines.CancellationException
+import kotlinx.coroutines.CoroutineScope
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.channels.awaitClose
 import kotlinx.coroutines.flow.Flow
@@ -11,7 +15,10 @@ import kotlinx.coroutines.isActive
 import kotlinx.coroutines.withContext
 import java.io.Closeable
 import java.io.File
+import java.nio.ByteBuffer
+import java.util.concurrent.ConcurrentLinkedQueue
 import java.util.concurrent.atomic.AtomicBoolean
+import java.util.concurrent.atomic.AtomicInteger
 import java.util.concurrent.atomic.AtomicLong
 
 /**
@@ -68,7 +75,8 @@ class LlamaModel private constructor(
 ) : Closeable {
 
     private val isClosed = AtomicBoolean(false)
-    private val isGeneratingFlag = AtomicBoolean(false)
+    private val activeGenerations = AtomicInteger(0)
+    private val streamBuffers = ConcurrentLinkedQueue<ByteBuffer>()
 
     /**
      * Configuration used to load this model.
@@ -89,7 +97,117 @@ class LlamaModel private constructor(
      * Check if generation is currently in progress.
      */
     val isGenerating: Boolean
-        get() = isGeneratingFlag.get() || LlamaNative.nativeIsGenerating(nativeHandle)
+        get() = activeGenerations.get() > 0 || LlamaNative.nativeIsGenerating(nativeHandle)
+
+    /**
+     * Fraction of draft tokens accepted during the last generation when
+     * speculative decoding is enabled via [LlamaConfig.draftModelPath].
+     * Returns -1 if no draft model was used.
+     */
+    val draftAcceptanceRate: Float
+        get() {
+            ensureNotClosed()
+            return LlamaNative.nativeGetDraftAcceptanceRate(nativeHandle)
+        }
+
+    /**
+     * Timings and counters of the most recently finished generation
+     * (tokenize/prefill/decode time, TTFT, tokens per second, cache reuse, truncation).
+     * With [LlamaConfig.parallelSequences] > 1 this is the last request that finished.
+     */
+    val lastGenerationStats: GenerationStats
+        get() {
+            ensureNotClosed()
+            return GenerationStats.fromNative(LlamaNative.nativeGetLastGenerationStats(nativeHandle))
+        }
+
+    /**
+     * Compute embeddings for a list of texts, e.g. to index notes for on-device retrieval.
+     *
+     * Texts are packed into shared batches as separate sequences, so many short texts
+     * cost a few decodes rather than one each. Load an embedding model (BGE, nomic-embed,
+     * Qwen3-Embedding, ...) for meaningful vectors. Texts longer than [LlamaConfig.batchSize]
+     * tokens are truncated.
+     *
+     * @param texts Input texts
+     * @param pooling How token embeddings are pooled into one vector per text
+     * @param normalize L2-normalize the vectors, so [Embeddings.dot] is cosine similarity
+     * @return One vector per text, in input order
+     * @throws LlamaException.GenerationError if the model can't produce embeddings
+     *
+     * Example:
+     * ```kotlin
+     * val vectors = model.embed(notes.map { it.text })
+     * val query = model.embed(listOf("where did I park?"))[0]
+     * ```
+     */
+    suspend fun embed(
+        texts: List<String>,
+        pooling: PoolingType = PoolingType.DEFAULT,
+        normalize: Boolean = true
+    ): Embeddings = withContext(Dispatchers.Default) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        if (texts.isEmpty()) {
+            return@withContext Embeddings(0, FloatArray(0))
+        }
+
+        acquireGenerationSlot()
+
+        try {
+            val data = LlamaNative.nativeEmbed(nativeHandle, texts.toTypedArray(), pooling.nativeValue, normalize)
+            Embeddings(data.size / texts.size, data)
+        } finally {
+            activeGenerations.decrementAndGet()
+        }
+    }
+
+    /**
+     * Estimate the KV cache memory of this model for a configuration.
+     * Uses [LlamaConfig.contextSize], [LlamaConfig.cacheTypeK] and [LlamaConfig.cacheTypeV],
+     * so an app can find the largest context that fits before reloading with it:
+     *
+     * ```kotlin
+     * val budget = 512L * 1024 * 1024
+     * val contextSize = listOf(16384, 8192, 4096, 2048).first { size ->
+     *     model.estimateKvCacheBytes(model.config.copy { contextSize = size }) <= budget
+     * }
+     * ```
+     *
+     * @param config Configuration to estimate, defaults to the one the model was loaded with
+     * @return Estimated bytes; models with sliding-window attention layers need less
+     */
+    fun estimateKvCacheBytes(config: LlamaConfig = _config): Long {
+        ensureNotClosed()
+        ensureModelLoaded()
+        return LlamaNative.nativeEstimateKvCacheBytes(nativeHandle, LlamaNative.NativeConfig.fromLlamaConfig(config))
+    }
+
+    /**
+     * Release memory in response to system memory pressure.
+     * Call from [android.content.ComponentCallbacks2.onTrimMemory]:
+     *
+     * ```kotlin
+     * override fun onTrimMemory(level: Int) {
+     *     model.trimMemory(level)
+     * }
+     * ```
+     *
+     * On TRIM_MEMORY_RUNNING_CRITICAL and TRIM_MEMORY_BACKGROUND and above, the reusable KV cache
+     * contents, the draft model and pooled stream buffers are released; the next request does a
+     * full prefill. Never blocks: with a generation running, the release happens when it ends.
+     *
+     * @param level Trim level passed to onTrimMemory
+     */
+    fun trimMemory(level: Int) {
+        if (isClosed.get()) return
+        if (level == ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL ||
+            level >= ComponentCallbacks2.TRIM_MEMORY_BACKGROUND
+        ) {
+            streamBuffers.clear()
+        }
+        LlamaNative.nativeTrimMemory(nativeHandle, level)
+    }
 
     /**
      * Generate a complete response for the given prompt.
@@ -117,9 +235,7 @@ class LlamaModel private constructor(
         ensureNotClosed()
         ensureModelLoaded()
 
-        if (isGeneratingFlag.getAndSet(true)) {
-            throw LlamaException.GenerationError("Generation already in progress")
-        }
+        acquireGenerationSlot()
 
         try {
             val nativeConfig = configOverride?.let {
@@ -145,7 +261,7 @@ class LlamaModel private constructor(
                 else -> throw LlamaException.GenerationError(e.message ?: "Unknown error", e)
             }
         } finally {
-            isGeneratingFlag.set(false)
+            activeGenerations.decrementAndGet()
         }
     }
 
@@ -157,8 +273,14 @@ class LlamaModel private constructor(
      *
      * @param prompt The input text prompt
      * @param configOverride Optional configuration override for this generation
+     * @param onPrefillProgress Called on the generation thread with prompt tokens processed / total
+     *        after each prefill chunk, before the first token is emitted. Not called with
+     *        [LlamaConfig.parallelSequences] > 1.
      * @return Flow of generated tokens
      *
+     * Cancelling the collector during a long prefill aborts the native decode within one chunk;
+     * the part of the prompt already processed stays in the KV cache for reuse.
+     *
      * Example:
      * ```kotlin
      * model.generateStream("Once upon a time")
@@ -176,32 +298,208 @@ class LlamaModel private constructor(
      */
     fun generateStream(
         prompt: String,
-        configOverride: LlamaConfig? = null
-    ): Flow<String> = callbackFlow {
+        configOverride: LlamaConfig? = null,
+        onPrefillProgress: ((processed: Int, total: Int) -> Unit)? = null
+    ): Flow<String> = streamInternal(prompt, null, configOverride, onPrefillProgress, 0)
+
+    /**
+     * Generate a streaming response from a prompt tokenized with [tokenize].
+     *
+     * Skips tokenization, e.g. for a system prompt tokenized once and concatenated with
+     * each user turn. The tokens are used as-is: include BOS if the model expects it.
+     *
+     * @param promptTokens Token ids of the prompt
+     * @param configOverride Optional configuration override for this generation
+     * @param onPrefillProgress See [generateStream]
+     * @return Flow of generated tokens
+     * @throws LlamaException.GenerationError if a token id is outside the vocabulary
+     */
+    fun generateStream(
+        promptTokens: IntArray,
+        configOverride: LlamaConfig? = null,
+        onPrefillProgress: ((processed: Int, total: Int) -> Unit)? = null
+    ): Flow<String> = streamInternal("", promptTokens, configOverride, onPrefillProgress, 0)
+
+    /**
+     * Start a multi-turn chat whose history is kept, formatted and tokenized in native memory.
+     *
+     * Unlike [applyChatTemplate], each turn only formats and tokenizes the new message, and the
+     * model's replies are stored as the tokens it generated, so the next turn's prompt matches
+     * the KV cache up to the end of the previous reply.
+     *
+     * @param systemPrompt Optional system message to start the history with
+     * @return Conversation bound to this model; close it when done (closing the model frees it too)
+     *
+     * Example:
+     * ```kotlin
+     * model.createConversation("You are a helpful assistant.").use { chat ->
+     *     chat.appendUserMessage("Hi!")
+     *     chat.reply().collect { print(it) }
+     * }
+     * ```
+     */
+    fun createConversation(systemPrompt: String? = null): Conversation {
+        ensureNotClosed()
+        ensureModelLoaded()
+        val conversation = Conversation(this, LlamaNative.nativeCreateConversation(nativeHandle))
+        if (systemPrompt != null) {
+            conversation.appendSystemMessage(systemPrompt)
+        }
+        return conversation
+    }
+
+    internal fun appendConversationMessage(conversationId: Int, role: String, content: String): Int {
+        ensureNotClosed()
+        return LlamaNative.nativeAppendMessage(nativeHandle, conversationId, role, content)
+    }
+
+    internal fun conversationTokenCount(conversationId: Int): Int {
+        ensureNotClosed()
+        return LlamaNative.nativeGetConversationTokenCount(nativeHandle, conversationId)
+    }
+
+    internal fun conversationReply(
+        conversationId: Int,
+        configOverride: LlamaConfig?,
+        onPrefillProgress: ((processed: Int, total: Int) -> Unit)?
+    ): Flow<String> = streamInternal("", null, configOverride, onPrefillProgress, conversationId)
+
+    internal fun freeConversation(conversationId: Int) {
+        if (!isClosed.get()) {
+            LlamaNative.nativeFreeConversation(nativeHandle, conversationId)
+        }
+    }
+
+    /**
+     * Load a LoRA adapter trained for this model's base weights.
+     *
+     * The adapter has no effect until applied with [setLoraAdapter]; the base weights are
+     * shared, so each loaded adapter only costs its own size in memory.
+     *
+     * @param path Path to the adapter .gguf file
+     * @return Adapter bound to this model; close it to free it (closing the model frees it too)
+     * @throws LlamaException.ModelNotFound if the file doesn't exist
+     * @throws LlamaException.AdapterError if the adapter can't be loaded, e.g. for another base model
+     */
+    suspend fun loadLoraAdapter(path: String): LoraAdapter = withContext(Dispatchers.IO) {
         ensureNotClosed()
         ensureModelLoaded()
+        if (!File(path).exists()) {
+            throw LlamaException.ModelNotFound(path)
+        }
+        val id = LlamaNative.nativeLoadLoraAdapter(nativeHandle, path)
+        if (id == 0) {
+            throw LlamaException.AdapterError(LlamaNative.nativeGetLastError(nativeHandle).ifEmpty { "Unknown error" })
+        }
+        LoraAdapter(this@LlamaModel, id, path)
+    }
 
-        if (isGeneratingFlag.getAndSet(true)) {
-            throw LlamaException.GenerationError("Generation already in progress")
+    /**
+     * Apply a LoRA adapter to the following generations, or remove it with `scale = 0`.
+     *
+     * Several adapters can be active at once. Changing them waits for a running generation to
+     * finish and drops the reusable KV cache, so the next prompt is prefilled in full.
+     * Not supported with [LlamaConfig.parallelSequences] > 1.
+     *
+     * @param adapter Adapter loaded by [loadLoraAdapter]
+     * @param scale Adapter strength, 1 = as trained
+     * @throws LlamaException.AdapterError if the adapter can't be applied
+     */
+    suspend fun setLoraAdapter(adapter: LoraAdapter, scale: Float = 1.0f) = withContext(Dispatchers.IO) {
+        ensureNotClosed()
+        adapter.ensureUsableWith(this@LlamaModel)
+        if (!LlamaNative.nativeSetLoraAdapter(nativeHandle, adapter.adapterId, scale)) {
+            throw LlamaException.AdapterError(LlamaNative.nativeGetLastError(nativeHandle).ifEmpty { "Unknown error" })
         }
+    }
+
+    /**
+     * Remove every active LoRA adapter, back to the base model. Loaded adapters stay loaded.
+     */
+    suspend fun clearLoraAdapters() = withContext(Dispatchers.IO) {
+        ensureNotClosed()
+        LlamaNative.nativeClearLoraAdapters(nativeHandle)
+    }
+
+    internal fun unloadLoraAdapter(adapterId: Int) {
+        if (!isClosed.get()) {
+            LlamaNative.nativeUnloadLoraAdapter(nativeHandle, adapterId)
+        }
+    }
+
+    private fun streamInternal(
+        prompt: String,
+        promptTokens: IntArray?,
+        configOverride: LlamaConfig?,
+        onPrefillProgress: ((processed: Int, total: Int) -> Unit)?,
+        conversationId: Int
+    ): Flow<String> = callbackFlow {
+        ensureNotClosed()
+        ensureModelLoaded()
 
         val nativeConfig = configOverride?.let {
             it.validate()
             LlamaNative.NativeConfig.fromLlamaConfig(it)
         }
 
-        val callback = object : LlamaNative.NativeTokenCallback {
-            override fun onToken(token: String) {
-                if (isActive) {
-                    trySend(token)
-                }
-            }
+        val effectiveConfig = configOverride ?: _config
+
+        acquireGenerationSlot()
+
+        val chunkBuffer = if (effectiveConfig.streamChunkTokens > 1 || effectiveConfig.asyncStreaming) {
+            acquireStreamBuffer()
+        } else {
+            null
         }
 
         try {
             // Run generation on background thread
             withContext(Dispatchers.Default) {
-                LlamaNative.nativeGenerateStream(nativeHandle, prompt, callback, nativeConfig)
+                // Prefill runs before any token is sent, so this is where a cancelled collector is noticed
+                val progressCallback = onPrefillProgress?.let { listener ->
+                    object : LlamaNative.NativeProgressCallback {
+                        override fun onPrefillProgress(processed: Int, total: Int) {
+                            if (isActive) {
+                                listener(processed, total)
+                            } else {
+                                LlamaNative.nativeCancelGeneration(nativeHandle)
+                            }
+                        }
+                    }
+                }
+                if (effectiveConfig.asyncStreaming) {
+                    val job = LlamaNative.nativeStartGeneration(
+                        nativeHandle, prompt, nativeConfig, promptTokens, conversationId
+                    )
+                    drainAsync(job, chunkBuffer!!, onPrefillProgress) { text -> send(text) }
+                } else if (chunkBuffer != null) {
+                    val chunkCallback = object : LlamaNative.NativeChunkCallback {
+                        override fun onChunk(length: Int) {
+                            if (isActive) {
+                                val bytes = ByteArray(length)
+                                chunkBuffer.clear()
+                                chunkBuffer.get(bytes, 0, length)
+                                trySend(String(bytes, Charsets.UTF_8))
+                            }
+                        }
+                    }
+                    LlamaNative.nativeGenerateStreamChunked(
+                        nativeHandle, prompt, chunkBuffer, chunkCallback, nativeConfig,
+                        effectiveConfig.streamChunkTokens, effectiveConfig.streamFlushIntervalMs,
+                        progressCallback, promptTokens, conversationId
+                    )
+                } else {
+                    val callback = object : LlamaNative.NativeTokenCallback {
+                        override fun onToken(token: String) {
+                            if (isActive) {
+                                trySend(token)
+                            }
+                        }
+                    }
+                    LlamaNative.nativeGenerateStream(
+                        nativeHandle, prompt, callback, nativeConfig, progressCallback, promptTokens, conversationId
+                    )
+                }
             }
         } catch (e: Exception) {
             when (e) {
@@ -213,23 +511,99 @@ class LlamaModel private constructor(
                 else -> throw LlamaException.GenerationError(e.message ?: "Unknown error", e)
             }
         } finally {
-            isGeneratingFlag.set(false)
+            chunkBuffer?.let { streamBuffers.offer(it) }
+            activeGenerations.decrementAndGet()
         }
 
         // Close the channel when done
         close()
 
-        awaitClose {
-            // Cancel generation if flow is cancelled
-            if (isGeneratingFlag.get()) {
+        awaitClose()
+    }.flowOn(Dispatchers.Default)
+
+    /**
+     * Read a job started by [LlamaNative.nativeStartGeneration] until it ends. Suspending in
+     * [emit] stops polling, so the worker only waits once the native ring buffer is full.
+     */
+    private suspend fun CoroutineScope.drainAsync(
+        job: Long,
+        buffer: ByteBuffer,
+        onPrefillProgress: ((processed: Int, total: Int) -> Unit)?,
+        emit: suspend (String) -> Unit
+    ) {
+        val bytes = ByteArray(buffer.capacity())
+        var lastProgress = -1L
+        var finished = false
+        try {
+            while (true) {
+                if (!isActive) {
+                    // Keep polling: the worker ends within one decode step and closes the ring
+                    LlamaNative.nativeCancelGeneration(nativeHandle)
+                }
+                val length = LlamaNative.nativePollGeneration(job, buffer)
+                if (length < 0) {
+                    finished = true
+                    break
+                }
+                if (length > 0) {
+                    buffer.clear()
+                    buffer.get(bytes, 0, length)
+                    if (isActive) {
+                        emit(String(bytes, 0, length, Charsets.UTF_8))
+                    }
+                    continue
+                }
+                if (onPrefillProgress != null && isActive) {
+                    val progress = LlamaNative.nativeGetGenerationProgress(job)
+                    if (progress != lastProgress && progress != 0L) {
+                        lastProgress = progress
+                        onPrefillProgress((progress ushr 32).toInt(), progress.toInt())
+                    }
+                }
+                LlamaNative.nativeAwaitGeneration(job, ASYNC_POLL_TIMEOUT_MS)
+            }
+        } finally {
+            if (!finished) {
                 LlamaNative.nativeCancelGeneration(nativeHandle)
-                isGeneratingFlag.set(false)
             }
+            LlamaNative.nativeFinishGeneration(job)
         }
-    }.flowOn(Dispatchers.Default)
+    }
+
+    /**
+     * Tokenize text with the model's vocabulary.
+     *
+     * Blocks while a generation on this model is running.
+     *
+     * @param text Input text
+     * @param addSpecial Add BOS (and EOS where the model expects it), as generation does
+     * @return Token ids, usable with [generateStream]
+     */
+    fun tokenize(text: String, addSpecial: Boolean = true): IntArray {
+        ensureNotClosed()
+        ensureModelLoaded()
+        return LlamaNative.nativeTokenize(nativeHandle, text, addSpecial)
+    }
+
+    /**
+     * Count the tokens of text exactly, e.g. to budget a prompt against [LlamaConfig.contextSize]
+     * before generating. Cheaper than [tokenize] as the ids are not copied to Kotlin.
+     *
+     * Blocks while a generation on this model is running.
+     *
+     * @param text Input text
+     * @param addSpecial Count BOS (and EOS where the model expects it), as generation does
+     * @return Number of tokens
+     */
+    fun countTokens(text: String, addSpecial: Boolean = true): Int {
+        ensureNotClosed()
+        ensureModelLoaded()
+        return LlamaNative.nativeCountTokens(nativeHandle, text, addSpecial)
+    }
 
     /**
      * Cancel any ongoing generation.
+     * With [LlamaConfig.parallelSequences] > 1 every in-flight request is cancelled.
      *
      * This is safe to call even if no generation is in progress.
      * After cancellation, [LlamaException.GenerationCancelled] will be thrown
@@ -249,6 +623,10 @@ class LlamaModel private constructor(
      * Mistral, ChatML, etc.)
      *
      * @param messages List of chat messages as JSON: [{"role": "user", "content": "..."}, ...]
+     * When the returned prompt is passed to [generate] or [generateStream] unchanged, it is
+     * tokenized per message and an over-long history is truncated by dropping whole old turns
+     * (the system message and latest message are kept), which keeps the KV cache prefix reusable.
+     *
      * @param addGenerationPrompt Whether to add the generation prompt at the end
      * @return Formatted prompt string ready for generation
      * @throws LlamaException.GenerationError if template application fails
@@ -283,6 +661,128 @@ class LlamaModel private constructor(
         }
     }
 
+    /**
+     * Save the current KV cache state to a file.
+     *
+     * The snapshot includes the cached token list, so after [restoreState] a prompt
+     * that starts with the same tokens (e.g. a fixed system prompt) skips their prefill.
+     * Requires [LlamaConfig.cacheReuse] to benefit from the restored cache.
+     *
+     * @param path Destination file path
+     * @throws LlamaException.StateError if the state could not be saved
+     *
+     * Example:
+     * ```kotlin
+     * model.generate(systemPrompt)
+     * model.saveState(File(filesDir, "system.state").path)
+     * ```
+     */
+    suspend fun saveState(path: String) = withContext(Dispatchers.IO) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        if (!LlamaNative.nativeSaveState(nativeHandle, path)) {
+            throw LlamaException.StateError(LlamaNative.nativeGetLastError(nativeHandle).ifEmpty { "Unknown error" })
+        }
+    }
+
+    /**
+     * Restore a KV cache state previously written by [saveState].
+     * The snapshot must come from the same model file.
+     *
+     * @param path Source file path
+     * @throws LlamaException.StateError if the state could not be restored
+     */
+    suspend fun restoreState(path: String) = withContext(Dispatchers.IO) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        if (!LlamaNative.nativeRestoreState(nativeHandle, path)) {
+            throw LlamaException.StateError(LlamaNative.nativeGetLastError(nativeHandle).ifEmpty { "Unknown error" })
+        }
+    }
+
+    /**
+     * Save the current KV cache state into a direct [ByteBuffer].
+     * The buffer is positioned at 0 with its limit set to the snapshot size.
+     *
+     * @return Buffer holding the snapshot
+     * @throws LlamaException.StateError if the state could not be saved
+     */
+    suspend fun saveStateToBuffer(): ByteBuffer = withContext(Dispatchers.Default) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        val size = LlamaNative.nativeGetStateSize(nativeHandle)
+        if (size <= 0 || size > Int.MAX_VALUE) {
+            throw LlamaException.StateError("Invalid state size: $size")
+        }
+        val buffer = ByteBuffer.allocateDirect(size.toInt())
+        val written = LlamaNative.nativeSaveStateToBuffer(nativeHandle, buffer)
+        if (written <= 0) {
+            throw LlamaException.StateError(LlamaNative.nativeGetLastError(nativeHandle).ifEmpty { "Unknown error" })
+        }
+        buffer.limit(written.toInt())
+        buffer
+    }
+
+    /**
+     * Restore a KV cache state written by [saveStateToBuffer].
+     * Bytes between the buffer's position and limit are used; non-direct buffers are copied first.
+     *
+     * @param buffer Buffer holding the snapshot
+     * @throws LlamaException.StateError if the state could not be restored
+     */
+    suspend fun restoreStateFromBuffer(buffer: ByteBuffer) = withContext(Dispatchers.Default) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        val direct = if (buffer.isDirect && buffer.position() == 0) {
+            buffer
+        } else {
+            ByteBuffer.allocateDirect(buffer.remaining()).put(buffer.duplicate()).apply { flip() }
+        }
+        if (!LlamaNative.nativeRestoreStateFromBuffer(nativeHandle, direct, direct.remaining().toLong())) {
+            throw LlamaException.StateError(LlamaNative.nativeGetLastError(nativeHandle).ifEmpty { "Unknown error" })
+        }
+    }
+
+    /**
+     * Measure prefill and decode throughput of the loaded model on this device.
+     *
+     * Runs synthetic tokens straight through the decoder (no sampling or detokenization),
+     * so results are comparable across prompts and devices. Prefill is measured at several
+     * batch sizes up to [LlamaConfig.batchSize], decode at several thread counts.
+     * The KV cache is cleared, so the next generation starts from an empty cache.
+     *
+     * @param promptTokens Prompt length used for prefill and time-to-first-token
+     * @param genTokens Number of tokens decoded per decode run
+     * @param reps Repetitions per measurement
+     * @return Benchmark results
+     * @throws LlamaException.GenerationError if the benchmark fails or a generation is running
+     *
+     * Example:
+     * ```kotlin
+     * val result = model.benchmark()
+     * Log.i("Bench", "pp ${result.bestPrefillTokensPerSecond} t/s, tg ${result.bestDecodeTokensPerSecond} t/s")
+     * ```
+     */
+    suspend fun benchmark(
+        promptTokens: Int = 512,
+        genTokens: Int = 128,
+        reps: Int = 3
+    ): BenchmarkResult = withContext(Dispatchers.Default) {
+        ensureNotClosed()
+        ensureModelLoaded()
+        require(promptTokens > 0) { "promptTokens must be positive" }
+        require(genTokens > 0) { "genTokens must be positive" }
+        require(reps > 0) { "reps must be positive" }
+
+        acquireGenerationSlot()
+
+        try {
+            BenchmarkResult.fromNative(LlamaNative.nativeBenchmark(nativeHandle, promptTokens, genTokens, reps))
+        } finally {
+            activeGenerations.decrementAndGet()
+        }
+    }
+
     /**
      * Release native resources.
      *
@@ -303,6 +803,29 @@ class LlamaModel private constructor(
         }
     }
 
+    /**
+     * Reserve one of the [LlamaConfig.parallelSequences] generation slots.
+     */
+    private fun acquireGenerationSlot() {
+        val maxConcurrent = _config.parallelSequences.coerceAtLeast(1)
+        while (true) {
+            val current = activeGenerations.get()
+            if (current >= maxConcurrent) {
+                throw LlamaException.GenerationError("Generation already in progress")
+            }
+            if (activeGenerations.compareAndSet(current, current + 1)) {
+                return
+            }
+        }
+    }
+
+    /**
+     * Take a direct buffer for chunked streaming from the pool, reused across generations.
+     */
+    private fun acquireStreamBuffer(): ByteBuffer {
+        return streamBuffers.poll() ?: ByteBuffer.allocateDirect(STREAM_BUFFER_SIZE)
+    }
+
     private fun ensureNotClosed() {
         if (isClosed.get()) {
             throw LlamaException.ContextClosed()
@@ -321,6 +844,12 @@ class LlamaModel private constructor(
          */
         private val contextCounter = AtomicLong(0)
 
+        /** Capacity of the direct buffers used for chunked streaming */
+        private const val STREAM_BUFFER_SIZE = 16 * 1024
+
+        /** Longest wait for async text before progress and cancellation are checked again */
+        private const val ASYNC_POLL_TIMEOUT_MS = 20
+
         init {
             // Ensure native library is loaded
             LlamaNative.ensureLoaded()
@@ -334,6 +863,49 @@ class LlamaModel private constructor(
         @JvmStatic
         fun getVersion(): String = LlamaNative.nativeGetVersion()
 
+        /**
+         * List the compute devices llama.cpp can use on this device.
+         * GPU devices only appear when the library was built with a GPU backend
+         * (Vulkan or OpenCL) and the backend loaded; pass a device [BackendDevice.name]
+         * as [LlamaConfig.gpuDevice] to pick one for offloading.
+         */
+        fun getBackendDevices(): List<BackendDevice> = LlamaNative.nativeGetBackendDevices().toList()
+
+        /**
+         * Estimate the memory a model file needs with a configuration, reading only its GGUF
+         * header: weights, KV cache and compute buffer, plus how many layers fit on the GPU.
+         * Lets an app pick a model, quantization and context size that fit before loading,
+         * instead of finding out through a low-memory kill.
+         *
+         * @param modelPath Absolute path to the .gguf model file
+         * @param config Configuration to plan for; [LlamaConfig.contextSize], the cache types,
+         *        [LlamaConfig.batchSize], [LlamaConfig.flashAttention] and [LlamaConfig.gpuDevice] matter
+         * @return Estimated footprint
+         * @throws LlamaException.ModelNotFound if the model file doesn't exist
+         * @throws LlamaException.ModelLoadError if the file is not a readable GGUF model
+         *
+         * Example:
+         * ```kotlin
+         * val contextSize = listOf(8192, 4096, 2048).firstOrNull { size ->
+         *     LlamaModel.planLoad(path, LlamaConfig(contextSize = size)).fitsInAvailableMemory
+         * } ?: error("Model doesn't fit")
+         * ```
+         */
+        @JvmStatic
+        suspend fun planLoad(
+            modelPath: String,
+            config: LlamaConfig = LlamaConfig()
+        ): LoadPlan = withContext(Dispatchers.IO) {
+            if (!File(modelPath).exists()) {
+                throw LlamaException.ModelNotFound(modelPath)
+            }
+            try {
+                LlamaNative.nativePlanLoad(modelPath, LlamaNative.NativeConfig.fromLlamaConfig(config))
+            } catch (e: IllegalArgumentException) {
+                throw LlamaException.ModelLoadError(e.message ?: "Unknown error", e)
+            }
+        }
+
         /**
          * Load a GGUF model from the specified path.
          *
@@ -367,12 +939,22 @@ class LlamaModel private constructor(
          *
          * @param modelPath Absolute path to the .gguf model file
          * @param config Configuration for model loading
+         * @param onProgress Called on the loading thread with the fraction loaded, 0..1,
+         *        including the warm-up when [LlamaConfig.warmup] is set
          * @return Loaded [LlamaModel] instance
+         *
+         * Example:
+         * ```kotlin
+         * val model = LlamaModel.load(path, LlamaConfig(warmup = true)) { progress ->
+         *     progressBar.post { progressBar.progress = (progress * 100).toInt() }
+         * }
+         * ```
          */
         @JvmStatic
         suspend fun load(
             modelPath: String,
-            config: LlamaConfig
+            config: LlamaConfig,
+            onProgress: ((progress: Float) -> Unit)? = null
         ): LlamaModel = withContext(Dispatchers.IO) {
             // Validate path
             val file = File(modelPath)
@@ -383,8 +965,100 @@ class LlamaModel private constructor(
                 throw LlamaException.ModelLoadError("Cannot read model file: $modelPath")
             }
 
+            loadInternal(config, onProgress) { handle, nativeConfig, progress ->
+                LlamaNative.nativeLoadModel(handle, modelPath, nativeConfig, progress)
+            }
+        }
+
+        /**
+         * Load a GGUF model from an open file, mapping it in place instead of copying it
+         * to internal storage first - e.g. a document picked through the Storage Access
+         * Framework or a blob from a content provider.
+         *
+         * The descriptor stays owned by the caller and can be closed once this returns;
+         * the model remains mapped.
+         *
+         * @param descriptor Descriptor of the .gguf file
+         * @param config Configuration for model loading and inference
+         * @return Loaded [LlamaModel] instance
+         * @throws LlamaException.ModelLoadError if loading fails
+         *
+         * Example:
+         * ```kotlin
+         * val model = contentResolver.openFileDescriptor(uri, "r")!!.use { fd ->
+         *     LlamaModel.load(fd) { contextSize = 4096 }
+         * }
+         * ```
+         */
+        @JvmStatic
+        suspend fun load(
+            descriptor: ParcelFileDescriptor,
+            config: LlamaConfig.() -> Unit = {}
+        ): LlamaModel = load(descriptor, LlamaConfig().apply(config))
+
+        /**
+         * Load a GGUF model from an open file with explicit configuration.
+         *
+         * @param descriptor Descriptor of the .gguf file
+         * @param config Configuration for model loading
+         * @param onProgress Load progress, see [load]
+         * @return Loaded [LlamaModel] instance
+         */
+        @JvmStatic
+        suspend fun load(
+            descriptor: ParcelFileDescriptor,
+            config: LlamaConfig,
+            onProgress: ((progress: Float) -> Unit)? = null
+        ): LlamaModel = withContext(Dispatchers.IO) {
+            loadInternal(config, onProgress) { handle, nativeConfig, progress ->
+                LlamaNative.nativeLoadModelFromFd(handle, descriptor.fd, 0L, nativeConfig, progress)
+            }
+        }
+
+        /**
+         * Load a GGUF model from an [AssetFileDescriptor], e.g. one returned by
+         * [android.content.ContentResolver.openAssetFileDescriptor].
+         *
+         * llama.cpp maps a model from the start of its file, so the descriptor must cover a
+         * whole file ([AssetFileDescriptor.getStartOffset] == 0). Assets packed inside the APK
+         * (`AssetManager.openFd`) always start at an offset; ship large models as a file-backed
+         * asset pack or download them and use [load] with a path or [ParcelFileDescriptor].
+         *
+         * @param descriptor Descriptor of the .gguf file
+         * @param config Configuration for model loading
+         * @param onProgress Load progress, see [load]
+         * @return Loaded [LlamaModel] instance
+         * @throws LlamaException.ModelLoadError if the descriptor starts inside a file or loading fails
+         */
+        @JvmStatic
+        suspend fun load(
+            descriptor: AssetFileDescriptor,
+            config: LlamaConfig,
+            onProgress: ((progress: Float) -> Unit)? = null
+        ): LlamaModel = withContext(Dispatchers.IO) {
+            loadInternal(config, onProgress) { handle, nativeConfig, progress ->
+                LlamaNative.nativeLoadModelFromFd(
+                    handle, descriptor.parcelFileDescriptor.fd, descriptor.startOffset, nativeConfig, progress
+                )
+            }
+        }
+
+        private fun loadInternal(
+            config: LlamaConfig,
+            onProgress: ((progress: Float) -> Unit)?,
+            nativeLoad: (
+                handle: Long,
+                config: LlamaNative.NativeConfig,
+                progress: LlamaNative.NativeLoadProgressCallback?
+            ) -> Boolean
+        ): LlamaModel {
             // Validate config
             config.validate()
+            config.draftModelPath?.let { draftPath ->
+                if (!File(draftPath).exists()) {
+                    throw LlamaException.ModelNotFound(draftPath)
+                }
+            }
 
             // Create native context
             val handle = LlamaNative.nativeCreateContext()
@@ -397,14 +1071,19 @@ class LlamaModel private constructor(
             try {
                 // Load model
                 val nativeConfig = LlamaNative.NativeConfig.fromLlamaConfig(config)
-                val success = LlamaNative.nativeLoadModel(handle, modelPath, nativeConfig)
+                val progress = onProgress?.let { listener ->
+                    object : LlamaNative.NativeLoadProgressCallback {
+                        override fun onLoadProgress(progress: Float) = listener(progress)
+                    }
+                }
+                val success = nativeLoad(handle, nativeConfig, progress)
 
                 if (!success) {
                     val error = LlamaNative.nativeGetLastError(handle)
                     throw LlamaException.ModelLoadError(error.ifEmpty { "Unknown error" })
                 }
 
-                LlamaModel(handle, config)
+                return LlamaModel(handle, config)
             } catch (e: Exception) {
                 // Clean up on failure
                 LlamaNative.nativeDestroyContext(handle)
@@ -416,23 +1095,5 @@ class LlamaModel private constructor(
                 }
             }
         }
-
-        /**
-         * Load a model from Android assets or resources.
-         *
-         * Note: This requires copying the model to a readable location first,
-         * as assets cannot be read directly by native code.
-         *
-         * @param modelPath Path relative to assets folder
-         * @param context Android context for asset access
-         * @param config Configuration for model loading
-         * @return Loaded [LlamaModel] instance
-         */
-        // Note: Implementation would require copying to cache directory first
-        // suspend fun loadFromAssets(
-        //     assetPath: String,
-        //     context: Context,
-        //     config: LlamaConfig.() -> Unit = {}
-        // ): LlamaModel
     }
 }
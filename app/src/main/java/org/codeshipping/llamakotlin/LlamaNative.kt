@@ -1,6 +1,7 @@
 package org.codeshipping.llamakotlin
 
 import androidx.annotation.Keep
+import java.nio.ByteBuffer
 
 /**
  * Internal JNI bridge to native llama.cpp implementation.
@@ -41,6 +42,13 @@ internal object LlamaNative {
     @JvmStatic
     external fun nativeGetVersion(): String
 
+    /**
+     * Get the compute devices of all registered ggml backends.
+     * @return Devices (CPU always present, GPUs when a GPU backend was built in and loads)
+     */
+    @JvmStatic
+    external fun nativeGetBackendDevices(): Array<BackendDevice>
+
     // ========================================================================
     // Context Management
     // ========================================================================
@@ -68,6 +76,7 @@ internal object LlamaNative {
      * @param handle Context handle
      * @param modelPath Path to the .gguf model file
      * @param config Configuration object
+     * @param progress Optional load progress callback
      * @return true if successful
      * @throws org.codeshipping.llamakotlin.exception.LlamaException on failure
      */
@@ -75,7 +84,27 @@ internal object LlamaNative {
     external fun nativeLoadModel(
         handle: Long,
         modelPath: String,
-        config: NativeConfig
+        config: NativeConfig,
+        progress: NativeLoadProgressCallback?
+    ): Boolean
+
+    /**
+     * Load a model from an open file descriptor without copying it.
+     * @param handle Context handle
+     * @param fd File descriptor; may be closed once this returns
+     * @param offset Start of the model in the file (only 0 is supported)
+     * @param config Configuration object
+     * @param progress Optional load progress callback
+     * @return true if successful
+     * @throws org.codeshipping.llamakotlin.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeLoadModelFromFd(
+        handle: Long,
+        fd: Int,
+        offset: Long,
+        config: NativeConfig,
+        progress: NativeLoadProgressCallback?
     ): Boolean
 
     /**
@@ -118,6 +147,9 @@ internal object LlamaNative {
      * @param prompt Input text
      * @param callback Callback for each token
      * @param config Optional config override
+     * @param progress Optional prefill progress callback
+     * @param promptTokens Pre-tokenized prompt used instead of [prompt] when not null
+     * @param conversationId Reply to this conversation instead of [prompt] when not 0
      * @throws org.codeshipping.llamakotlin.exception.LlamaException on failure
      */
     @JvmStatic
@@ -125,9 +157,207 @@ internal object LlamaNative {
         handle: Long,
         prompt: String,
         callback: NativeTokenCallback,
-        config: NativeConfig?
+        config: NativeConfig?,
+        progress: NativeProgressCallback?,
+        promptTokens: IntArray?,
+        conversationId: Int
     )
 
+    /**
+     * Generate text with streaming output delivered in chunks.
+     * Tokens are grouped and written as UTF-8 into [buffer]; [NativeChunkCallback.onChunk]
+     * receives the number of valid bytes, which are only valid until the callback returns.
+     * Chunks never end in the middle of a UTF-8 character.
+     * @param handle Context handle
+     * @param prompt Input prompt
+     * @param buffer Reusable direct ByteBuffer receiving each chunk
+     * @param callback Callback invoked once per chunk
+     * @param config Generation config (optional)
+     * @param chunkTokens Flush after this many tokens
+     * @param flushIntervalMs Flush when this much time passed since the last flush (0 = disabled)
+     * @param progress Optional prefill progress callback
+     * @param promptTokens Pre-tokenized prompt used instead of [prompt] when not null
+     * @param conversationId Reply to this conversation instead of [prompt] when not 0
+     */
+    @JvmStatic
+    external fun nativeGenerateStreamChunked(
+        handle: Long,
+        prompt: String,
+        buffer: ByteBuffer,
+        callback: NativeChunkCallback,
+        config: NativeConfig?,
+        chunkTokens: Int,
+        flushIntervalMs: Int,
+        progress: NativeProgressCallback?,
+        promptTokens: IntArray?,
+        conversationId: Int
+    )
+
+    // ========================================================================
+    // Async Generation
+    // ========================================================================
+
+    /**
+     * Start a generation on a native worker thread. Its text is read with [nativePollGeneration];
+     * every started job must be ended with [nativeFinishGeneration].
+     * @param handle Context handle
+     * @param prompt Input text
+     * @param config Optional config override
+     * @param promptTokens Pre-tokenized prompt used instead of [prompt] when not null
+     * @param conversationId Reply to this conversation instead of [prompt] when not 0
+     * @return Job handle
+     */
+    @JvmStatic
+    external fun nativeStartGeneration(
+        handle: Long,
+        prompt: String,
+        config: NativeConfig?,
+        promptTokens: IntArray?,
+        conversationId: Int
+    ): Long
+
+    /**
+     * Copy the text generated since the last poll into [buffer] as UTF-8, without blocking.
+     * Never ends in the middle of a character.
+     * @param job Job handle
+     * @param buffer Direct ByteBuffer of at least 4 bytes
+     * @return Number of bytes written, 0 if none are ready yet, -1 once the generation ended
+     *         and all text was read
+     */
+    @JvmStatic
+    external fun nativePollGeneration(job: Long, buffer: ByteBuffer): Int
+
+    /**
+     * Block until [nativePollGeneration] has something to return or the timeout passes.
+     * @param job Job handle
+     * @param timeoutMs Maximum wait
+     * @return true if text (or the end) is ready
+     */
+    @JvmStatic
+    external fun nativeAwaitGeneration(job: Long, timeoutMs: Int): Boolean
+
+    /**
+     * Latest prefill progress of a job.
+     * @param job Job handle
+     * @return Prompt tokens processed in the upper 32 bits, total in the lower 32 bits
+     */
+    @JvmStatic
+    external fun nativeGetGenerationProgress(job: Long): Long
+
+    /**
+     * Wait for the worker thread to end and release the job. Unread text is dropped.
+     * @param job Job handle
+     * @throws org.codeshipping.llamakotlin.exception.LlamaException if the generation failed
+     */
+    @JvmStatic
+    external fun nativeFinishGeneration(job: Long)
+
+    // ========================================================================
+    // Tokenization
+    // ========================================================================
+
+    /**
+     * Tokenize text with the loaded model's vocabulary.
+     * @param handle Context handle
+     * @param text Input text
+     * @param addSpecial Add BOS (and EOS where the model expects it)
+     * @return Token ids
+     * @throws org.codeshipping.llamakotlin.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeTokenize(handle: Long, text: String, addSpecial: Boolean): IntArray
+
+    /**
+     * Count the tokens of text without copying them to Java.
+     * @param handle Context handle
+     * @param text Input text
+     * @param addSpecial Add BOS (and EOS where the model expects it)
+     * @return Number of tokens
+     * @throws org.codeshipping.llamakotlin.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeCountTokens(handle: Long, text: String, addSpecial: Boolean): Int
+
+    // ========================================================================
+    // Conversations
+    // ========================================================================
+
+    /**
+     * Create a native chat history for the loaded model.
+     * @param handle Context handle
+     * @return Conversation id
+     * @throws org.codeshipping.llamakotlin.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeCreateConversation(handle: Long): Int
+
+    /**
+     * Free a conversation. No-op if it or the context is already gone.
+     * @param handle Context handle
+     * @param conversationId Conversation id
+     */
+    @JvmStatic
+    external fun nativeFreeConversation(handle: Long, conversationId: Int)
+
+    /**
+     * Append a message to a conversation, tokenizing only the new message.
+     * @param handle Context handle
+     * @param conversationId Conversation id
+     * @param role Message role
+     * @param content Message text
+     * @return Number of tokens the message added
+     * @throws org.codeshipping.llamakotlin.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeAppendMessage(handle: Long, conversationId: Int, role: String, content: String): Int
+
+    /**
+     * Number of tokens in a conversation's history.
+     * @param handle Context handle
+     * @param conversationId Conversation id
+     * @return Token count, -1 if the conversation doesn't exist
+     */
+    @JvmStatic
+    external fun nativeGetConversationTokenCount(handle: Long, conversationId: Int): Int
+
+    // ========================================================================
+    // LoRA Adapters
+    // ========================================================================
+
+    /**
+     * Load a LoRA adapter for the loaded model.
+     * @param handle Context handle
+     * @param path Path to the adapter .gguf file
+     * @return Adapter id, 0 on failure
+     */
+    @JvmStatic
+    external fun nativeLoadLoraAdapter(handle: Long, path: String): Int
+
+    /**
+     * Apply an adapter with a scale, or remove it with scale 0.
+     * @param handle Context handle
+     * @param adapterId Adapter id
+     * @param scale Adapter strength
+     * @return true if successful
+     */
+    @JvmStatic
+    external fun nativeSetLoraAdapter(handle: Long, adapterId: Int, scale: Float): Boolean
+
+    /**
+     * Remove every active adapter.
+     * @param handle Context handle
+     */
+    @JvmStatic
+    external fun nativeClearLoraAdapters(handle: Long)
+
+    /**
+     * Remove and free an adapter. No-op if it or the context is already gone.
+     * @param handle Context handle
+     * @param adapterId Adapter id
+     */
+    @JvmStatic
+    external fun nativeUnloadLoraAdapter(handle: Long, adapterId: Int)
+
     // ========================================================================
     // Generation Control
     // ========================================================================
@@ -147,6 +377,76 @@ internal object LlamaNative {
     @JvmStatic
     external fun nativeIsGenerating(handle: Long): Boolean
 
+    /**
+     * Get the draft acceptance rate of the last generation.
+     * @param handle Context handle
+     * @return Accepted / drafted tokens in [0, 1], or -1 if no draft model was used
+     */
+    @JvmStatic
+    external fun nativeGetDraftAcceptanceRate(handle: Long): Float
+
+    // ========================================================================
+    // Benchmark
+    // ========================================================================
+
+    /**
+     * Run the synthetic prefill/decode benchmark.
+     * @param handle Context handle
+     * @param promptTokens Prompt length for prefill and TTFT
+     * @param genTokens Tokens decoded per decode run
+     * @param reps Repetitions per measurement
+     * @return Flat result array, decoded by [BenchmarkResult.fromNative]
+     */
+    @JvmStatic
+    external fun nativeBenchmark(handle: Long, promptTokens: Int, genTokens: Int, reps: Int): DoubleArray
+
+    /**
+     * Get timings and counters of the most recently finished generation.
+     * @param handle Context handle
+     * @return Flat stats array, decoded by [GenerationStats.fromNative]
+     */
+    @JvmStatic
+    external fun nativeGetLastGenerationStats(handle: Long): DoubleArray
+
+    /**
+     * Estimate the memory a model file needs with a configuration from its GGUF header.
+     * @param modelPath Path to the .gguf model file
+     * @param config Configuration to plan for
+     * @return Estimated footprint
+     * @throws IllegalArgumentException if the file is not a readable GGUF model
+     */
+    @JvmStatic
+    external fun nativePlanLoad(modelPath: String, config: NativeConfig): LoadPlan
+
+    /**
+     * Estimate the KV cache memory of the loaded model for a configuration.
+     * @param handle Context handle
+     * @param config Configuration providing contextSize and the cache types
+     * @return Bytes, 0 if no model is loaded
+     */
+    @JvmStatic
+    external fun nativeEstimateKvCacheBytes(handle: Long, config: NativeConfig): Long
+
+    /**
+     * Compute one pooled embedding per text, packing the texts into shared batches.
+     * @param handle Context handle
+     * @param texts Input texts
+     * @param pooling [PoolingType.nativeValue]
+     * @param normalize L2-normalize each vector
+     * @return texts.size vectors back to back
+     * @throws org.codeshipping.llamakotlin.exception.LlamaException on failure
+     */
+    @JvmStatic
+    external fun nativeEmbed(handle: Long, texts: Array<String>, pooling: Int, normalize: Boolean): FloatArray
+
+    /**
+     * Forward an onTrimMemory level to the native context.
+     * @param handle Context handle
+     * @param level ComponentCallbacks2 trim level
+     */
+    @JvmStatic
+    external fun nativeTrimMemory(handle: Long, level: Int)
+
     // ========================================================================
     // Chat Template Support
     // ========================================================================
@@ -174,6 +474,55 @@ internal object LlamaNative {
     @JvmStatic
     external fun nativeGetChatTemplate(handle: Long): String
 
+    // ========================================================================
+    // State Snapshots
+    // ========================================================================
+
+    /**
+     * Save the KV cache state and cached tokens to a file.
+     * @param handle Context handle
+     * @param path Destination file path
+     * @return true if successful
+     */
+    @JvmStatic
+    external fun nativeSaveState(handle: Long, path: String): Boolean
+
+    /**
+     * Restore a KV cache state written by [nativeSaveState].
+     * @param handle Context handle
+     * @param path Source file path
+     * @return true if successful
+     */
+    @JvmStatic
+    external fun nativeRestoreState(handle: Long, path: String): Boolean
+
+    /**
+     * Get the buffer size needed by [nativeSaveStateToBuffer].
+     * @param handle Context handle
+     * @return Size in bytes
+     */
+    @JvmStatic
+    external fun nativeGetStateSize(handle: Long): Long
+
+    /**
+     * Save the KV cache state and cached tokens into a direct buffer.
+     * @param handle Context handle
+     * @param buffer Direct ByteBuffer with at least [nativeGetStateSize] bytes capacity
+     * @return Number of bytes written, 0 on failure
+     */
+    @JvmStatic
+    external fun nativeSaveStateToBuffer(handle: Long, buffer: ByteBuffer): Long
+
+    /**
+     * Restore a state written by [nativeSaveStateToBuffer].
+     * @param handle Context handle
+     * @param buffer Direct ByteBuffer holding the state
+     * @param length Number of valid bytes in the buffer
+     * @return true if successful
+     */
+    @JvmStatic
+    external fun nativeRestoreStateFromBuffer(handle: Long, buffer: ByteBuffer, length: Long): Boolean
+
     // ========================================================================
     // Error Handling
     // ========================================================================
@@ -198,17 +547,31 @@ internal object LlamaNative {
     class NativeConfig {
         @JvmField var contextSize: Int = 2048
         @JvmField var batchSize: Int = 512
+        @JvmField var parallelSequences: Int = 1
         @JvmField var threads: Int = 4
         @JvmField var threadsBatch: Int = 4
         @JvmField var temperature: Float = 0.7f
         @JvmField var topP: Float = 0.9f
         @JvmField var topK: Int = 40
         @JvmField var repeatPenalty: Float = 1.1f
+        @JvmField var grammar: String? = null
+        @JvmField var jsonSchema: String? = null
+        @JvmField var grammarTriggers: Array<String>? = null
         @JvmField var maxTokens: Int = 512
+        @JvmField var cacheReuse: Boolean = true
+        @JvmField var contextShift: Boolean = false
+        @JvmField var keepTokens: Int = 4
+        @JvmField var flashAttention: Boolean = false
+        @JvmField var cacheTypeK: String = "f16"
+        @JvmField var cacheTypeV: String = "f16"
         @JvmField var useMmap: Boolean = true
         @JvmField var useMlock: Boolean = false
+        @JvmField var warmup: Boolean = false
         @JvmField var gpuLayers: Int = 0
+        @JvmField var gpuDevice: String? = null
         @JvmField var seed: Int = -1
+        @JvmField var draftModelPath: String? = null
+        @JvmField var draftTokens: Int = 4
 
         companion object {
             /**
@@ -218,17 +581,31 @@ internal object LlamaNative {
                 return NativeConfig().apply {
                     contextSize = config.contextSize
                     batchSize = config.batchSize
+                    parallelSequences = config.parallelSequences
                     threads = config.threads
                     threadsBatch = config.effectiveThreadsBatch()
                     temperature = config.temperature
                     topP = config.topP
                     topK = config.topK
                     repeatPenalty = config.repeatPenalty
+                    grammar = config.grammar
+                    jsonSchema = config.jsonSchema
+                    grammarTriggers = config.grammarTriggers.toTypedArray()
                     maxTokens = config.maxTokens
+                    cacheReuse = config.cacheReuse
+                    contextShift = config.contextShift
+                    keepTokens = config.keepTokens
+                    flashAttention = config.flashAttention
+                    cacheTypeK = config.cacheTypeK.nativeName
+                    cacheTypeV = config.cacheTypeV.nativeName
                     useMmap = config.useMmap
                     useMlock = config.useMlock
+                    warmup = config.warmup
                     gpuLayers = config.gpuLayers
+                    gpuDevice = config.gpuDevice
                     seed = config.seed
+                    draftModelPath = config.draftModelPath
+                    draftTokens = config.draftTokens
                 }
             }
         }
@@ -246,4 +623,44 @@ internal object LlamaNative {
          */
         fun onToken(token: String)
     }
+
+    /**
+     * Callback interface for chunked streaming.
+     * Called from native code each time a chunk has been written to the shared buffer.
+     */
+    @Keep
+    interface NativeChunkCallback {
+        /**
+         * Called for each chunk of generated text.
+         * @param length Number of UTF-8 bytes written at the start of the buffer
+         */
+        fun onChunk(length: Int)
+    }
+
+    /**
+     * Callback interface for model load progress.
+     * Called from native code on the loading thread.
+     */
+    @Keep
+    interface NativeLoadProgressCallback {
+        /**
+         * Called as the weights are read and the warm-up runs.
+         * @param progress Fraction done, 0..1
+         */
+        fun onLoadProgress(progress: Float)
+    }
+
+    /**
+     * Callback interface for prefill progress.
+     * Called from native code after each prompt chunk has been decoded.
+     */
+    @Keep
+    interface NativeProgressCallback {
+        /**
+         * Called after each prefill chunk.
+         * @param processed Prompt tokens in the KV cache so far (including reused ones)
+         * @param total Prompt length in tokens
+         */
+        fun onPrefillProgress(processed: Int, total: Int)
+    }
 }
@@ -0,0 +1,35 @@
+package org.codeshipping.llamakotlin
+
+import androidx.annotation.Keep
+
+/**
+ * Memory a model would need with a configuration, see [LlamaModel.planLoad].
+ * Estimated from the GGUF header and tensor table, without loading the weights.
+ *
+ * @property weightBytes All tensors. Mmapped from the file, but every one is read for each
+ *   token, so they need to stay resident to avoid thrashing
+ * @property kvCacheBytes KV cache for [LlamaConfig.contextSize], [LlamaConfig.cacheTypeK] and [LlamaConfig.cacheTypeV]
+ * @property computeBytes Worst-case compute buffer of one prefill micro-batch
+ * @property availableBytes Memory available to the app right now (MemAvailable), 0 if unknown
+ * @property layerCount Repeating layers of the model
+ * @property contextLength Context length the model was trained with, 0 if not in the file
+ * @property gpuLayers Layers whose weights and KV cache fit the free memory of the GPU device
+ *   ([LlamaConfig.gpuDevice], or the one with the most free memory), 0 without a GPU backend
+ */
+data class LoadPlan @Keep constructor(
+    val weightBytes: Long,
+    val kvCacheBytes: Long,
+    val computeBytes: Long,
+    val availableBytes: Long,
+    val layerCount: Int,
+    val contextLength: Int,
+    val gpuLayers: Int
+) {
+    /** Weights, KV cache and compute buffer together */
+    val totalBytes: Long
+        get() = weightBytes + kvCacheBytes + computeBytes
+
+    /** Whether [totalBytes] fits in the memory available right now (false if unknown) */
+    val fitsInAvailableMemory: Boolean
+        get() = totalBytes <= availableBytes
+}
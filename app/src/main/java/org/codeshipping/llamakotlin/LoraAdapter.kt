@@ -0,0 +1,52 @@
+package org.codeshipping.llamakotlin
+
+import java.io.Closeable
+import java.util.concurrent.atomic.AtomicBoolean
+
+/**
+ * LoRA adapter loaded by [LlamaModel.loadLoraAdapter] on top of the model's base weights.
+ *
+ * Loading an adapter only reads its own weights, so several task-specific fine-tunes of the
+ * same base model share one copy of it. Switching between them with
+ * [LlamaModel.setLoraAdapter] takes milliseconds instead of a model reload.
+ *
+ * Example:
+ * ```kotlin
+ * val summarize = model.loadLoraAdapter(File(filesDir, "summarize.gguf").path)
+ * val translate = model.loadLoraAdapter(File(filesDir, "translate.gguf").path)
+ *
+ * model.setLoraAdapter(summarize)
+ * model.generate(article)
+ *
+ * model.clearLoraAdapters()
+ * model.setLoraAdapter(translate)
+ * model.generate(sentence)
+ * ```
+ */
+class LoraAdapter internal constructor(
+    private val model: LlamaModel,
+    internal val adapterId: Int,
+    /** Path the adapter was loaded from */
+    val path: String
+) : Closeable {
+
+    private val isClosed = AtomicBoolean(false)
+
+    internal fun ensureUsableWith(owner: LlamaModel) {
+        if (owner !== model) {
+            throw IllegalArgumentException("LoRA adapter belongs to another model")
+        }
+        if (isClosed.get()) {
+            throw IllegalStateException("LoRA adapter is closed")
+        }
+    }
+
+    /**
+     * Remove the adapter if active and free its weights. Also freed when the model is closed.
+     */
+    override fun close() {
+        if (isClosed.compareAndSet(false, true)) {
+            model.unloadLoraAdapter(adapterId)
+        }
+    }
+}
@@ -0,0 +1,18 @@
+package org.codeshipping.llamakotlin
+
+/**
+ * How token embeddings are pooled into one vector per text, see [LlamaModel.embed].
+ */
+enum class PoolingType(internal val nativeValue: Int) {
+    /** Pooling declared by the model (most embedding models set it in their GGUF metadata). */
+    DEFAULT(-1),
+
+    /** Average over all tokens (e.g. nomic-embed, all-MiniLM). */
+    MEAN(1),
+
+    /** Embedding of the first (CLS) token (e.g. BGE). */
+    CLS(2),
+
+    /** Embedding of the last token, for decoder-based embedding models (e.g. Qwen3-Embedding). */
+    LAST(3)
+}
@@ -33,6 +33,22 @@ sealed class LlamaException(
         cause: Throwable? = null
     ) : LlamaException("Generation failed: $message", cause)
 
+    /**
+     * Thrown when saving or restoring a KV cache state snapshot fails.
+     */
+    class StateError(
+        message: String,
+        cause: Throwable? = null
+    ) : LlamaException("State snapshot failed: $message", cause)
+
+    /**
+     * Thrown when a LoRA adapter can't be loaded or applied.
+     */
+    class AdapterError(
+        message: String,
+        cause: Throwable? = null
+    ) : LlamaException("LoRA adapter failed: $message", cause)
+
     /**
      * Thrown when the configuration is invalid.
      */
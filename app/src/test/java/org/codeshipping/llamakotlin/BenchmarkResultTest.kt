@@ -0,0 +1,48 @@
+package org.codeshipping.llamakotlin
+
+import org.junit.Test
+
+import org.junit.Assert.*
+
+/**
+ * Decoding of the flat array returned by [LlamaNative.nativeBenchmark].
+ */
+class BenchmarkResultTest {
+    @Test
+    fun fromNative_decodesPrefillAndDecodeRuns() {
+        val result = BenchmarkResult.fromNative(
+            doubleArrayOf(
+                120.5, 523_000.0,
+                2.0, 64.0, 210.0, 512.0, 340.0,
+                2.0, 2.0, 11.5, 85.0, 95.0, 4.0, 14.0, 70.0, 80.0
+            )
+        )
+
+        assertEquals(120.5, result.timeToFirstTokenMs, 0.0)
+        assertEquals(523_000L, result.peakRssKb)
+        assertEquals(
+            listOf(BenchmarkResult.Prefill(64, 210.0), BenchmarkResult.Prefill(512, 340.0)),
+            result.prefill
+        )
+        assertEquals(
+            listOf(
+                BenchmarkResult.Decode(2, 11.5, 85.0, 95.0),
+                BenchmarkResult.Decode(4, 14.0, 70.0, 80.0)
+            ),
+            result.decode
+        )
+        assertEquals(340.0, result.bestPrefillTokensPerSecond, 0.0)
+        assertEquals(14.0, result.bestDecodeTokensPerSecond, 0.0)
+        assertEquals(4, result.bestDecodeThreads)
+    }
+
+    @Test
+    fun fromNative_emptyRuns() {
+        val result = BenchmarkResult.fromNative(doubleArrayOf(0.0, 0.0, 0.0, 0.0))
+
+        assertTrue(result.prefill.isEmpty())
+        assertTrue(result.decode.isEmpty())
+        assertEquals(0.0, result.bestDecodeTokensPerSecond, 0.0)
+        assertNull(result.bestDecodeThreads)
+    }
+}
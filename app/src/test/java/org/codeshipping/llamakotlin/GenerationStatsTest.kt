@@ -0,0 +1,42 @@
+package org.codeshipping.llamakotlin
+
+import org.junit.Test
+
+import org.junit.Assert.*
+
+/**
+ * Decoding of the flat array returned by [LlamaNative.nativeGetLastGenerationStats].
+ */
+class GenerationStatsTest {
+    @Test
+    fun fromNative_decodesFieldsInOrder() {
+        val stats = GenerationStats.fromNative(
+            doubleArrayOf(1.5, 80.0, 95.0, 400.0, 12.5, 300.0, 120.0, 50.0, 1.0, 256.0, 40.0, 28.0)
+        )
+
+        assertEquals(
+            GenerationStats(
+                tokenizeMs = 1.5,
+                prefillMs = 80.0,
+                timeToFirstTokenMs = 95.0,
+                decodeMs = 400.0,
+                tokensPerSecond = 12.5,
+                promptTokens = 300,
+                reusedTokens = 120,
+                generatedTokens = 50,
+                truncated = true,
+                batchCapacity = 256,
+                draftedTokens = 40,
+                acceptedTokens = 28
+            ),
+            stats
+        )
+    }
+
+    @Test
+    fun fromNative_zeroMeansNotTruncated() {
+        val stats = GenerationStats.fromNative(DoubleArray(12))
+
+        assertFalse(stats.truncated)
+    }
+}
@@ -0,0 +1,52 @@
+package org.codeshipping.llamakotlin
+
+import org.codeshipping.llamakotlin.exception.LlamaException
+import org.junit.Test
+
+import org.junit.Assert.*
+
+/**
+ * [LlamaConfig.validate] rules for grammar, JSON schema and lazy grammar triggers.
+ */
+class GrammarConfigTest {
+    private fun assertInvalid(expected: String, config: LlamaConfig) {
+        val error = assertThrows(LlamaException.InvalidConfig::class.java) { config.validate() }
+        assertTrue(error.message!!.contains(expected))
+    }
+
+    @Test
+    fun grammarAndJsonSchema_areMutuallyExclusive() {
+        assertInvalid("mutually exclusive", LlamaConfig {
+            grammar = "root ::= \"yes\" | \"no\""
+            jsonSchema = "{\"type\": \"string\"}"
+        })
+    }
+
+    @Test
+    fun triggers_requireGrammarOrJsonSchema() {
+        assertInvalid("requires grammar or jsonSchema", LlamaConfig {
+            grammarTriggers = listOf("<tool_call>")
+        })
+    }
+
+    @Test
+    fun triggers_mustNotBeEmpty() {
+        assertInvalid("must not contain empty strings", LlamaConfig {
+            grammar = "root ::= \"yes\" | \"no\""
+            grammarTriggers = listOf("<tool_call>", "")
+        })
+    }
+
+    @Test
+    fun grammarOrJsonSchema_withTriggers_isValid() {
+        LlamaConfig {
+            grammar = "root ::= \"yes\" | \"no\""
+            grammarTriggers = listOf("<answer>")
+        }.validate()
+        LlamaConfig {
+            jsonSchema = "{\"type\": \"object\"}"
+            grammarTriggers = listOf("<tool_call>")
+        }.validate()
+        LlamaConfig.DEFAULT.validate()
+    }
+}
@@ -0,0 +1,36 @@
+package org.codeshipping.llamakotlin
+
+import org.codeshipping.llamakotlin.exception.LlamaException
+import org.junit.Test
+
+import org.junit.Assert.*
+
+/**
+ * KV cache type names passed to native code and the flash attention requirement.
+ */
+class KvCacheTypeTest {
+    @Test
+    fun nativeNames_matchLlamaCppTypeNames() {
+        assertEquals("f16", KvCacheType.F16.nativeName)
+        assertEquals("q8_0", KvCacheType.Q8_0.nativeName)
+        assertEquals("q4_0", KvCacheType.Q4_0.nativeName)
+    }
+
+    @Test
+    fun quantizedValueCache_requiresFlashAttention() {
+        val error = assertThrows(LlamaException.InvalidConfig::class.java) {
+            LlamaConfig { cacheTypeV = KvCacheType.Q8_0 }.validate()
+        }
+        assertTrue(error.message!!.contains("requires flashAttention"))
+    }
+
+    @Test
+    fun quantizedCaches_validWithFlashAttention() {
+        LlamaConfig {
+            cacheTypeK = KvCacheType.Q4_0
+            cacheTypeV = KvCacheType.Q8_0
+            flashAttention = true
+        }.validate()
+        LlamaConfig { cacheTypeK = KvCacheType.Q8_0 }.validate()
+    }
+}
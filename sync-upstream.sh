@@ -35,7 +35,7 @@ DIFF=$(git diff "$CURRENT_SHA" "$LATEST_SHA" -- include/llama.h include/llama-ch
 if [ -n "$DIFF" ]; then
     # Extract functions used in our JNI
     cd "$SCRIPT_DIR"
-    USED_FUNCS=$(grep -ohP 'llama_\w+|ggml_\w+' app/src/main/cpp/llama_jni.cpp app/src/main/cpp/llama_context_wrapper.cpp 2>/dev/null | sort -u)
+    USED_FUNCS=$(grep -ohP 'llama_\w+|ggml_\w+' app/src/main/cpp/*.cpp 2>/dev/null | sort -u)
 
     echo ""
     echo "⚠️  API changes detected. Checking functions we use:"